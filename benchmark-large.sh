@@ -0,0 +1,45 @@
+#
+# Compares large dictionaries against the default max_code of 32767,
+# with and without huge pages, on one big file. For each max_code and
+# page mode, prints the compressed size, the ratio, the compress and
+# decompress speeds in MB/s, and checks the round trip.
+#
+if [ "$1" == "" ]
+then
+   echo usage: benchmark-large.sh file [max-code ...]
+   echo ""
+   echo max-code defaults to 32767 1048575 16777215. The output of this
+   echo script looks nice when piped into "column -t"
+   exit
+fi
+file=$1
+shift
+codes="$@"
+if [ "$codes" == "" ]
+then
+    codes="32767 1048575 16777215"
+fi
+size=`stat $file --format=%s`
+echo "Max-code" "Pages" "LZW-size" "Ratio" "Compress-MB/s" "Decompress-MB/s"
+echo "--------" "-----" "--------" "-----" "-------------" "---------------"
+for max in $codes
+do
+    for pages in off thp
+    do
+        start=`date +%s%N`
+        ./lzw -pages $pages -max $max -c $file /tmp/$$.lzw
+        middle=`date +%s%N`
+        ./lzw -pages $pages -d /tmp/$$.lzw /tmp/$$.out
+        end=`date +%s%N`
+        packed=`stat /tmp/$$.lzw --format=%s`
+        echo $max $pages $packed \
+             `awk "BEGIN { printf \"%.3f %.1f %.1f\", $packed / $size, $size * 1000 / ($middle - $start), $size * 1000 / ($end - $middle) }"`
+        cmp $file /tmp/$$.out
+        if [ $? -ne 0 ]
+        then
+            echo "error compressing $file"
+            break 2
+        fi
+    done
+done
+rm -f /tmp/$$.lzw /tmp/$$.out
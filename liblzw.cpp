@@ -0,0 +1,311 @@
+//
+// Copyright (c) 2011 Mark Nelson
+//
+// This software is licensed under the OSI MIT License, contained in
+// the file license.txt included with this project.
+//
+// liblzw.cpp : The C interface declared in liblzw.h. This file
+// instantiates compress() and decompress() once for each of the
+// four code stream flavours, all reading and writing memory, and
+// dispatches to the right one based on the flavour stored in the
+// context.
+//
+
+#include <cstring>
+#include <new>
+
+#include "liblzw.h"
+#include "lzw_streambase.h"
+#include "lzw-a.h"
+#include "lzw-b.h"
+#include "lzw-c.h"
+#include "lzw-d.h"
+#include "lzw_memory.h"
+#include "lzw_header.h"
+#include "lzw.h"
+#include "lzw_block.h"
+
+//
+// The context holds the settings for the stream, a compressor and a
+// decompressor that are created on first use and then reused, so a
+// context used for many small messages stops allocating once its
+// dictionaries have grown to fit, plus a scratch buffer that is only
+// used when a headerless stream turns out to be too big for the
+// caller's buffer, to find out how much space is really needed.
+//
+struct lzw_context
+{
+    char flavour;
+    unsigned int max_code;
+    unsigned int flags;
+    lzw::compressor *compressor;
+    lzw::decompressor *decompressor;
+    std::string buffer;
+};
+
+namespace {
+
+bool valid_parameters( char flavour, unsigned int max_code )
+{
+    if ( max_code < 256 )
+        return false;
+    switch ( flavour ) {
+    case 'a' :
+    case 'c' :
+    case 'd' :
+        return max_code <= lzw::LARGEST_MAX_CODE;
+    case 'b' :
+        return max_code <= 0xffff;
+    default :
+        return false;
+    }
+}
+
+void release_contexts( lzw_context *ctx )
+{
+    delete ctx->compressor;
+    delete ctx->decompressor;
+    ctx->compressor = 0;
+    ctx->decompressor = 0;
+}
+
+template<char FLAVOUR, class OUTPUT>
+void compress_flavour( lzw_context *ctx, const char *input, size_t length, OUTPUT &out )
+{
+    if ( !ctx->compressor )
+        ctx->compressor = new lzw::compressor( ctx->max_code );
+    if ( ctx->flags & LZW_FLAG_BLOCKS ) {
+        lzw::block_writer writer( *ctx->compressor );
+        writer.write<FLAVOUR>( out, input, length );
+        writer.finish( out );
+        return;
+    }
+    lzw::memory_input in( input, length );
+    lzw::flavoured<lzw::memory_input,FLAVOUR> flavoured_in( in );
+    lzw::flavoured<OUTPUT,FLAVOUR> flavoured_out( out );
+    ctx->compressor->compress( flavoured_in, flavoured_out );
+}
+
+//
+// Returns false if the data is damaged, which can only be detected
+// when the stream is made of blocks.
+//
+template<char FLAVOUR, class OUTPUT>
+bool decompress_flavour( lzw_context *ctx, const lzw::stream_header &header, lzw::memory_input &in, OUTPUT &out )
+{
+    if ( !ctx->decompressor )
+        ctx->decompressor = new lzw::decompressor( ctx->max_code );
+    if ( header.has_blocks() ) {
+        lzw::block_reader reader( *ctx->decompressor );
+        reader.set_primed( header.has_primed() );
+        return reader.read<FLAVOUR>( in, out );
+    }
+    lzw::flavoured<lzw::memory_input,FLAVOUR> flavoured_in( in );
+    lzw::flavoured<OUTPUT,FLAVOUR> flavoured_out( out );
+    ctx->decompressor->decompress( flavoured_in, flavoured_out );
+    return true;
+}
+
+template<class OUTPUT>
+void compress_to( lzw_context *ctx, const char *input, size_t length, OUTPUT &out )
+{
+    if ( ctx->flags & (LZW_FLAG_RECORD_SIZE | LZW_FLAG_BLOCKS) ) {
+        lzw::stream_header header;
+        if ( ctx->flags & LZW_FLAG_RECORD_SIZE )
+            header.set_size( length );
+        if ( ctx->flags & LZW_FLAG_BLOCKS )
+            header.set_blocks();
+        header.set_flavour( ctx->flavour );
+        header.write( out );
+    }
+    switch ( ctx->flavour ) {
+    case 'a' : compress_flavour<'a'>( ctx, input, length, out ); break;
+    case 'b' : compress_flavour<'b'>( ctx, input, length, out ); break;
+    case 'c' : compress_flavour<'c'>( ctx, input, length, out ); break;
+    case 'd' : compress_flavour<'d'>( ctx, input, length, out ); break;
+    }
+}
+
+//
+// Headers written before the flavour was recorded don't have it, and
+// the context's flavour is the only guide.
+//
+template<class OUTPUT>
+bool decompress_to( lzw_context *ctx, const lzw::stream_header &header, lzw::memory_input &in, OUTPUT &out )
+{
+    switch ( header.has_flavour() ? header.flavour() : ctx->flavour ) {
+    case 'a' : return decompress_flavour<'a'>( ctx, header, in, out );
+    case 'b' : return decompress_flavour<'b'>( ctx, header, in, out );
+    case 'c' : return decompress_flavour<'c'>( ctx, header, in, out );
+    case 'd' : return decompress_flavour<'d'>( ctx, header, in, out );
+    }
+    return false;
+}
+
+} //namespace
+
+extern "C" {
+
+lzw_context *lzw_create( char flavour, unsigned int max_code )
+{
+    if ( !valid_parameters( flavour, max_code ) )
+        return 0;
+    lzw_context *ctx = new (std::nothrow) lzw_context;
+    if ( ctx ) {
+        ctx->flavour = flavour;
+        ctx->max_code = max_code;
+        ctx->flags = 0;
+        ctx->compressor = 0;
+        ctx->decompressor = 0;
+    }
+    return ctx;
+}
+
+int lzw_reset( lzw_context *ctx, char flavour, unsigned int max_code )
+{
+    if ( !ctx || !valid_parameters( flavour, max_code ) )
+        return LZW_ERROR_PARAMETER;
+    if ( max_code != ctx->max_code )
+        release_contexts( ctx );
+    ctx->flavour = flavour;
+    ctx->max_code = max_code;
+    return LZW_OK;
+}
+
+int lzw_set_flags( lzw_context *ctx, unsigned int flags )
+{
+    if ( !ctx || (flags & ~(LZW_FLAG_RECORD_SIZE | LZW_FLAG_BLOCKS)) )
+        return LZW_ERROR_PARAMETER;
+    ctx->flags = flags;
+    return LZW_OK;
+}
+
+//
+// Compression writes straight into the caller's buffer. If it doesn't
+// fit, buffer_output keeps counting, so we can still tell the caller
+// how big the output is without doing the work a second time.
+//
+int lzw_compress( lzw_context *ctx,
+                  const void *input, size_t input_length,
+                  void *output, size_t output_capacity,
+                  size_t *output_length )
+{
+    if ( !ctx || (!input && input_length) || (!output && output_capacity) || !output_length )
+        return LZW_ERROR_PARAMETER;
+    try {
+        lzw::buffer_output out( static_cast<char *>( output ), output_capacity );
+        compress_to( ctx, static_cast<const char *>( input ), input_length, out );
+        *output_length = out.tellp();
+        return out.overflow() ? LZW_ERROR_BUFFER_TOO_SMALL : LZW_OK;
+    } catch ( std::bad_alloc & ) {
+        return LZW_ERROR_MEMORY;
+    }
+}
+
+//
+// When the header records the original size, we know before decoding
+// a single code whether the caller's buffer is big enough, and when
+// decoding is done we can check that we got exactly what we expected.
+//
+int lzw_decompress( lzw_context *ctx,
+                    const void *input, size_t input_length,
+                    void *output, size_t output_capacity,
+                    size_t *output_length )
+{
+    if ( !ctx || (!input && input_length) || (!output && output_capacity) || !output_length )
+        return LZW_ERROR_PARAMETER;
+    const char *in = static_cast<const char *>( input );
+    lzw::stream_header header;
+    size_t header_length = 0;
+    if ( lzw::stream_header::present( in, input_length ) ) {
+        lzw::memory_input header_in( in, input_length );
+        if ( !header.read( header_in ) )
+            return LZW_ERROR_DATA;
+        header_length = header_in.tellg();
+        if ( header.has_symbols() || header.has_filters() )
+            return LZW_ERROR_DATA;
+        if ( header.has_max_code() && header.max_code() != ctx->max_code )
+            return LZW_ERROR_PARAMETER;
+        if ( header.has_flavour() && !valid_parameters( header.flavour(), ctx->max_code ) )
+            return LZW_ERROR_PARAMETER;
+        if ( header.has_size() && header.size() > output_capacity ) {
+            *output_length = (size_t) header.size();
+            return LZW_ERROR_BUFFER_TOO_SMALL;
+        }
+    }
+    try {
+        lzw::buffer_output out( static_cast<char *>( output ), output_capacity );
+        try {
+            lzw::memory_input codes( in + header_length, input_length - header_length );
+            const bool ok = decompress_to( ctx, header, codes, out );
+            *output_length = out.tellp();
+            if ( !ok || (header.has_size() && header.size() != out.tellp()) )
+                return LZW_ERROR_DATA;
+            if ( out.overflow() )
+                return LZW_ERROR_BUFFER_TOO_SMALL;
+            return LZW_OK;
+        } catch ( lzw::buffer_overflow & ) {
+            if ( header.has_size() )
+                return LZW_ERROR_DATA;
+        }
+        ctx->buffer.clear();
+        lzw::memory_output scratch( ctx->buffer );
+        lzw::memory_input codes( in + header_length, input_length - header_length );
+        decompress_to( ctx, header, codes, scratch );
+        *output_length = ctx->buffer.size();
+        return LZW_ERROR_BUFFER_TOO_SMALL;
+    } catch ( std::bad_alloc & ) {
+        return LZW_ERROR_MEMORY;
+    }
+}
+
+int lzw_decompressed_size( const void *input, size_t input_length, size_t *size )
+{
+    if ( (!input && input_length) || !size )
+        return LZW_ERROR_PARAMETER;
+    const char *in = static_cast<const char *>( input );
+    lzw::stream_header header;
+    lzw::memory_input header_in( in, input_length );
+    if ( !lzw::stream_header::present( in, input_length ) || !header.read( header_in ) || !header.has_size() )
+        return LZW_ERROR_DATA;
+    *size = (size_t) header.size();
+    return LZW_OK;
+}
+
+//
+// The decompressor needs less per code than the compressor, so the
+// compressor is the one that sets the limit.
+//
+unsigned int lzw_max_code_for_memory( size_t bytes, unsigned int max_code )
+{
+    return lzw::max_code_for_budget<lzw::compressor>( bytes, max_code );
+}
+
+size_t lzw_peak_memory( const lzw_context *ctx )
+{
+    if ( !ctx )
+        return 0;
+    return (ctx->compressor ? ctx->compressor->peak_bytes() : 0) +
+           (ctx->decompressor ? ctx->decompressor->peak_bytes() : 0);
+}
+
+void lzw_free( lzw_context *ctx )
+{
+    if ( ctx )
+        release_contexts( ctx );
+    delete ctx;
+}
+
+const char *lzw_error_string( int error )
+{
+    switch ( error ) {
+    case LZW_OK :                     return "success";
+    case LZW_ERROR_PARAMETER :        return "invalid parameter";
+    case LZW_ERROR_BUFFER_TOO_SMALL : return "output buffer too small";
+    case LZW_ERROR_MEMORY :           return "out of memory";
+    case LZW_ERROR_DATA :             return "invalid compressed data";
+    default :                         return "unknown error";
+    }
+}
+
+} //extern "C"
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2011 Mark Nelson
+ *
+ * This software is licensed under the OSI MIT License, contained in
+ * the file license.txt included with this project.
+ *
+ * liblzw.h : C interface to the LZW library built by the Makefile.
+ *
+ * The C++ templates in lzw.h and the lzw-a.h through lzw-d.h headers
+ * are the real implementation. This interface wraps them in an opaque
+ * context so that programs written in C, or in C++ built with a
+ * different compiler, can link against liblzw.a or liblzw.so and pick
+ * the code stream flavour at runtime. All four flavours are compiled
+ * into the library.
+ *
+ * A typical use looks like this:
+ *
+ *     lzw_context *ctx = lzw_create( 'd', 32767 );
+ *     size_t length;
+ *     if ( lzw_compress( ctx, in, in_length, out, out_capacity, &length ) == LZW_OK )
+ *         ...
+ *     lzw_free( ctx );
+ *
+ * If the output buffer is too small, the call returns
+ * LZW_ERROR_BUFFER_TOO_SMALL and stores the required size in
+ * *output_length, so the caller can grow the buffer and try again.
+ *
+ * Both calls write directly into the caller's buffer. If the context
+ * has LZW_FLAG_RECORD_SIZE set, lzw_compress() precedes the code
+ * stream with a header holding the original size. The receiver can
+ * then call lzw_decompressed_size() to allocate exactly the right
+ * amount of memory, once, and lzw_decompress() fails immediately
+ * if the buffer it is given is too small, without decoding anything.
+ * lzw_decompress() accepts data with or without the header.
+ *
+ * If LZW_FLAG_BLOCKS is set, the input is split into blocks, and any
+ * block that doesn't get smaller when compressed, like JPEG or gzip
+ * data, is stored as is. That limits the expansion on incompressible
+ * data to a few bytes per block, and it is much faster, since blocks
+ * that look random are copied without being compressed at all. The
+ * format is described in lzw_block.h.
+ *
+ * Streams written by the lzw program record max_code in the header.
+ * lzw_decompress() returns LZW_ERROR_PARAMETER if that doesn't match
+ * the context, and lzw_reset() can be used to make it match.
+ *
+ * A header written by lzw_compress() also records the flavour, unless
+ * it is 'd', the default. lzw_decompress() decodes a stream whose
+ * header names a flavour with that flavour, whatever the context was
+ * created with, and uses the context's flavour for everything else.
+ *
+ * The memory a context uses is almost all dictionary, and the
+ * dictionary stops growing at max_code. lzw_max_code_for_memory()
+ * returns the largest max_code, up to the one given, whose dictionary
+ * is sure to fit in the given number of bytes, on either side, or 0
+ * if none will. lzw_peak_memory() reports the most dictionary memory
+ * the context has actually held at one time.
+ */
+#ifndef LIBLZW_DOT_H
+#define LIBLZW_DOT_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct lzw_context lzw_context;
+
+#define LZW_OK                       0
+#define LZW_ERROR_PARAMETER         -1
+#define LZW_ERROR_BUFFER_TOO_SMALL  -2
+#define LZW_ERROR_MEMORY            -3
+#define LZW_ERROR_DATA              -4
+
+#define LZW_FLAG_RECORD_SIZE        0x01
+#define LZW_FLAG_BLOCKS             0x02
+
+/*
+ * flavour is one of 'a', 'b', 'c', or 'd', selecting the code
+ * stream format from the matching header. max_code must be at
+ * least 256, and no more than 65535 for 'b' or 0x7fffffff for the
+ * others. Returns NULL if either parameter is invalid, or
+ * if memory can't be allocated.
+ */
+lzw_context *lzw_create( char flavour, unsigned int max_code );
+int lzw_reset( lzw_context *ctx, char flavour, unsigned int max_code );
+int lzw_set_flags( lzw_context *ctx, unsigned int flags );
+int lzw_compress( lzw_context *ctx,
+                  const void *input, size_t input_length,
+                  void *output, size_t output_capacity,
+                  size_t *output_length );
+int lzw_decompress( lzw_context *ctx,
+                    const void *input, size_t input_length,
+                    void *output, size_t output_capacity,
+                    size_t *output_length );
+/*
+ * Returns LZW_ERROR_DATA if the compressed data doesn't begin
+ * with a header that records the original size.
+ */
+int lzw_decompressed_size( const void *input, size_t input_length, size_t *size );
+unsigned int lzw_max_code_for_memory( size_t bytes, unsigned int max_code );
+size_t lzw_peak_memory( const lzw_context *ctx );
+void lzw_free( lzw_context *ctx );
+const char *lzw_error_string( int error );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* #ifndef LIBLZW_DOT_H */
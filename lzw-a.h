@@ -8,6 +8,7 @@
 #define LZW_A_DOT_H
 
 #include "lzw_streambase.h"
+#include "lzw_iostream.h"
 #include <iostream>
 
 //
@@ -18,46 +19,11 @@
 // way to be able to debug the output stream, as it can be loaded
 // into a text editor.
 //
-namespace lzw {
-
-//
-// It's tempting to try to read characters using the ifstream
-// extraction operator, as in m_impl >> c, but that operator
-// skips over whitespace, so we don't get an exact copy of 
-// the input stream. Using get() works around this problem.
+// The symbol classes are shared by all four flavours, and are found
+// in lzw_iostream.h. The code classes are written for flavoured<T,'a'>,
+// so they work with any byte stream T, not just the iostreams classes.
 //
-template<>
-class input_symbol_stream<std::istream> {
-public :
-    input_symbol_stream( std::istream &input ) 
-        : m_input( input ) {}
-    bool operator>>( char &c )
-    {
-        if ( !m_input.get( c ) )
-            return false;
-        else
-            return true;
-    }
-private :
-    std::istream &m_input;
-};
-//
-// Using the insertion operator to output strings seems to work properly,
-// even when the strings contain binary data, so this implementation is
-// as simple as we could hope for.
-//
-template<>
-class output_symbol_stream<std::ostream> {
-public :
-    output_symbol_stream( std::ostream &output ) 
-        : m_output( output ) {}
-    void operator<<( const std::string &s )
-    {
-        m_output << s;
-    }
-private :
-    std::ostream &m_output;
-};
+namespace lzw {
 
 //
 // LZW-A prints the text values of integers to the output
@@ -65,59 +31,110 @@ private :
 // efficient at all, but it is much easier to debug. If
 // you are having a problem with the algorithm, this provides
 // a great way to examine your stream. The implementation
-// of this is very simple - just using the std::ostream
-// insertion operator, and following each code by a newline
+// of this is very simple - just converting the integer to
+// decimal digits, and following each code by a newline
 // so it can properly parse on input, as well as be easilyr loaded
 // into a text editor.
 //
-// One important thing to notice in this class: the presence of 
+// One important thing to notice in this class: the presence of
 // a destructor that prints the EOF_CODE. Since this object goes
 // out of scope as the compressor exists, this insures that every
-// code stream will end with this special code. Putting the onus on 
+// code stream will end with this special code. Putting the onus on
 // the I/O routines to deal with EOF issues simplifies the
 // algorithm itself.
 //
-template<>
-class output_code_stream<std::ostream> {
+template<class T>
+class output_code_stream< flavoured<T,'a'> > {
 public :
-    output_code_stream( std::ostream &output, const int ) 
-        : m_output( output ) {}
+    output_code_stream( flavoured<T,'a'> output, const int )
+        : m_output( output.stream() ) {}
     void operator<<( unsigned int i )
     {
-        m_output << i << '\n';
+        char digits[ 16 ];
+        int n = 0;
+        do {
+            digits[ n++ ] = '0' + i % 10;
+            i /= 10;
+        } while ( i );
+        while ( n )
+            m_output.put( digits[ --n ] );
+        m_output.put( '\n' );
     }
     ~output_code_stream()
     {
         *this << EOF_CODE;
     }
+    //
+    // Fixed width codes don't care where the dictionary starts.
+    //
+    void preset( unsigned int ) {}
 private :
-    std::ostream &m_output;
+    T &m_output;
 };
 
 //
 // The corresponding version of the input operator
 // just reads in the white-space separated codes.
 // If there is an error or an EOF_CODE encountered
-// in the stream, the extraction operator returns 
+// in the stream, the extraction operator returns
 // false, which allows the decompressor to know
 // when it is time to stop processing.
 //
-template<>
-class input_code_stream<std::istream> {
+template<class T>
+class input_code_stream< flavoured<T,'a'> > {
 public :
-    input_code_stream( std::istream &input, unsigned int ) 
-        : m_input( input ) {}
+    input_code_stream( flavoured<T,'a'> input, unsigned int )
+        : m_input( input.stream() ) {}
     bool operator>>( unsigned int &i )
     {
-        m_input >> i;
-        if ( !m_input || i == EOF_CODE )
+        char c;
+        do {
+            if ( !m_input.get( c ) )
+                return false;
+        } while ( c == ' ' || c == '\t' || c == '\r' || c == '\n' );
+        if ( c < '0' || c > '9' )
+            return false;
+        i = 0;
+        do {
+            i = i * 10 + (c - '0');
+            if ( !m_input.get( c ) )
+                break;
+        } while ( c >= '0' && c <= '9' );
+        if ( i == EOF_CODE )
             return false;
         else
             return true;
     }
+    //
+    // Fixed width codes don't care where the dictionary starts.
+    //
+    void preset( unsigned int ) {}
 private :
-    std::istream &m_input;
+    T &m_input;
+};
+
+//
+// The first flavour header included in a program gets to decide what
+// format is used when compress() and decompress() are called with
+// plain std::istream and std::ostream objects, just as they were when
+// only one of these headers could be included at a time.
+//
+#ifndef LZW_IOSTREAM_FLAVOUR
+#define LZW_IOSTREAM_FLAVOUR 'a'
+template<>
+class output_code_stream<std::ostream> : public output_code_stream< flavoured<std::ostream,'a'> > {
+public :
+    output_code_stream( std::ostream &output, const int max_code )
+        : output_code_stream< flavoured<std::ostream,'a'> >( output, max_code ) {}
+};
+
+template<>
+class input_code_stream<std::istream> : public input_code_stream< flavoured<std::istream,'a'> > {
+public :
+    input_code_stream( std::istream &input, unsigned int max_code )
+        : input_code_stream< flavoured<std::istream,'a'> >( input, max_code ) {}
 };
+#endif
 
 }; //namespace lzw
 
@@ -8,55 +8,17 @@
 #define LZW_B_DOT_H
 
 #include "lzw_streambase.h"
+#include "lzw_iostream.h"
 #include <iostream>
 
 //
 // lzw-b specializes the four I/O classes for std::istream and std::ostream.
-// The symbol I/O classes are identical to those in lzw-a.h, but the code
-// I/O classes have to be completely different.
+// The symbol I/O classes are identical to those in lzw-a.h, and are shared
+// in lzw_iostream.h, but the code I/O classes have to be completely different.
 //
 
 namespace lzw {
 
-//
-// It's tempting to try to read characters using the ifstream
-// extraction operator, as in m_impl >> c, but that operator
-// skips over whitespace, so we don't get an exact copy of 
-// the input stream. Using get() works around this problem.
-//
-template<>
-class input_symbol_stream<std::istream> {
-public :
-    input_symbol_stream( std::istream &input ) 
-        : m_input( input ) {}
-    bool operator>>( char &c )
-    {
-        if ( !m_input.get( c ) )
-            return false;
-        else
-            return true;
-    }
-private :
-    std::istream &m_input;
-};
-//
-// Using the insertion operator to output strings seems to work properly,
-// even when the strings contain binary data, so this implementation is
-// as simple as we could hope for.
-//
-template<>
-class output_symbol_stream<std::ostream> {
-public :
-    output_symbol_stream( std::ostream &output ) 
-        : m_output( output ) {}
-    void operator<<( const std::string &s )
-    {
-        m_output << s;
-    }
-private :
-    std::ostream &m_output;
-};
-
 //
 // Writing the codes to std::ostream as binary values requires breaking
 // the integer code into two bytes and writing the bytes one at a time. There are
@@ -64,11 +26,11 @@ private :
 // function call, but they raise code portability problems, as we
 // don't always know what order bytes will be written in.
 //
-template<>
-class output_code_stream<std::ostream> {
+template<class T>
+class output_code_stream< flavoured<T,'b'> > {
 public :
-    output_code_stream( std::ostream &output, const int ) 
-        : m_output( output ) {}
+    output_code_stream( flavoured<T,'b'> output, const int )
+        : m_output( output.stream() ) {}
     void operator<<( unsigned int i )
     {
         m_output.put( i & 0xff );
@@ -78,8 +40,12 @@ public :
     {
         *this << EOF_CODE;
     }
+    //
+    // Fixed width codes don't care where the dictionary starts.
+    //
+    void preset( unsigned int ) {}
 private :
-    std::ostream &m_output;
+    T &m_output;
 };
 //
 // Reading the codes requires reading the
@@ -90,11 +56,11 @@ private :
 // It also returns false if there is an error
 // on the input stream.
 //
-template<>
-class input_code_stream<std::istream> {
+template<class T>
+class input_code_stream< flavoured<T,'b'> > {
 public :
-    input_code_stream( std::istream &input, unsigned int ) 
-        : m_input( input ) {}
+    input_code_stream( flavoured<T,'b'> input, unsigned int )
+        : m_input( input.stream() ) {}
     bool operator>>( unsigned int &i )
     {
         char c;
@@ -109,9 +75,35 @@ public :
         else
             return true;
     }
+    //
+    // Fixed width codes don't care where the dictionary starts.
+    //
+    void preset( unsigned int ) {}
 private :
-    std::istream &m_input;
+    T &m_input;
+};
+
+//
+// The first flavour header included in a program gets to decide what
+// format is used when compress() and decompress() are called with
+// plain std::istream and std::ostream objects.
+//
+#ifndef LZW_IOSTREAM_FLAVOUR
+#define LZW_IOSTREAM_FLAVOUR 'b'
+template<>
+class output_code_stream<std::ostream> : public output_code_stream< flavoured<std::ostream,'b'> > {
+public :
+    output_code_stream( std::ostream &output, const int max_code )
+        : output_code_stream< flavoured<std::ostream,'b'> >( output, max_code ) {}
+};
+
+template<>
+class input_code_stream<std::istream> : public input_code_stream< flavoured<std::istream,'b'> > {
+public :
+    input_code_stream( std::istream &input, unsigned int max_code )
+        : input_code_stream< flavoured<std::istream,'b'> >( input, max_code ) {}
 };
+#endif
 
 }; //namespace lzw
 
@@ -8,6 +8,9 @@
 #define LZW_C_DOT_H
 
 #include "lzw_streambase.h"
+#include "lzw_iostream.h"
+#include "lzw_memory.h"
+#include "lzw_unpack.h"
 #include <iostream>
 
 //
@@ -17,51 +20,14 @@
 // codes based on that width, which will normally be something in the range of 9-18.
 //
 // Since these values are no aligned with byte boundaries, there are some issues writing
-// them to streams that expect to read and write bytes. 
+// them to streams that expect to read and write bytes.
 //
-// Note that the code to read and write symbols is unchanged from lzw-a.h and lzw-b.h
+// Note that the code to read and write symbols is unchanged from lzw-a.h and lzw-b.h,
+// and is shared with them in lzw_iostream.h.
 
 namespace lzw {
 //
-// It's tempting to try to read characters using the ifstream
-// extraction operator, as in m_impl >> c, but that operator
-// skips over whitespace, so we don't get an exact copy of 
-// the input stream. Using get() works around this problem.
-//
-template<>
-class input_symbol_stream<std::istream> {
-public :
-    input_symbol_stream( std::istream &input ) 
-        : m_input( input ) {}
-    bool operator>>( char &c )
-    {
-        if ( !m_input.get( c ) )
-            return false;
-        else
-            return true;
-    }
-private :
-    std::istream &m_input;
-};
-//
-// Using the insertion operator to output strings seems to work properly,
-// even when the strings contain binary data, so this implementation is
-// as simple as we could hope for.
-//
-template<>
-class output_symbol_stream<std::ostream> {
-public :
-    output_symbol_stream( std::ostream &output ) 
-        : m_output( output ) {}
-    void operator<<( const std::string &s )
-    {
-        m_output << s;
-    }
-private :
-    std::ostream &m_output;
-};
-//
-// The constructor has to initialize the number of bits in the code. 
+// The constructor has to initialize the number of bits in the code.
 // This value is calculated from the max_code parameter, and is
 // stored in member m_code_size, where it is used frequently.
 //
@@ -82,12 +48,18 @@ private :
 // part of a code - the code will be EOF_CODE, and that is the
 // last one.
 //
-template<>
-class output_code_stream<std::ostream>
+// Up to 7 bits are left over after each flush, so the pending bits
+// have to hold a code plus 7 more. They used to be kept in a 32 bit
+// integer, which quietly broke once codes passed 25 bits. A 64 bit
+// accumulator costs nothing on a 64 bit machine, and handles codes as
+// wide as LARGEST_MAX_CODE in lzw_streambase.h allows.
+//
+template<class T>
+class output_code_stream< flavoured<T,'c'> >
 {
 public :
-    output_code_stream( std::ostream &out, unsigned int max_code ) 
-        : m_output( out ),
+    output_code_stream( flavoured<T,'c'> out, unsigned int max_code )
+        : m_output( out.stream() ),
           m_pending_bits(0),
           m_pending_output(0),
           m_code_size(1)
@@ -102,10 +74,14 @@ public :
     }
     void operator<<( const int &i )
     {
-        m_pending_output |= i << m_pending_bits;
+        m_pending_output |= (unsigned long long) (unsigned int) i << m_pending_bits;
         m_pending_bits += m_code_size;
         flush( 8 );
     }
+    //
+    // Fixed width codes don't care where the dictionary starts.
+    //
+    void preset( unsigned int ) {}
 private :
     void flush( const int val )
     {
@@ -115,15 +91,15 @@ private :
             m_pending_bits -= 8;
         }
     }
-    std::ostream & m_output;
+    T & m_output;
     int m_code_size;
     int m_pending_bits;
-    unsigned int m_pending_output;
+    unsigned long long m_pending_output;
 };
 //
 // Like the output class, the input class has to calculate the code
 // size for this decompression based on the max_code value passed
-// in the function call. 
+// in the function call.
 //
 // When an attempt is made to read a code, there must be a
 // minimum of m_code_size bits in member m_pending_input.
@@ -134,13 +110,13 @@ private :
 // in and appropriately masked, the m_pending_input
 // count is reduced, and the m_available_bits member is
 // reduced accordingly.
-// 
-template<>
-class input_code_stream<std::istream>
+//
+template<class T>
+class input_code_stream< flavoured<T,'c'> >
 {
 public :
-    input_code_stream( std::istream &in, unsigned int max_code ) 
-        : m_input( in ),
+    input_code_stream( flavoured<T,'c'> in, unsigned int max_code )
+        : m_input( in.stream() ),
           m_available_bits(0),
           m_pending_input(0),
           m_code_size(1)
@@ -155,23 +131,144 @@ public :
             char c;
             if ( !m_input.get(c) )
                 return false;
-            m_pending_input |= (c & 0xff) << m_available_bits;
+            m_pending_input |= (unsigned long long) (c & 0xff) << m_available_bits;
             m_available_bits += 8;
         }
-        i = m_pending_input & ~(~0 << m_code_size);
+        i = (unsigned int) (m_pending_input & ~(~0ull << m_code_size));
         m_pending_input >>= m_code_size;
         m_available_bits -= m_code_size;
-        if ( i == EOF_CODE )
+        if ( i == EOF_CODE ) {
+            //
+            // The writer always ends with one byte more than the codes
+            // need, which we have already read unless EOF_CODE ended on
+            // a byte boundary. Taking it leaves the input just past the
+            // stream, where the next one, if any, starts.
+            //
+            char c;
+            if ( !m_available_bits )
+                m_input.get( c );
+            m_available_bits = 0;
+            m_pending_input = 0;
             return false;
-        else
-            return true;
-}
+        }
+        return true;
+    }
+    //
+    // Fixed width codes don't care where the dictionary starts.
+    //
+    void preset( unsigned int ) {}
 private :
-    std::istream & m_input;
+    T & m_input;
     int m_code_size;
     int m_available_bits;
-    unsigned int m_pending_input;
+    unsigned long long m_pending_input;
+};
+
+//
+// When the codes are coming out of memory, they don't have to be read
+// one at a time. This version unpacks them BATCH at a time with one of
+// the routines in lzw_unpack.h, and operator>> just hands them out of
+// m_codes. The position in the input is m_input.next() plus m_shift
+// bits, and it is only moved past a batch when the next one is needed,
+// so when EOF_CODE turns up the input can be left just after the
+// padding byte that follows it, exactly where the byte at a time
+// version would leave it.
+// Near the end of the input, where the unpackers would read too far,
+// the last few codes are put together a byte at a time.
+//
+template<>
+class input_code_stream< flavoured<memory_input,'c'> >
+{
+public :
+    enum { BATCH = 64 };
+    input_code_stream( flavoured<memory_input,'c'> in, unsigned int max_code )
+        : m_input( in.stream() ),
+          m_unpack( unpack_codes() ),
+          m_code_size(1),
+          m_shift(0),
+          m_count(0),
+          m_next(0)
+    {
+        while ( max_code >>= 1 )
+            m_code_size++;
+    }
+    bool operator>>( unsigned int & i )
+    {
+        if ( m_next == m_count && !refill() )
+            return false;
+        i = m_codes[ m_next++ ];
+        if ( i == EOF_CODE ) {
+            const size_t used = (size_t) ((m_shift + (unsigned long long) m_next * m_code_size) >> 3) + 1;
+            m_input.skip( used < m_input.available() ? used : m_input.available() );
+            m_shift = m_count = m_next = 0;
+            return false;
+        }
+        return true;
+    }
+    //
+    // Fixed width codes don't care where the dictionary starts.
+    //
+    void preset( unsigned int ) {}
+private :
+    bool refill()
+    {
+        const unsigned long long used = m_shift + (unsigned long long) m_count * m_code_size;
+        m_input.skip( (size_t) (used >> 3) );
+        m_shift = (unsigned int) (used & 7);
+        m_count = m_next = 0;
+        const unsigned char *data = (const unsigned char *) m_input.next();
+        const size_t available = m_input.available();
+        if ( available >= BATCH / 8 * m_code_size + UNPACK_SLACK ) {
+            m_unpack( data, m_shift, m_code_size, m_codes, BATCH );
+            m_count = BATCH;
+            return true;
+        }
+        unsigned long long bits = available * 8ull - m_shift;
+        for ( ; m_count < BATCH && bits >= m_code_size ; m_count++, bits -= m_code_size ) {
+            const unsigned long long bit = m_shift + (unsigned long long) m_count * m_code_size;
+            const unsigned int last = (unsigned int) ((bit + m_code_size - 1) >> 3);
+            unsigned long long code = 0;
+            for ( unsigned int j = last + 1 ; j-- > (unsigned int) (bit >> 3) ; )
+                code = (code << 8) | data[ j ];
+            m_codes[ m_count ] = (unsigned int) ((code >> (bit & 7)) & ~(~0ull << m_code_size));
+        }
+        if ( !m_count ) {
+            m_input.skip( available );
+            m_shift = 0;
+            return false;
+        }
+        return true;
+    }
+    memory_input & m_input;
+    unpack_function m_unpack;
+    unsigned int m_code_size;
+    unsigned int m_shift;
+    unsigned int m_count;
+    unsigned int m_next;
+    unsigned int m_codes[ BATCH ];
+};
+
+//
+// The first flavour header included in a program gets to decide what
+// format is used when compress() and decompress() are called with
+// plain std::istream and std::ostream objects.
+//
+#ifndef LZW_IOSTREAM_FLAVOUR
+#define LZW_IOSTREAM_FLAVOUR 'c'
+template<>
+class output_code_stream<std::ostream> : public output_code_stream< flavoured<std::ostream,'c'> > {
+public :
+    output_code_stream( std::ostream &output, unsigned int max_code )
+        : output_code_stream< flavoured<std::ostream,'c'> >( output, max_code ) {}
+};
+
+template<>
+class input_code_stream<std::istream> : public input_code_stream< flavoured<std::istream,'c'> > {
+public :
+    input_code_stream( std::istream &input, unsigned int max_code )
+        : input_code_stream< flavoured<std::istream,'c'> >( input, max_code ) {}
 };
+#endif
 
 }; //namespace lzw
 
@@ -8,60 +8,24 @@
 #define LZW_D_DOT_H
 
 #include "lzw_streambase.h"
+#include "lzw_iostream.h"
 #include <iostream>
 
 //
 // I'm using ifstream and ofstream for my input and output. This means
 // I need to create four specialized routines that read and write
-// symbols and codes.
+// symbols and codes. The symbol routines are shared by all the flavours,
+// and live in lzw_iostream.h.
 
 namespace lzw {
-//
-// It's tempting to try to read characters using the ifstream
-// extraction operator, as in m_impl >> c, but that operator
-// skips over whitespace, so we don't get an exact copy of 
-// the input stream. Using get() works around this problem.
-//
-template<>
-class input_symbol_stream<std::istream> {
-public :
-    input_symbol_stream( std::istream &input ) 
-        : m_input( input ) {}
-    bool operator>>( char &c )
-    {
-        if ( !m_input.get( c ) )
-            return false;
-        else
-            return true;
-    }
-private :
-    std::istream &m_input;
-};
-//
-// Using the insertion operator to output strings seems to work properly,
-// even when the strings contain binary data, so this implementation is
-// as simple as we could hope for.
-//
-template<>
-class output_symbol_stream<std::ostream> {
-public :
-    output_symbol_stream( std::ostream &output ) 
-        : m_output( output ) {}
-    void operator<<( const std::string &s )
-    {
-        m_output << s;
-    }
-private :
-    std::ostream &m_output;
-};
 
 //
 // lzw-d uses variable length integers in the code stream. The first code issued is 9 bits wide,
-// and as the dictionary grows, it works its way up to the maximum size. 
+// and as the dictionary grows, it works its way up to the maximum size.
 //
 // The basics of the variable length bit stream work identically to that from lzw-c.h. However,
 // we have the addition of a couple of new members: m_current_code, m_next_bump, and m_max_code.
-// We know that when the encoder starts, the highest possible code it can issue the first time 
+// We know that when the encoder starts, the highest possible code it can issue the first time
 // it is called will be 256. We also know that each time it is called that maximum code can be
 // incremented by one. So the initial value of m_code_size is set to 9, and m_next_bump is set to
 // 512, indicating that the code size has to be bumped when m_current_code reaches 512.
@@ -69,12 +33,18 @@ private :
 // The steady increase in the code size continues until m_current_code reaches m_max_code_size,
 // and from then on the code size is fixed.
 //
-template<>
-class output_code_stream<std::ostream>
+// When the dictionary starts out with more than the 256 roots, preset() moves m_current_code
+// ahead to match, and bumps the code size as many times as needed to get there.
+//
+// Like lzw-c, the pending bits are kept in 64 bits, so codes can grow as wide as
+// LARGEST_MAX_CODE allows. m_next_bump stops at 1u << 31, just past the biggest code.
+//
+template<class T>
+class output_code_stream< flavoured<T,'d'> >
 {
 public :
-    output_code_stream( std::ostream &output, unsigned int max_code ) 
-        : m_output( output ),
+    output_code_stream( flavoured<T,'d'> output, unsigned int max_code )
+        : m_output( output.stream() ),
           m_pending_bits(0),
           m_pending_output(0),
           m_code_size(9),
@@ -89,7 +59,7 @@ public :
     }
     void operator<<( const unsigned int &i )
     {
-        m_pending_output |= i << m_pending_bits;
+        m_pending_output |= (unsigned long long) i << m_pending_bits;
         m_pending_bits += m_code_size;
         flush( 8 );
         if ( m_current_code < m_max_code ) {
@@ -100,6 +70,14 @@ public :
             }
         }
     }
+    void preset( unsigned int next_code )
+    {
+        m_current_code = next_code - 1 < m_max_code ? next_code - 1 : m_max_code;
+        while ( m_current_code >= m_next_bump ) {
+            m_next_bump *= 2;
+            m_code_size++;
+        }
+    }
 private :
     void flush( const int val )
     {
@@ -110,9 +88,9 @@ private :
         }
     }
     int m_code_size;
-    std::ostream & m_output;
+    T & m_output;
     int m_pending_bits;
-    unsigned int m_pending_output;
+    unsigned long long m_pending_output;
     unsigned int m_current_code;
     unsigned int m_next_bump;
     unsigned int m_max_code;
@@ -120,15 +98,15 @@ private :
 
 //
 // Like output_code_stream, the variable bit length part of reading from the input code stream is identical to
-// the code from lzw-c.h. The difference is in the new members, and these behave just like they do in the 
+// the code from lzw-c.h. The difference is in the new members, and these behave just like they do in the
 // output_code_stream class.
 //
-template<>
-class input_code_stream<std::istream>
+template<class T>
+class input_code_stream< flavoured<T,'d'> >
 {
 public :
-    input_code_stream( std::istream &input, unsigned int max_code ) 
-        : m_input( input ),
+    input_code_stream( flavoured<T,'d'> input, unsigned int max_code )
+        : m_input( input.stream() ),
           m_available_bits(0),
           m_pending_input(0),
           m_code_size(9),
@@ -143,10 +121,10 @@ public :
             char c;
             if ( !m_input.get(c) )
                 return false;
-            m_pending_input |= (c & 0xff) << m_available_bits;
+            m_pending_input |= (unsigned long long) (c & 0xff) << m_available_bits;
             m_available_bits += 8;
         }
-        i = m_pending_input & ~(~0 << m_code_size);
+        i = (unsigned int) (m_pending_input & ~(~0ull << m_code_size));
         m_pending_input >>= m_code_size;
         m_available_bits -= m_code_size;
         if ( m_current_code < m_max_code ) {
@@ -156,21 +134,61 @@ public :
                 m_code_size++;
             }
         }
-        if ( i == EOF_CODE )
+        if ( i == EOF_CODE ) {
+            //
+            // The writer always ends with one byte more than the codes
+            // need, which we have already read unless EOF_CODE ended on
+            // a byte boundary. Taking it leaves the input just past the
+            // stream, where the next one, if any, starts.
+            //
+            char c;
+            if ( !m_available_bits )
+                m_input.get( c );
+            m_available_bits = 0;
+            m_pending_input = 0;
             return false;
-        else
-            return true;
+        }
+        return true;
+    }
+    void preset( unsigned int next_code )
+    {
+        m_current_code = next_code - 1 < m_max_code ? next_code - 1 : m_max_code;
+        while ( m_current_code >= m_next_bump ) {
+            m_next_bump *= 2;
+            m_code_size++;
+        }
     }
 private :
     int m_code_size;
-    std::istream & m_input;
+    T & m_input;
     int m_available_bits;
-    unsigned int m_pending_input;
+    unsigned long long m_pending_input;
     unsigned int m_current_code;
     unsigned int m_next_bump;
     unsigned int m_max_code;
 };
 
+//
+// The first flavour header included in a program gets to decide what
+// format is used when compress() and decompress() are called with
+// plain std::istream and std::ostream objects.
+//
+#ifndef LZW_IOSTREAM_FLAVOUR
+#define LZW_IOSTREAM_FLAVOUR 'd'
+template<>
+class output_code_stream<std::ostream> : public output_code_stream< flavoured<std::ostream,'d'> > {
+public :
+    output_code_stream( std::ostream &output, unsigned int max_code )
+        : output_code_stream< flavoured<std::ostream,'d'> >( output, max_code ) {}
+};
+
+template<>
+class input_code_stream<std::istream> : public input_code_stream< flavoured<std::istream,'d'> > {
+public :
+    input_code_stream( std::istream &input, unsigned int max_code )
+        : input_code_stream< flavoured<std::istream,'d'> >( input, max_code ) {}
+};
+#endif
 
 }; //namespace lzw
 
@@ -0,0 +1,343 @@
+//
+// Copyright (c) 2011 Mark Nelson
+//
+// This software is licensed under the OSI MIT License, contained in
+// the file license.txt included with this project.
+//
+#ifndef LZW_FD_DOT_H
+#define LZW_FD_DOT_H
+
+#include "lzw_streambase.h"
+#include "lzw-d.h"
+#include <string>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+//
+// lzw-fd.h implements all four classes for raw file descriptors. Every
+// call to get() or put() on a std::istream or std::ostream constructs a
+// sentry object, checks the stream state, and goes through a virtual
+// call into the stream buffer, which adds up to a lot of work for one
+// byte. fd_input and fd_output do their own buffering instead, with
+// large buffers aligned to a page boundary, so the per-byte cost is a
+// pointer compare and a load or store, and the operating system sees
+// a small number of big read() and write() calls.
+//
+// When a file is read from start to finish, fd_input tells the kernel
+// so with posix_fadvise(), which lets it read further ahead. This is
+// only a hint, so it is quietly skipped on pipes and on systems that
+// don't have it.
+//
+// The code streams use the lzw-d format, so the output is identical to
+// what you get from lzw-d.h with iostreams. Since fd_input and fd_output
+// have get() and put(), flavoured<fd_input,'c'> and the like work too.
+//
+// Neither class closes its file descriptor, that is left to the owner.
+// fd_output flushes its buffer in its destructor, but since errors
+// can't be reported from there, call flush() and check good() first if
+// you care whether the data made it out.
+//
+
+namespace lzw {
+
+namespace fd_detail {
+
+const size_t ALIGNMENT = 4096;
+
+inline char *allocate( size_t size )
+{
+#ifdef _WIN32
+    return static_cast<char *>( malloc( size ) );
+#else
+    void *p = 0;
+    if ( posix_memalign( &p, ALIGNMENT, size ) )
+        return 0;
+    return static_cast<char *>( p );
+#endif
+}
+
+inline long read_some( int fd, char *data, size_t length )
+{
+    for ( ; ; ) {
+#ifdef _WIN32
+        long n = ::_read( fd, data, (unsigned int) length );
+#else
+        long n = (long) ::read( fd, data, length );
+#endif
+        if ( n >= 0 || errno != EINTR )
+            return n;
+    }
+}
+
+inline bool write_all( int fd, const char *data, size_t length )
+{
+    while ( length ) {
+#ifdef _WIN32
+        long n = ::_write( fd, data, (unsigned int) length );
+#else
+        long n = (long) ::write( fd, data, length );
+#endif
+        if ( n < 0 && errno == EINTR )
+            continue;
+        if ( n <= 0 )
+            return false;
+        data += n;
+        length -= n;
+    }
+    return true;
+}
+
+}; //namespace fd_detail
+
+class fd_input
+{
+public :
+    enum { DEFAULT_BUFFER_SIZE = 1 << 20 };
+    fd_input( int fd, size_t buffer_size = DEFAULT_BUFFER_SIZE, bool sequential = true )
+        : m_fd( fd ),
+          m_size( buffer_size ? buffer_size : size_t( DEFAULT_BUFFER_SIZE ) ),
+          m_buffer( fd_detail::allocate( m_size ) ),
+          m_next( m_buffer ),
+          m_end( m_buffer ),
+          m_count( 0 ),
+          m_eof( false ),
+          m_error( !m_buffer )
+    {
+#if defined( POSIX_FADV_SEQUENTIAL )
+        if ( sequential )
+            posix_fadvise( fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+#else
+        (void) sequential;
+#endif
+    }
+    ~fd_input() { free( m_buffer ); }
+    bool get( char &c )
+    {
+        if ( m_next == m_end && !fill() )
+            return false;
+        c = *m_next++;
+        return true;
+    }
+    //
+    // Like std::istream::read(), this copies as much as is available,
+    // up to length bytes, and gcount() reports how much that was. A big
+    // read goes straight from the file into the caller's memory.
+    //
+    fd_input &read( char *data, size_t length )
+    {
+        m_count = 0;
+        while ( m_count < length ) {
+            size_t available = m_end - m_next;
+            if ( !available ) {
+                if ( length - m_count >= m_size && !m_eof && !m_error ) {
+                    long n = fd_detail::read_some( m_fd, data + m_count, length - m_count );
+                    if ( n <= 0 ) {
+                        m_eof = true;
+                        m_error = n < 0;
+                        break;
+                    }
+                    m_count += n;
+                    continue;
+                }
+                if ( !fill() )
+                    break;
+                available = m_end - m_next;
+            }
+            const size_t n = available < length - m_count ? available : length - m_count;
+            memcpy( data + m_count, m_next, n );
+            m_next += n;
+            m_count += n;
+        }
+        return *this;
+    }
+    size_t gcount() const { return m_count; }
+    //
+    // Copies whatever can be had without waiting for more than one
+    // read(), up to length bytes. This is for data arriving on a pipe or
+    // socket, where read() would sit and wait for a full buffer. Returns
+    // 0 only at the end of the input.
+    //
+    size_t read_some( char *data, size_t length )
+    {
+        if ( m_next == m_end && !fill() )
+            return 0;
+        const size_t n = size_t( m_end - m_next ) < length ? size_t( m_end - m_next ) : length;
+        memcpy( data, m_next, n );
+        m_next += n;
+        return n;
+    }
+    //
+    // Copies up to length bytes into data without consuming them, so
+    // the caller can look at the start of a stream before deciding
+    // how to decode it. Returns the number of bytes copied, which is
+    // less than length only at the end of the input.
+    //
+    size_t peek( char *data, size_t length )
+    {
+        if ( length > m_size )
+            length = m_size;
+        while ( size_t( m_end - m_next ) < length && !m_eof && !m_error ) {
+            if ( m_next != m_buffer ) {
+                memmove( m_buffer, m_next, m_end - m_next );
+                m_end = m_buffer + (m_end - m_next);
+                m_next = m_buffer;
+            }
+            long n = fd_detail::read_some( m_fd, m_end, m_size - (m_end - m_buffer) );
+            if ( n <= 0 ) {
+                m_eof = true;
+                m_error = n < 0;
+            } else
+                m_end += n;
+        }
+        if ( size_t( m_end - m_next ) < length )
+            length = m_end - m_next;
+        memcpy( data, m_next, length );
+        return length;
+    }
+    bool good() const { return !m_error; }
+private :
+    fd_input( const fd_input & );
+    fd_input &operator=( const fd_input & );
+    bool fill()
+    {
+        if ( m_eof || m_error )
+            return false;
+        long n = fd_detail::read_some( m_fd, m_buffer, m_size );
+        if ( n <= 0 ) {
+            m_eof = true;
+            m_error = n < 0;
+            return false;
+        }
+        m_next = m_buffer;
+        m_end = m_buffer + n;
+        return true;
+    }
+    int m_fd;
+    size_t m_size;
+    char *m_buffer;
+    char *m_next;
+    char *m_end;
+    size_t m_count;
+    bool m_eof;
+    bool m_error;
+};
+
+class fd_output
+{
+public :
+    enum { DEFAULT_BUFFER_SIZE = 1 << 20 };
+    fd_output( int fd, size_t buffer_size = DEFAULT_BUFFER_SIZE )
+        : m_fd( fd ),
+          m_size( buffer_size ? buffer_size : size_t( DEFAULT_BUFFER_SIZE ) ),
+          m_buffer( fd_detail::allocate( m_size ) ),
+          m_next( m_buffer ),
+          m_end( m_buffer ? m_buffer + m_size : 0 ),
+          m_error( !m_buffer ) {}
+    ~fd_output()
+    {
+        flush();
+        free( m_buffer );
+    }
+    void put( char c )
+    {
+        if ( m_next == m_end && !flush() )
+            return;
+        *m_next++ = c;
+    }
+    //
+    // Small writes are buffered, big ones are passed straight through
+    // once the buffer has been emptied.
+    //
+    void write( const char *data, size_t length )
+    {
+        if ( length <= size_t( m_end - m_next ) ) {
+            memcpy( m_next, data, length );
+            m_next += length;
+            return;
+        }
+        if ( !flush() )
+            return;
+        if ( length >= m_size ) {
+            if ( !fd_detail::write_all( m_fd, data, length ) )
+                m_error = true;
+            return;
+        }
+        memcpy( m_next, data, length );
+        m_next += length;
+    }
+    //
+    // Once a write fails, everything after it is thrown away, and
+    // good() returns false from then on.
+    //
+    bool flush()
+    {
+        if ( m_error )
+            return false;
+        if ( m_next != m_buffer && !fd_detail::write_all( m_fd, m_buffer, m_next - m_buffer ) )
+            m_error = true;
+        m_next = m_buffer;
+        return !m_error;
+    }
+    bool good() const { return !m_error; }
+private :
+    fd_output( const fd_output & );
+    fd_output &operator=( const fd_output & );
+    int m_fd;
+    size_t m_size;
+    char *m_buffer;
+    char *m_next;
+    char *m_end;
+    bool m_error;
+};
+
+template<>
+class input_symbol_stream<fd_input> {
+public :
+    input_symbol_stream( fd_input &input )
+        : m_input( input ) {}
+    bool operator>>( char &c )
+    {
+        return m_input.get( c );
+    }
+private :
+    fd_input &m_input;
+};
+
+template<>
+class output_symbol_stream<fd_output> {
+public :
+    output_symbol_stream( fd_output &output )
+        : m_output( output ) {}
+    void operator<<( const std::string &s )
+    {
+        m_output.write( s.data(), s.size() );
+    }
+private :
+    fd_output &m_output;
+};
+
+template<>
+class output_code_stream<fd_output> : public output_code_stream< flavoured<fd_output,'d'> > {
+public :
+    output_code_stream( fd_output &output, unsigned int max_code )
+        : output_code_stream< flavoured<fd_output,'d'> >( output, max_code ) {}
+};
+
+template<>
+class input_code_stream<fd_input> : public input_code_stream< flavoured<fd_input,'d'> > {
+public :
+    input_code_stream( fd_input &input, unsigned int max_code )
+        : input_code_stream< flavoured<fd_input,'d'> >( input, max_code ) {}
+};
+
+}; //namespace lzw
+
+#endif //#ifndef LZW_FD_DOT_H
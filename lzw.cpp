@@ -16,69 +16,1344 @@
 #define _ITERATOR_DEBUG_LEVEL 0
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <vector>
 #include <cstring>
+#include <cstdio>
 
 #include "lzw_streambase.h"
 #include "lzw-d.h"
+#include "lzw-a.h"
+#include "lzw-b.h"
+#include "lzw-c.h"
+#include "lzw-fd.h"
 #include "lzw.h"
+#include "lzw_header.h"
+#include "lzw_block.h"
+#include "lzw_perf.h"
+#include "lzw_search.h"
+#include "lzw_symbols.h"
+#include "lzw_checkpoint.h"
+#include "lzw_archive.h"
+#include "lzw_parallel.h"
+#include <sys/stat.h>
 
 
 void usage()
 {
     std::cerr << 
         "Usage:\n"
-        "lzw [-max max_code] -c input output #compress file input to file output\n"
+        "lzw [-max max_code] [-raw] -c input output #compress file input to file output\n"
         "lzw [-max max_code] -c - output     #compress stdin to file otuput\n"
         "lzw [-max max_code] -c input        #compress file input to stdout\n"
         "lzw [-max max_code] -c              #compress stdin to stdout\n"
         "lzw [-max max_code] -d input output #decompress file input to file output\n"
         "lzw [-max max_code] -d - output     #decompress stdin to file otuput\n"
         "lzw [-max max_code] -d input        #decompress file input to stdout\n"
-        "lzw [-max max_code] -d              #decompress stdin to stdout\n";
+        "lzw [-max max_code] -d              #decompress stdin to stdout\n"
+        "lzw [-max max_code] -a input output #compress input onto the end of output\n"
+        "lzw [-max max_code] -a - output     #compress stdin onto the end of output\n"
+        "lzw [-max max_code] -flush [-c|-a] ... #compress as data arrives, see below\n"
+        "lzw [-max max_code] -mem bytes [-c|-d|-a] ... #cap dictionary memory, see below\n"
+        "lzw [-max max_code] -sym 16 [-c|-a] ... #compress 16 bit symbols, see below\n"
+        "lzw [-max max_code] -filter list [-c|-a] ... #filter before compressing\n"
+        "lzw [-max max_code] -pages mode [-c|-d|-a|--perf] ... #choose huge pages, see below\n"
+        "lzw [-max max_code] -checkpoint bytes [--resume] -c|-a input output #see below\n"
+        "lzw [-max max_code] -f a|b|c|d [-c|-d|-a|--perf|--grep] ... #choose the code format\n"
+        "lzw [-max max_code] -fp lookahead [-c|-a|--perf|--archive] ... #flexible parsing\n"
+        "lzw [-max max_code] -j threads [-prime bytes] -c|-a ... #compress on several cores\n"
+        "lzw [-max max_code] --perf input    #profile compress and decompress of input\n"
+        "lzw [-max max_code] --perf          #profile compress and decompress of stdin\n"
+        "lzw [-max max_code] --grep [-o] pattern [input] #search compressed input\n"
+        "lzw [-max max_code] [-reset bytes] --archive archive [file ...] #see below\n"
+        "lzw --list archive                 #list the members of an archive\n"
+        "lzw --extract archive name [output] #extract one member of an archive\n"
+        "\n"
+        "Compressed files are written as a header followed by blocks, any of\n"
+        "which may be stored instead of compressed if compression doesn't help.\n"
+        "-raw writes a bare code stream with no header, as older versions did.\n"
+        "Decompression accepts either format.\n"
+        "\n"
+        "-a adds a new member to an existing compressed file, without touching\n"
+        "what is already there. Compressed files can also be joined with cat.\n"
+        "-d and --grep process all of the members in order.\n"
+        "\n"
+        "-flush is for live streams, such as a pipe or socket. Each time input\n"
+        "arrives, it is compressed and written out right away, in a form that\n"
+        "-d can decode as soon as it sees it, and the dictionary is kept for the\n"
+        "data that follows. -d always writes its output a block at a time.\n"
+        "\n"
+        "-mem limits the memory used by the dictionary, in bytes, or with a\n"
+        "k, m or g suffix. -c and -a reduce max_code as far as needed to fit,\n"
+        "using the more compact trie dictionary if that allows a bigger table,\n"
+        "and -d refuses any stream whose max_code wouldn't fit. --perf reports\n"
+        "the peak dictionary memory for each engine.\n"
+        "\n"
+        "-sym 16 compresses the input as a sequence of 16 bit little-endian\n"
+        "symbols, such as UTF-16 text, instead of bytes. max_code defaults to\n"
+        "262143 and can't be less than 65536, the code for the last symbol.\n"
+        "-d recognizes these streams by their header.\n"
+        "\n"
+        "-filter rearranges each block before it is compressed, which can help\n"
+        "a lot with tables of numbers. The list is applied in order, and can\n"
+        "hold delta:N, which replaces each byte with its difference from the\n"
+        "byte N back, and planes:N, which groups byte 0 of every N byte record,\n"
+        "then byte 1, and so on. For 32 bit integers, try planes:4,delta:1.\n"
+        "The filters are recorded in the header, and -d undoes them.\n"
+        "\n"
+        "max_code can go as high as 2147483647. Dictionary tables of 8MB or\n"
+        "more, which the compressor needs once max_code passes 131072, are\n"
+        "backed by 2MB pages, so lookups in them don't keep missing the TLB.\n"
+        "-pages thp, the default, asks for transparent huge pages, -pages\n"
+        "hugetlb takes pages from the reserved pool set up with vm.nr_hugepages,\n"
+        "falling back to thp when it runs out, and -pages off uses ordinary\n"
+        "pages.\n"
+        "\n"
+        "-checkpoint saves the progress of a long job in output.ckpt after\n"
+        "every so many bytes of input, with a k, m or g suffix, at the next\n"
+        "block boundary, once the output so far is safely on disk. If the job\n"
+        "is stopped, running it again with --resume picks up from the last\n"
+        "checkpoint, with the settings saved in it, instead of starting over.\n"
+        "Without a checkpoint to resume from, it starts from the beginning,\n"
+        "with checkpoints every 1g unless -checkpoint says otherwise. The\n"
+        "checkpoint is removed when the output is complete.\n"
+        "\n"
+        "-f picks the format of the codes: a writes them as decimal text, b\n"
+        "as fixed 16 bit numbers, c as fixed width codes sized to max_code,\n"
+        "and d, the default, as codes that start at 9 bits and widen as the\n"
+        "dictionary grows. The header records the format, so -d and --grep\n"
+        "only need -f for streams written with -raw. With -f b, max_code\n"
+        "can't be more than 65535.\n"
+        "\n"
+        "-fp compresses with flexible parsing instead of always taking the\n"
+        "longest match, trying up to lookahead shorter ones at each step for\n"
+        "one that lets the next match reach well past it. The output is often\n"
+        "a few percent smaller, and any version of -d reads it, just as fast,\n"
+        "but compression is several times slower. --perf -fp compares it with\n"
+        "the greedy parse. -fp can't be used with -sym or -checkpoint.\n"
+        "\n"
+        "-j compresses blocks on that many threads at once, or one per core\n"
+        "with -j 0. Each block's dictionary is primed with the end of the\n"
+        "block before it, one byte for each code in the table unless -prime\n"
+        "says otherwise, up to 256k. -prime 0 turns priming off. -d reads the\n"
+        "output on one core, a little more slowly than usual. -j only works\n"
+        "with ordinary block output, not with -raw, -flush, -mem, -sym,\n"
+        "-checkpoint, --perf, or --archive.\n"
+        "\n"
+        "-max auto picks max_code by trial compressing the first block with\n"
+        "several table sizes, and takes the smallest table within 1% of the\n"
+        "best ratio. auto:speed allows 5%, auto:ratio insists on the best.\n"
+        "The choice is recorded in the header, so -d doesn't need -max.\n"
+        "\n"
+        "--grep searches compressed data without decompressing it, and prints\n"
+        "the number of each line containing the pattern. With -o, it prints\n"
+        "line:offset for every match instead. The exit status is 0 if there\n"
+        "were matches, 1 if there weren't, and 2 if the data is damaged.\n"
+        "\n"
+        "--archive compresses many files into one solid archive, with one\n"
+        "dictionary carried from each file to the next, which does much better\n"
+        "than compressing small files one at a time. With no files listed, the\n"
+        "names are read from stdin, one to a line. An index at the end lets\n"
+        "--list show the members and --extract decode just one of them, along\n"
+        "with at most one reset interval before it. -reset starts a new\n"
+        "dictionary every so many bytes, with a k, m or g suffix, instead of\n"
+        "every 8 bytes per code, 256k with the default max_code. Smaller makes\n"
+        "extraction faster, at some cost in compression.\n";
     exit(1);
 }
 
+//
+// The --perf mode reads the entire input into memory, then compresses
+// it and decompresses it again, using in-memory streams so that file
+// I/O doesn't pollute the measurements. Each phase is bracketed by
+// the hardware performance counters, and the results are reported per
+// uncompressed byte, so runs with different -max values and different
+// inputs can be compared directly. If the counters can't be opened,
+// we still report the elapsed time, which is better than nothing.
+//
+void print_perf_line( const char *phase, const lzw::perf_counters &counters, double bytes )
+{
+    static const lzw::perf_counters::event events[] = {
+        lzw::perf_counters::CYCLES,
+        lzw::perf_counters::INSTRUCTIONS,
+        lzw::perf_counters::L1D_MISSES,
+        lzw::perf_counters::LLC_MISSES,
+        lzw::perf_counters::BRANCH_MISSES,
+    };
+    printf( "%-17s", phase );
+    for ( int i = 0 ; i < 5 ; i++ )
+        if ( counters.available( events[ i ] ) && bytes > 0 )
+            printf( " %12.4f", counters.value( events[ i ] ) / bytes );
+        else
+            printf( " %12s", "n/a" );
+    if ( bytes > 0 )
+        printf( " %12.4f\n", counters.nanoseconds() / bytes );
+    else
+        printf( " %12s\n", "n/a" );
+}
+
+//
+// Compression is measured once for each of the dictionary engines
+// in lzw_dictionary.h. They all produce exactly the same output, so
+// the only differences in the numbers are in how they use memory.
+//
+template<char FLAVOUR, class ENGINE>
+std::string perf_compress( const std::string &original,
+                           unsigned int max_code,
+                           unsigned int lookahead,
+                           lzw::perf_counters &counters,
+                           size_t &peak_bytes )
+{
+    std::istringstream in( original );
+    std::ostringstream out;
+    lzw::flavoured<std::istream,FLAVOUR> flavoured_in( in );
+    lzw::flavoured<std::ostream,FLAVOUR> flavoured_out( out );
+    lzw::basic_compressor<ENGINE> c( max_code );
+    c.set_lookahead( lookahead );
+    counters.start();
+    c.compress( flavoured_in, flavoured_out );
+    counters.stop();
+    peak_bytes = c.peak_bytes();
+    return out.str();
+}
+
+//
+// Decompression reads from memory, the way blocks are decoded, so
+// lzw-c gets the batch unpacking in lzw_unpack.h.
+//
+template<char FLAVOUR>
+std::string perf_decompress( const std::string &compressed,
+                             unsigned int max_code,
+                             lzw::perf_counters &counters,
+                             size_t &peak_bytes )
+{
+    std::string decompressed;
+    lzw::memory_input decompress_in( compressed );
+    lzw::memory_output decompress_out( decompressed );
+    lzw::flavoured<lzw::memory_input,FLAVOUR> flavoured_in( decompress_in );
+    lzw::flavoured<lzw::memory_output,FLAVOUR> flavoured_out( decompress_out );
+    lzw::decompressor d( max_code );
+    counters.start();
+    d.decompress( flavoured_in, flavoured_out );
+    counters.stop();
+    peak_bytes = d.peak_bytes();
+    return decompressed;
+}
+
+//
+// With -fp, the numbers are for flexible parsing, and the input is
+// compressed and decompressed once more the greedy way, with the hash
+// table, for comparison: the size shows what the lookahead bought, and
+// the two decompress lines show that it cost nothing to read.
+//
+template<char FLAVOUR>
+int perf( std::istream &in, unsigned int max_code, lzw::tuning_objective objective, unsigned int lookahead )
+{
+    std::ostringstream buffer;
+    buffer << in.rdbuf();
+    std::string original = buffer.str();
+    if ( objective != lzw::TUNE_NONE ) {
+        size_t sample = original.size() < lzw::block_writer::DEFAULT_BLOCK_SIZE ? original.size() : lzw::block_writer::DEFAULT_BLOCK_SIZE;
+        max_code = lzw::choose_max_code<FLAVOUR>( original.data(), sample, objective );
+    }
+
+    lzw::perf_counters hash_counters;
+    lzw::perf_counters trie_counters;
+    lzw::perf_counters hybrid_counters;
+    size_t hash_peak;
+    size_t trie_peak;
+    size_t hybrid_peak;
+    std::string compressed = perf_compress<FLAVOUR,lzw::code_hash>( original, max_code, lookahead, hash_counters, hash_peak );
+    bool same = perf_compress<FLAVOUR,lzw::code_trie>( original, max_code, lookahead, trie_counters, trie_peak ) == compressed;
+    same = perf_compress< FLAVOUR,lzw::code_hybrid<> >( original, max_code, lookahead, hybrid_counters, hybrid_peak ) == compressed && same;
+
+    lzw::perf_counters counters;
+    size_t decompress_peak;
+    const std::string decompressed = perf_decompress<FLAVOUR>( compressed, max_code, counters, decompress_peak );
+    lzw::perf_counters greedy_counters;
+    lzw::perf_counters greedy_decompress_counters;
+    std::string greedy;
+    bool greedy_same = true;
+    if ( lookahead ) {
+        size_t peak;
+        greedy = perf_compress<FLAVOUR,lzw::code_hash>( original, max_code, 0, greedy_counters, peak );
+        greedy_same = perf_decompress<FLAVOUR>( greedy, max_code, greedy_decompress_counters, peak ) == original;
+    }
+
+    printf( "input: %lu bytes, compressed: %lu bytes, max_code: %u\n",
+            (unsigned long) original.size(), (unsigned long) compressed.size(), max_code );
+    if ( !counters.any_available() )
+        printf( "hardware counters unavailable (%s), reporting time only\n", counters.error().c_str() );
+    else if ( counters.error().size() )
+        printf( "some hardware counters unavailable (%s)\n", counters.error().c_str() );
+    printf( "%-17s %12s %12s %12s %12s %12s %12s\n",
+            "per byte", "cycles", "instructions", "L1d-misses", "LLC-misses", "br-misses", "ns" );
+    print_perf_line( "compress/hash", hash_counters, (double) original.size() );
+    print_perf_line( "compress/trie", trie_counters, (double) original.size() );
+    print_perf_line( "compress/hybrid", hybrid_counters, (double) original.size() );
+    print_perf_line( "decompress", counters, (double) original.size() );
+    if ( lookahead ) {
+        print_perf_line( "compress/greedy", greedy_counters, (double) original.size() );
+        print_perf_line( "decompress/greedy", greedy_decompress_counters, (double) original.size() );
+        printf( "lookahead %u: %lu bytes, greedy: %lu bytes, %.2f%% of greedy\n",
+                lookahead, (unsigned long) compressed.size(), (unsigned long) greedy.size(),
+                greedy.size() ? 100.0 * compressed.size() / greedy.size() : 100.0 );
+    }
+    printf( "peak dictionary bytes: hash %lu, trie %lu, hybrid %lu, decompress %lu\n",
+            (unsigned long) hash_peak, (unsigned long) trie_peak,
+            (unsigned long) hybrid_peak, (unsigned long) decompress_peak );
+    if ( FLAVOUR == 'c' )
+        printf( "code unpacking: %s\n", lzw::unpack_name() );
+    if ( !same ) {
+        std::cerr << "Error: dictionary engines produced different output\n";
+        return 1;
+    }
+    if ( decompressed != original || !greedy_same ) {
+        std::cerr << "Error: round trip did not reproduce the input\n";
+        return 1;
+    }
+    return 0;
+}
+
+//
+// A compressed file is a sequence of one or more members, each of which
+// starts with its own stream header and is compressed independently, so
+// appending to a file is just a matter of writing a new member on the
+// end of it, and two compressed files can be joined with cat. The very
+// first member might instead be a bare code stream written by an older
+// version of this program, or by -raw, which has no header. The first
+// four bytes of a member tell us which, and fd_input lets us look at
+// them without taking them out of the stream. An archive starts with
+// its index instead, and gets a type of its own so the caller can say
+// what to do with it.
+//
+enum member_type { HEADER_MEMBER, RAW_MEMBER, NO_MEMBER, BAD_MEMBER, ARCHIVE_MEMBER };
+
+member_type next_member( lzw::fd_input &in, lzw::stream_header &header, bool first )
+{
+    char start[ lzw::stream_header::MAGIC_SIZE ];
+    const size_t length = in.peek( start, sizeof( start ) );
+    if ( !length && !first )
+        return NO_MEMBER;
+    if ( first && lzw::archive_index::present( start, length ) )
+        return ARCHIVE_MEMBER;
+    if ( !lzw::stream_header::present( start, length ) )
+        return first ? RAW_MEMBER : BAD_MEMBER;
+    header = lzw::stream_header();
+    return header.read( in ) ? HEADER_MEMBER : BAD_MEMBER;
+}
+
+//
+// Output is flushed after every block, so that when the input is a live
+// stream written with -flush, each piece is passed along as soon as it
+// has been decoded.
+//
+template<char FLAVOUR>
+bool decompress_blocks( lzw::fd_input &in,
+                        lzw::fd_output &out,
+                        unsigned int max_code,
+                        const lzw::filter_chain &filters,
+                        bool primed )
+{
+    lzw::decompressor d( max_code );
+    lzw::block_reader reader( d );
+    reader.set_filters( filters );
+    reader.set_primed( primed );
+    while ( reader.template read_block<FLAVOUR>( in, out ) ) {
+        if ( reader.end() )
+            return true;
+        out.flush();
+    }
+    return false;
+}
+
+typedef lzw::alphabet<unsigned short> utf16;
+
+//
+// Decodes one member, whose header has already been read. A bare code
+// stream is passed a default header, which has no flags set.
+//
+template<char FLAVOUR>
+bool decompress_member( lzw::fd_input &in,
+                        lzw::fd_output &out,
+                        const lzw::stream_header &header,
+                        unsigned int max_code,
+                        const lzw::filter_chain &filters )
+{
+    if ( header.has_symbols() )
+        return header.symbol_size() == 2 && header.alphabet_size() == utf16::size &&
+               !header.has_filters() &&
+               lzw::decompress_symbol_stream<FLAVOUR,utf16>( in, out, max_code );
+    if ( header.has_blocks() )
+        return decompress_blocks<FLAVOUR>( in, out, max_code, filters, header.has_primed() );
+    lzw::flavoured<lzw::fd_input,FLAVOUR> flavoured_in( in );
+    lzw::flavoured<lzw::fd_output,FLAVOUR> flavoured_out( out );
+    lzw::decompress( flavoured_in, flavoured_out, max_code );
+    return true;
+}
+
+//
+// Each member says which flavour it was written with, so the choice is
+// made here, once per member, and from then on the code streams are
+// the ones built for that flavour. Only a bare code stream, which has
+// no header to say, relies on -f.
+//
+bool decompress_member( lzw::fd_input &in,
+                        lzw::fd_output &out,
+                        const lzw::stream_header &header,
+                        unsigned int max_code,
+                        const lzw::filter_chain &filters,
+                        char flavour )
+{
+    switch ( flavour ) {
+    case 'a' : return decompress_member<'a'>( in, out, header, max_code, filters );
+    case 'b' : return decompress_member<'b'>( in, out, header, max_code, filters );
+    case 'c' : return decompress_member<'c'>( in, out, header, max_code, filters );
+    case 'd' : return decompress_member<'d'>( in, out, header, max_code, filters );
+    }
+    return false;
+}
+
+//
+// With -mem, each member's max_code is checked against the budget
+// before anything is decoded, so a stream that would need more memory
+// than we have is rejected instead of being half written. A member
+// with 'P' blocks needs room for the compressor that primes them too.
+// The result says why decompression stopped, so the caller prints one
+// message that fits.
+//
+enum decompress_result { DECOMPRESS_OK, DECOMPRESS_DAMAGED, DECOMPRESS_ARCHIVE, DECOMPRESS_OVER_BUDGET };
+
+decompress_result decompress( lzw::fd_input &in, lzw::fd_output &out, unsigned int max_code, size_t memory_budget, char flavour )
+{
+    lzw::stream_header header;
+    for ( bool first = true ; ; first = false ) {
+        switch ( next_member( in, header, first ) ) {
+        case NO_MEMBER :
+            return DECOMPRESS_OK;
+        case BAD_MEMBER :
+            return DECOMPRESS_DAMAGED;
+        case ARCHIVE_MEMBER :
+            return DECOMPRESS_ARCHIVE;
+        case RAW_MEMBER :
+            //
+            // The code streams leave the input just past their padding,
+            // so members written onto the end with -a follow directly.
+            //
+            if ( !decompress_member( in, out, lzw::stream_header(), max_code, lzw::filter_chain(), flavour ) )
+                return DECOMPRESS_DAMAGED;
+            break;
+        case HEADER_MEMBER :
+            const unsigned int member_max_code = header.has_max_code() ? header.max_code() : max_code;
+            const size_t primer_bytes = header.has_primed() ? lzw::block_reader::primer_bytes_for( member_max_code ) : 0;
+            if ( memory_budget && lzw::decompressor::peak_bytes_for( member_max_code ) + primer_bytes > memory_budget )
+                return DECOMPRESS_OVER_BUDGET;
+            lzw::filter_chain filters;
+            if ( !filters.set( header.filters() ) || (header.has_filters() && !header.has_blocks()) ||
+                 !decompress_member( in, out, header, member_max_code, filters, header.flavour() ) )
+                return DECOMPRESS_DAMAGED;
+            break;
+        }
+    }
+}
+
+//
+// --grep walks the compressed data the same way decompress() does, but
+// hands the code streams to compressed_search instead of decoding them.
+// Stored blocks are searched as they are.
+//
+struct grep_printer
+{
+    bool offsets;
+    unsigned long long last_line;
+    unsigned long long count;
+    void operator()( const lzw::search_match &match )
+    {
+        count++;
+        if ( offsets )
+            printf( "%llu:%llu\n", match.line, match.offset );
+        else if ( match.line != last_line ) {
+            printf( "%llu\n", match.line );
+            last_line = match.line;
+        }
+    }
+};
+
+//
+// A 'P' block needs the dictionary built from the end of the block
+// before it, which comes from the bytes of a stored block, or else
+// from the codes the search just went through.
+//
+template<char FLAVOUR>
+bool prime_search( lzw::compressed_search &search, const std::string &stored, bool after_stored, size_t length )
+{
+    std::string tail;
+    if ( after_stored ) {
+        if ( length > stored.size() )
+            return false;
+        tail.assign( stored, stored.size() - length, length );
+    } else if ( !search.tail( length, tail ) )
+        return false;
+    lzw::compressor primer( search.max_code() );
+    std::string codes;
+    lzw::prime<FLAVOUR>( primer, tail.data(), tail.size(), codes );
+    lzw::memory_input in( codes );
+    return search.prime_codes<FLAVOUR>( in );
+}
+
+template<char FLAVOUR>
+bool grep_member( lzw::fd_input &in,
+                  const lzw::stream_header &header,
+                  lzw::compressed_search &search,
+                  grep_printer &printer )
+{
+    if ( !header.has_blocks() )
+        return search.search_codes<FLAVOUR>( in, printer );
+    lzw::block_parser parser;
+    std::string stored;
+    bool after_stored = false;
+    bool ok = true;
+    while ( ok && (ok = parser.next( in )) && parser.type() != lzw::END_BLOCK ) {
+        const std::string &data = parser.data();
+        if ( parser.type() == lzw::STORED_BLOCK ) {
+            search.search_bytes( data.data(), data.size(), printer );
+            const size_t keep = data.size() < lzw::MAX_PRIME_SIZE ? data.size() : lzw::MAX_PRIME_SIZE;
+            stored.assign( data, data.size() - keep, keep );
+            after_stored = true;
+        } else {
+            const unsigned long long block_start = search.position();
+            const bool primed = parser.type() == lzw::PRIMED_BLOCK;
+            if ( primed )
+                ok = header.has_primed() && prime_search<FLAVOUR>( search, stored, after_stored, parser.prime_length() );
+            const bool resume = primed || parser.type() == lzw::CONTINUE_BLOCK;
+            lzw::memory_input codes( data );
+            ok = ok && search.search_codes<FLAVOUR>( codes, printer, resume ) &&
+                 search.position() - block_start == parser.length();
+            after_stored = false;
+        }
+    }
+    return ok;
+}
+
+int grep( lzw::fd_input &in, const std::string &pattern, unsigned int max_code, bool offsets, char flavour )
+{
+    grep_printer printer = { offsets, 0, 0 };
+    lzw::compressed_search search( pattern, max_code );
+    lzw::stream_header header;
+    bool ok = true;
+    for ( bool first = true ; ok ; first = false ) {
+        const member_type type = next_member( in, header, first );
+        if ( type == NO_MEMBER )
+            break;
+        if ( type == ARCHIVE_MEMBER ) {
+            std::cerr << "Error: this is an archive, use --list or --extract\n";
+            return 2;
+        }
+        ok = type != BAD_MEMBER;
+        if ( !ok )
+            break;
+        if ( header.has_symbols() || header.has_filters() ) {
+            ok = false;
+            break;
+        }
+        search.set_max_code( header.has_max_code() ? header.max_code() : max_code );
+        switch ( type == RAW_MEMBER ? flavour : header.flavour() ) {
+        case 'a' : ok = grep_member<'a'>( in, header, search, printer ); break;
+        case 'b' : ok = grep_member<'b'>( in, header, search, printer ); break;
+        case 'c' : ok = grep_member<'c'>( in, header, search, printer ); break;
+        case 'd' : ok = grep_member<'d'>( in, header, search, printer ); break;
+        }
+    }
+    fflush( stdout );
+    if ( !ok ) {
+        std::cerr << "Error: damaged or unsupported compressed data\n";
+        return 2;
+    }
+    return printer.count ? 0 : 1;
+}
+
+//
+// With -flush, the input is compressed a piece at a time, as it comes
+// in, and each piece is written out and flushed before waiting for the
+// next, so the latency is bounded by whoever is writing to us.
+//
+template<char FLAVOUR, class ENGINE>
+void compress_live( lzw::fd_input &in,
+                    lzw::fd_output &out,
+                    unsigned int max_code,
+                    const lzw::filter_chain &filters,
+                    unsigned int lookahead )
+{
+    lzw::stream_writer<FLAVOUR,lzw::fd_output,ENGINE> writer( out, max_code, lzw::block_writer::DEFAULT_BLOCK_SIZE, filters );
+    writer.set_lookahead( lookahead );
+    std::string buffer( 1 << 16, 0 );
+    size_t length;
+    while ( (length = in.read_some( &buffer[ 0 ], buffer.size() )) != 0 ) {
+        writer.write( buffer.data(), length );
+        writer.flush();
+        if ( !out.flush() )
+            return;
+    }
+    writer.close();
+}
+
+//
+// -j gives the number of threads, with 0 meaning one per core, so the
+// caller says whether to compress in parallel at all with parallel.
+//
+struct parallel_options
+{
+    bool parallel;
+    unsigned int threads;
+    size_t prime_size;
+};
+
+template<char FLAVOUR, class ENGINE>
+void compress_flavour( lzw::fd_input &in,
+                       lzw::fd_output &out,
+                       unsigned int max_code,
+                       lzw::tuning_objective objective,
+                       bool raw,
+                       bool live,
+                       const lzw::filter_chain &filters,
+                       unsigned int lookahead,
+                       const parallel_options &parallel )
+{
+    if ( parallel.parallel )
+        lzw::compress_parallel<FLAVOUR,ENGINE>( in, out, max_code, parallel.threads, parallel.prime_size,
+                                                lzw::block_writer::DEFAULT_BLOCK_SIZE, filters, lookahead, objective );
+    else if ( raw ) {
+        lzw::flavoured<lzw::fd_input,FLAVOUR> flavoured_in( in );
+        lzw::flavoured<lzw::fd_output,FLAVOUR> flavoured_out( out );
+        lzw::basic_compressor<ENGINE> c( max_code );
+        c.set_lookahead( lookahead );
+        c.compress( flavoured_in, flavoured_out );
+    } else if ( live )
+        compress_live<FLAVOUR,ENGINE>( in, out, max_code, filters, lookahead );
+    else
+        lzw::compress_blocks<FLAVOUR,ENGINE>( in, out, max_code, lzw::block_writer::DEFAULT_BLOCK_SIZE, filters,
+                                              lookahead, objective );
+}
+
+//
+// All four flavours are built into the program, and -f picks one. The
+// choice is made once, here, and the header records it, so -d can make
+// the same choice without being told.
+//
+template<class ENGINE>
+void compress_file( lzw::fd_input &in,
+                    lzw::fd_output &out,
+                    unsigned int max_code,
+                    lzw::tuning_objective objective,
+                    bool raw,
+                    bool live,
+                    const lzw::filter_chain &filters,
+                    char flavour,
+                    unsigned int lookahead,
+                    const parallel_options &parallel )
+{
+    switch ( flavour ) {
+    case 'a' : compress_flavour<'a',ENGINE>( in, out, max_code, objective, raw, live, filters, lookahead, parallel ); break;
+    case 'b' : compress_flavour<'b',ENGINE>( in, out, max_code, objective, raw, live, filters, lookahead, parallel ); break;
+    case 'c' : compress_flavour<'c',ENGINE>( in, out, max_code, objective, raw, live, filters, lookahead, parallel ); break;
+    case 'd' : compress_flavour<'d',ENGINE>( in, out, max_code, objective, raw, live, filters, lookahead, parallel ); break;
+    }
+}
+
+//
+// lzw-b can't hold the codes for 16 bit symbols, so main() doesn't
+// allow it here.
+//
+void compress_symbols( lzw::fd_input &in, lzw::fd_output &out, unsigned int max_code, char flavour )
+{
+    switch ( flavour ) {
+    case 'a' : lzw::compress_symbol_stream<'a',utf16>( in, out, max_code ); break;
+    case 'c' : lzw::compress_symbol_stream<'c',utf16>( in, out, max_code ); break;
+    case 'd' : lzw::compress_symbol_stream<'d',utf16>( in, out, max_code ); break;
+    }
+}
+
+//
+// With -checkpoint, the blocks are written here instead of by
+// compress_blocks(), so that after every interval bytes of input, at a
+// block boundary, the output can be flushed and synced and the
+// checkpoint saved next to it. If the job is being resumed, main() has
+// already moved the input and output to where the checkpoint says, and
+// read the blocks written with the current dictionary into chain, and
+// the writer is restored from those before it carries on.
+//
+bool save_checkpoint( lzw::fd_output &out,
+                      int out_fd,
+                      lzw::compress_checkpoint &checkpoint,
+                      unsigned long long chain_bytes,
+                      const std::string &path )
+{
+    if ( !out.flush() || fdatasync( out_fd ) ) {
+        std::cerr << "Error: write failed: " << strerror( errno ) << "\n";
+        return false;
+    }
+    checkpoint.output_offset = lseek( out_fd, 0, SEEK_CUR );
+    checkpoint.chain_bytes = chain_bytes;
+    if ( !checkpoint.save( path ) ) {
+        perror( path.c_str() );
+        return false;
+    }
+    return true;
+}
+
+template<char FLAVOUR, class ENGINE>
+bool compress_checkpointed( lzw::fd_input &in,
+                            lzw::fd_output &out,
+                            int out_fd,
+                            lzw::compress_checkpoint &checkpoint,
+                            const std::string &chain,
+                            bool resumed,
+                            const std::string &path,
+                            lzw::tuning_objective objective )
+{
+    lzw::filter_chain filters;
+    filters.set( checkpoint.filters );
+    std::string data( checkpoint.block_size, 0 );
+    in.read( &data[ 0 ], data.size() );
+    size_t n = (size_t) in.gcount();
+    if ( !resumed ) {
+        if ( objective != lzw::TUNE_NONE ) {
+            std::string sample( data, 0, n );
+            if ( n )
+                filters.encode( &sample[ 0 ], n );
+            checkpoint.max_code = lzw::choose_max_code<FLAVOUR>( sample.data(), n, objective );
+        }
+        lzw::stream_header header;
+        header.set_blocks();
+        header.set_max_code( checkpoint.max_code );
+        header.set_filters( filters.specs() );
+        header.set_flavour( FLAVOUR );
+        header.write( out );
+    }
+    lzw::basic_compressor<ENGINE> c( checkpoint.max_code );
+    lzw::basic_block_writer<ENGINE> writer( c, checkpoint.block_size );
+    writer.set_filters( filters );
+    if ( resumed && !writer.template restore<FLAVOUR>( chain ) ) {
+        std::cerr << "Error: the output doesn't match the checkpoint\n";
+        return false;
+    }
+    unsigned long long next = checkpoint.input_offset + checkpoint.interval;
+    while ( n ) {
+        writer.template write<FLAVOUR>( out, data.data(), n );
+        checkpoint.input_offset += n;
+        if ( checkpoint.input_offset >= next ) {
+            if ( !save_checkpoint( out, out_fd, checkpoint, writer.chain_bytes(), path ) )
+                return false;
+            next = checkpoint.input_offset + checkpoint.interval;
+        }
+        in.read( &data[ 0 ], data.size() );
+        n = (size_t) in.gcount();
+    }
+    writer.finish( out );
+    return true;
+}
+
+bool compress_checkpointed( lzw::fd_input &in,
+                            lzw::fd_output &out,
+                            int out_fd,
+                            lzw::compress_checkpoint &checkpoint,
+                            const std::string &chain,
+                            bool resumed,
+                            const std::string &path,
+                            lzw::tuning_objective objective )
+{
+    const bool trie = checkpoint.engine == 't';
+    switch ( checkpoint.flavour ) {
+    case 'a' :
+        return trie ? compress_checkpointed<'a',lzw::code_trie>( in, out, out_fd, checkpoint, chain, resumed, path, objective )
+                    : compress_checkpointed<'a',lzw::code_hash>( in, out, out_fd, checkpoint, chain, resumed, path, objective );
+    case 'b' :
+        return trie ? compress_checkpointed<'b',lzw::code_trie>( in, out, out_fd, checkpoint, chain, resumed, path, objective )
+                    : compress_checkpointed<'b',lzw::code_hash>( in, out, out_fd, checkpoint, chain, resumed, path, objective );
+    case 'c' :
+        return trie ? compress_checkpointed<'c',lzw::code_trie>( in, out, out_fd, checkpoint, chain, resumed, path, objective )
+                    : compress_checkpointed<'c',lzw::code_hash>( in, out, out_fd, checkpoint, chain, resumed, path, objective );
+    case 'd' :
+        return trie ? compress_checkpointed<'d',lzw::code_trie>( in, out, out_fd, checkpoint, chain, resumed, path, objective )
+                    : compress_checkpointed<'d',lzw::code_hash>( in, out, out_fd, checkpoint, chain, resumed, path, objective );
+    }
+    return false;
+}
+
+//
+// Before a job is resumed, the checkpoint is checked against the files:
+// the input has to be the same file, and the output has to hold at
+// least as much as the checkpoint says was written. Anything written
+// after the checkpoint is cut off, the blocks written with the current
+// dictionary are read back for restore(), and both files are moved to
+// where the checkpoint left them.
+//
+bool prepare_resume( int in_fd, int out_fd, const lzw::compress_checkpoint &checkpoint, std::string &chain )
+{
+    struct stat in_stat;
+    struct stat out_stat;
+    if ( fstat( in_fd, &in_stat ) || fstat( out_fd, &out_stat ) ) {
+        std::cerr << "Error: " << strerror( errno ) << "\n";
+        return false;
+    }
+    if ( (unsigned long long) in_stat.st_size != checkpoint.input_size ||
+         (unsigned long long) in_stat.st_mtime != checkpoint.input_time ||
+         checkpoint.input_offset > checkpoint.input_size ) {
+        std::cerr << "Error: the input has changed since the checkpoint was saved\n";
+        return false;
+    }
+    if ( (unsigned long long) out_stat.st_size < checkpoint.output_offset ) {
+        std::cerr << "Error: the output is shorter than the checkpoint says\n";
+        return false;
+    }
+    chain.resize( (size_t) checkpoint.chain_bytes );
+    const off_t chain_start = (off_t) (checkpoint.output_offset - checkpoint.chain_bytes);
+    for ( size_t done = 0 ; done < chain.size() ; ) {
+        const ssize_t n = pread( out_fd, &chain[ done ], chain.size() - done, chain_start + done );
+        if ( n <= 0 ) {
+            std::cerr << "Error: read failed: " << strerror( n ? errno : EIO ) << "\n";
+            return false;
+        }
+        done += n;
+    }
+    if ( ftruncate( out_fd, (off_t) checkpoint.output_offset ) ||
+         lseek( out_fd, (off_t) checkpoint.output_offset, SEEK_SET ) < 0 ||
+         lseek( in_fd, (off_t) checkpoint.input_offset, SEEK_SET ) < 0 ) {
+        std::cerr << "Error: " << strerror( errno ) << "\n";
+        return false;
+    }
+    return true;
+}
+
+//
+// -mem sizes can be given as a plain number of bytes, or with a k, m,
+// or g suffix.
+//
+bool parse_size( const char *text, size_t &size )
+{
+    char *end;
+    const unsigned long long value = strtoull( text, &end, 10 );
+    if ( end == text )
+        return false;
+    unsigned long long scale = 1;
+    switch ( *end ) {
+    case 'k' : case 'K' : scale = 1ull << 10 ; end++ ; break;
+    case 'm' : case 'M' : scale = 1ull << 20 ; end++ ; break;
+    case 'g' : case 'G' : scale = 1ull << 30 ; end++ ; break;
+    }
+    if ( *end || !value )
+        return false;
+    size = size_t( value * scale );
+    return true;
+}
+
+//
+// Under a memory budget, the compressor gets the largest max_code
+// that fits, up to the one asked for. The hash table is faster, so it
+// is used unless the trie, which needs less than half the memory per
+// code, allows a bigger table. Every engine writes the same codes, so
+// the choice has no effect on the output beyond max_code itself. Raw
+// streams don't record max_code, so -d has to make the same choice to
+// read them, which it can, since it only depends on the two numbers.
+//
+unsigned int fit_max_code( size_t memory_budget, unsigned int max_code, bool &use_trie )
+{
+    const unsigned int hash_max_code = lzw::max_code_for_budget<lzw::compressor>( memory_budget, max_code );
+    const unsigned int trie_max_code =
+        lzw::max_code_for_budget< lzw::basic_compressor<lzw::code_trie> >( memory_budget, max_code );
+    use_trie = trie_max_code > hash_max_code;
+    return use_trie ? trie_max_code : hash_max_code;
+}
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+//
+// --archive runs all of the files through one archive_writer, so they
+// share the dictionary. Names can come from stdin, one to a line, so
+// that a list from find doesn't have to fit on the command line.
+//
+bool read_names( std::vector<std::string> &names )
+{
+    lzw::fd_input in( 0, 1 << 16 );
+    std::string name;
+    char c;
+    while ( in.get( c ) ) {
+        if ( c != '\n' )
+            name += c;
+        else if ( name.size() ) {
+            names.push_back( name );
+            name.clear();
+        }
+    }
+    if ( name.size() )
+        names.push_back( name );
+    return in.good();
+}
+
+template<char FLAVOUR>
+bool write_archive( lzw::fd_output &out,
+                    const std::vector<std::string> &names,
+                    unsigned int max_code,
+                    size_t reset,
+                    const lzw::filter_chain &filters,
+                    unsigned int lookahead )
+{
+    lzw::archive_writer<FLAVOUR,lzw::fd_output> archive( out, max_code, lzw::block_writer::DEFAULT_BLOCK_SIZE, reset, filters );
+    archive.set_lookahead( lookahead );
+    std::string buffer( 1 << 16, 0 );
+    for ( size_t i = 0 ; i < names.size() ; i++ ) {
+        const int fd = open( names[ i ].c_str(), O_RDONLY | O_BINARY );
+        if ( fd < 0 ) {
+            perror( names[ i ].c_str() );
+            return false;
+        }
+        archive.add( names[ i ] );
+        bool good;
+        {
+            lzw::fd_input in( fd, buffer.size() );
+            size_t length;
+            while ( (length = in.read( &buffer[ 0 ], buffer.size() ).gcount()) != 0 )
+                archive.write( buffer.data(), length );
+            good = in.good();
+        }
+        close( fd );
+        if ( !good ) {
+            perror( names[ i ].c_str() );
+            return false;
+        }
+    }
+    archive.close();
+    return true;
+}
+
+bool write_archive( lzw::fd_output &out,
+                    const std::vector<std::string> &names,
+                    unsigned int max_code,
+                    size_t reset,
+                    const lzw::filter_chain &filters,
+                    char flavour,
+                    unsigned int lookahead )
+{
+    switch ( flavour ) {
+    case 'a' : return write_archive<'a'>( out, names, max_code, reset, filters, lookahead );
+    case 'b' : return write_archive<'b'>( out, names, max_code, reset, filters, lookahead );
+    case 'c' : return write_archive<'c'>( out, names, max_code, reset, filters, lookahead );
+    }
+    return write_archive<'d'>( out, names, max_code, reset, filters, lookahead );
+}
+
+//
+// --extract starts at the member's restart point, which is the only
+// place it seeks to, and stops reading as soon as the member is done.
+//
+template<char FLAVOUR>
+bool extract_archive_member( int fd,
+                             lzw::fd_output &out,
+                             const lzw::archive_index &index,
+                             const lzw::archive_member &member )
+{
+    if ( lseek( fd, member.restart, SEEK_SET ) < 0 )
+        return false;
+    lzw::fd_input in( fd );
+    lzw::decompressor d( index.header().max_code() );
+    return lzw::extract_member<FLAVOUR>( in, out, member, d, index.filters() );
+}
+
+int archive_mode( int argc,
+                  char *argv[],
+                  unsigned int max_code,
+                  size_t reset,
+                  const lzw::filter_chain &filters,
+                  char flavour,
+                  unsigned int lookahead )
+{
+    const std::string mode = argv[1];
+    const char *path = argv[2];
+    if ( mode == "--archive" ) {
+        std::vector<std::string> names( argv + 3, argv + argc );
+        if ( names.empty() && !read_names( names ) ) {
+            perror( "stdin" );
+            return 1;
+        }
+        const int fd = open( path, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666 );
+        if ( fd < 0 ) {
+            perror( path );
+            return 1;
+        }
+        bool ok;
+        {
+            lzw::fd_output out( fd );
+            ok = write_archive( out, names, max_code, reset, filters, flavour, lookahead );
+            if ( ok && !out.flush() ) {
+                perror( path );
+                ok = false;
+            }
+        }
+        if ( close( fd ) && ok ) {
+            perror( path );
+            ok = false;
+        }
+        if ( !ok )
+            unlink( path );
+        return ok ? 0 : 1;
+    }
+    const int fd = open( path, O_RDONLY | O_BINARY );
+    if ( fd < 0 ) {
+        perror( path );
+        return 1;
+    }
+    lzw::archive_index index;
+    if ( !index.read( fd ) ) {
+        std::cerr << "Error: can't read the archive index of " << path << ": " << strerror( errno ) << "\n";
+        return 1;
+    }
+    if ( mode == "--list" ) {
+        const std::vector<lzw::archive_member> &members = index.members();
+        for ( size_t i = 0 ; i < members.size() ; i++ )
+            printf( "%12llu  %s\n", members[ i ].size, members[ i ].name.c_str() );
+        return 0;
+    }
+    const lzw::archive_member *member = index.find( argv[3] );
+    if ( !member ) {
+        std::cerr << "Error: " << path << " has no member named " << argv[3] << "\n";
+        return 1;
+    }
+    int out_fd = 1;
+    if ( argc == 5 ) {
+        out_fd = open( argv[4], O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666 );
+        if ( out_fd < 0 ) {
+            perror( argv[4] );
+            return 1;
+        }
+    }
+    bool ok;
+    {
+        lzw::fd_output out( out_fd );
+        switch ( index.header().flavour() ) {
+        case 'a' : ok = extract_archive_member<'a'>( fd, out, index, *member ); break;
+        case 'b' : ok = extract_archive_member<'b'>( fd, out, index, *member ); break;
+        case 'c' : ok = extract_archive_member<'c'>( fd, out, index, *member ); break;
+        default : ok = extract_archive_member<'d'>( fd, out, index, *member ); break;
+        }
+        if ( !ok )
+            std::cerr << "Error: damaged or unsupported compressed data\n";
+        else if ( !out.flush() ) {
+            std::cerr << "Error: write failed: " << strerror( errno ) << "\n";
+            ok = false;
+        }
+    }
+    close( fd );
+    if ( out_fd != 1 && close( out_fd ) ) {
+        perror( argv[4] );
+        ok = false;
+    }
+    return ok ? 0 : 1;
+}
+
+//
+// Files are read and written through raw file descriptors, using the
+// buffered streams from lzw-fd.h, so the iostreams library is only
+// used for error messages and the --perf mode.
+//
 int main(int argc, char* argv[])
 {
     int max_code = 32767;
-    if ( argc >= 2 && !strcmp( "-max", argv[1] ) ) {
-        if ( sscanf( argv[2], "%d", &max_code ) != 1 )
-            usage();
-        argc -= 2;
-        argv += 2;
+    bool max_code_given = false;
+    lzw::tuning_objective objective = lzw::TUNE_NONE;
+    int symbol_bits = 8;
+    lzw::filter_chain filters;
+    bool raw = false;
+    bool live = false;
+    size_t memory_budget = 0;
+    size_t checkpoint_interval = 0;
+    size_t reset_interval = 0;
+    bool resume = false;
+    char flavour = 'd';
+    unsigned int lookahead = 0;
+    parallel_options parallel = { false, 0, lzw::AUTO_PRIME_SIZE };
+    bool prime_given = false;
+    for ( ; ; ) {
+        if ( argc >= 3 && !strcmp( "-max", argv[1] ) ) {
+            objective = lzw::TUNE_NONE;
+            if ( !strcmp( "auto", argv[2] ) )
+                objective = lzw::TUNE_BALANCED;
+            else if ( !strcmp( "auto:speed", argv[2] ) )
+                objective = lzw::TUNE_SPEED;
+            else if ( !strcmp( "auto:ratio", argv[2] ) )
+                objective = lzw::TUNE_RATIO;
+            else if ( sscanf( argv[2], "%d", &max_code ) != 1 || max_code < 256 )
+                usage();
+            max_code_given = true;
+            argc -= 2;
+            argv += 2;
+        } else if ( argc >= 3 && !strcmp( "-sym", argv[1] ) ) {
+            if ( strcmp( "16", argv[2] ) )
+                usage();
+            symbol_bits = 16;
+            argc -= 2;
+            argv += 2;
+        } else if ( argc >= 3 && !strcmp( "-filter", argv[1] ) ) {
+            if ( !filters.parse( argv[2] ) )
+                usage();
+            argc -= 2;
+            argv += 2;
+        } else if ( argc >= 3 && !strcmp( "-f", argv[1] ) ) {
+            if ( strlen( argv[2] ) != 1 || argv[2][0] < 'a' || argv[2][0] > 'd' )
+                usage();
+            flavour = argv[2][0];
+            argc -= 2;
+            argv += 2;
+        } else if ( argc >= 3 && !strcmp( "-fp", argv[1] ) ) {
+            if ( sscanf( argv[2], "%u", &lookahead ) != 1 || !lookahead )
+                usage();
+            argc -= 2;
+            argv += 2;
+        } else if ( argc >= 3 && !strcmp( "-j", argv[1] ) ) {
+            if ( sscanf( argv[2], "%u", &parallel.threads ) != 1 )
+                usage();
+            parallel.parallel = true;
+            argc -= 2;
+            argv += 2;
+        } else if ( argc >= 3 && !strcmp( "-prime", argv[1] ) ) {
+            if ( !strcmp( "0", argv[2] ) )
+                parallel.prime_size = 0;
+            else if ( !parse_size( argv[2], parallel.prime_size ) || parallel.prime_size > lzw::MAX_PRIME_SIZE )
+                usage();
+            prime_given = true;
+            argc -= 2;
+            argv += 2;
+        } else if ( argc >= 2 && !strcmp( "-raw", argv[1] ) ) {
+            raw = true;
+            argc--;
+            argv++;
+        } else if ( argc >= 3 && !strcmp( "-mem", argv[1] ) ) {
+            if ( !parse_size( argv[2], memory_budget ) )
+                usage();
+            argc -= 2;
+            argv += 2;
+        } else if ( argc >= 3 && !strcmp( "-pages", argv[1] ) ) {
+            if ( !strcmp( "thp", argv[2] ) )
+                lzw::huge_pages() = lzw::HUGE_PAGES_TRANSPARENT;
+            else if ( !strcmp( "hugetlb", argv[2] ) )
+                lzw::huge_pages() = lzw::HUGE_PAGES_RESERVED;
+            else if ( !strcmp( "off", argv[2] ) )
+                lzw::huge_pages() = lzw::HUGE_PAGES_OFF;
+            else
+                usage();
+            argc -= 2;
+            argv += 2;
+        } else if ( argc >= 3 && !strcmp( "-checkpoint", argv[1] ) ) {
+            if ( !parse_size( argv[2], checkpoint_interval ) )
+                usage();
+            argc -= 2;
+            argv += 2;
+        } else if ( argc >= 3 && !strcmp( "-reset", argv[1] ) ) {
+            if ( !parse_size( argv[2], reset_interval ) )
+                usage();
+            argc -= 2;
+            argv += 2;
+        } else if ( argc >= 2 && !strcmp( "--resume", argv[1] ) ) {
+            resume = true;
+            argc--;
+            argv++;
+        } else if ( argc >= 2 && !strcmp( "-flush", argv[1] ) ) {
+            live = true;
+            argc--;
+            argv++;
+        } else
+            break;
     }
-    if ( argc < 2 )
+    if ( argc < 2 ||
+         ((raw || live || memory_budget) && objective != lzw::TUNE_NONE) ||
+         (raw && live) ||
+         (symbol_bits != 8 && (raw || live || memory_budget || objective != lzw::TUNE_NONE)) ||
+         (symbol_bits == 16 && max_code_given && max_code < 65536) ||
+         (!filters.empty() && (raw || symbol_bits != 8)) ||
+         (lookahead && symbol_bits != 8) ||
+         (prime_given && !parallel.parallel) ||
+         (parallel.parallel && (raw || live || memory_budget || symbol_bits != 8)) ||
+         (flavour == 'b' && (symbol_bits != 8 || (objective == lzw::TUNE_NONE && max_code > 0xffff))) )
+            usage();
+        if ( std::string( "--perf" ) == argv[1] ) {
+            if ( argc > 3 || parallel.parallel )
+                usage();
+            std::ifstream file;
+            if ( argc == 3 ) {
+                file.open( argv[2], std::ios_base::binary );
+                if ( !file )
+                    usage();
+            }
+            std::istream &in = argc == 3 ? file : std::cin;
+            switch ( flavour ) {
+            case 'a' : return perf<'a'>( in, max_code, objective, lookahead );
+            case 'b' : return perf<'b'>( in, max_code, objective, lookahead );
+            case 'c' : return perf<'c'>( in, max_code, objective, lookahead );
+            }
+            return perf<'d'>( in, max_code, objective, lookahead );
+        }
+        if ( std::string( "--grep" ) == argv[1] ) {
+            bool offsets = argc >= 3 && std::string( "-o" ) == argv[2];
+            if ( offsets ) {
+                argc--;
+                argv++;
+            }
+            if ( objective != lzw::TUNE_NONE ) {
+                std::cerr << "Error: -max auto only applies when compressing\n";
+                return 2;
+            }
+            if ( argc < 3 || argc > 4 || !argv[2][0] || parallel.parallel )
+                usage();
+            int fd = 0;
+            if ( argc == 4 && std::string( "-" ) != argv[3] ) {
+                fd = open( argv[3], O_RDONLY | O_BINARY );
+                if ( fd < 0 ) {
+                    perror( argv[3] );
+                    return 2;
+                }
+            }
+            lzw::fd_input in( fd );
+            return grep( in, argv[2], max_code, offsets, flavour );
+        }
+        const std::string mode = argv[1];
+        if ( mode == "--archive" || mode == "--list" || mode == "--extract" ) {
+            if ( argc < 3 || parallel.parallel ||
+                 (mode == "--list" && argc != 3) ||
+                 (mode == "--extract" && (argc < 4 || argc > 5)) ||
+                 raw || live || memory_budget || symbol_bits != 8 || checkpoint_interval || resume ||
+                 objective != lzw::TUNE_NONE )
+                usage();
+            return archive_mode( argc, argv, max_code, reset_interval, filters, flavour, lookahead );
+        }
+        if ( reset_interval )
             usage();
         bool compress;
+        bool append = false;
         if ( std::string( "-c" ) == argv[1] )
             compress = true;
         else if ( std::string( "-d" ) == argv[1] )
             compress = false;
+        else if ( std::string( "-a" ) == argv[1] && argc == 4 && !raw )
+            compress = append = true;
         else
             usage();
-        std::istream *in = &std::cin;
-        std::ostream *out = &std::cout;
-        bool delete_instream = false;
-        bool delete_ostream = false;
-        if ( argc == 3 ) {
-            in = new std::ifstream( argv[2] );
-            delete_instream = true;
+        if ( !compress && objective != lzw::TUNE_NONE ) {
+            std::cerr << "Error: -max auto only applies when compressing\n";
+            return 1;
+        }
+        if ( argc > 4 || (!compress && parallel.parallel) )
+            usage();
+        //
+        // Checkpoints need real files at both ends, since resuming means
+        // seeking in the input and reading back from the output.
+        //
+        const bool checkpointed = checkpoint_interval || resume;
+        if ( checkpointed &&
+             (!compress || argc != 4 || std::string( "-" ) == argv[2] ||
+              raw || live || symbol_bits != 8 || lookahead || parallel.parallel) )
+            usage();
+        lzw::compress_checkpoint checkpoint;
+        std::string checkpoint_path;
+        bool resumed = false;
+        if ( checkpointed ) {
+            checkpoint_path = std::string( argv[3] ) + ".ckpt";
+            resumed = resume && checkpoint.load( checkpoint_path );
+            if ( resume && !resumed && errno != ENOENT ) {
+                std::cerr << "Error: can't resume from " << checkpoint_path << ": " << strerror( errno ) << "\n";
+                return 1;
+            }
+            if ( checkpoint_interval )
+                checkpoint.interval = checkpoint_interval;
+        }
+        int in_fd = 0;
+        int out_fd = 1;
+        if ( argc >= 3 && std::string( "-" ) != argv[2] ) {
+            in_fd = open( argv[2], O_RDONLY | O_BINARY );
+            if ( in_fd < 0 ) {
+                perror( argv[2] );
+                return 1;
+            }
         }
         if ( argc == 4 ) {
-            out = new std::ofstream( argv[3] );
-            delete_ostream = true;
-            if ( std::string("-") != argv[2] ) {
-                in = new std::ifstream( argv[2] );
-                delete_instream = true;
+            const int mode = resumed ? O_RDWR : O_WRONLY | (append ? O_APPEND : O_TRUNC);
+            out_fd = open( argv[3], mode | O_CREAT | O_BINARY, 0666 );
+            if ( out_fd < 0 ) {
+                perror( argv[3] );
+                return 1;
             }
         }
-        if ( compress )
-            lzw::compress( *in, *out, max_code );
-        else
-            lzw::decompress( *in, *out, max_code );
-        if ( delete_instream )
-            delete in;
-        if ( delete_ostream )
-            delete out;
-    return 0;
+        bool use_trie = false;
+        if ( memory_budget ) {
+            max_code = fit_max_code( memory_budget, max_code, use_trie );
+            if ( !max_code ) {
+                std::cerr << "Error: -mem is too small for even the smallest dictionary\n";
+                return 1;
+            }
+        }
+        std::string chain;
+        if ( resumed && !prepare_resume( in_fd, out_fd, checkpoint, chain ) )
+            return 1;
+        if ( checkpointed && !resumed ) {
+            struct stat in_stat;
+            if ( fstat( in_fd, &in_stat ) ) {
+                perror( argv[2] );
+                return 1;
+            }
+            checkpoint.max_code = max_code;
+            checkpoint.engine = use_trie ? 't' : 'h';
+            checkpoint.flavour = flavour;
+            checkpoint.filters = filters.specs();
+            checkpoint.input_size = in_stat.st_size;
+            checkpoint.input_time = in_stat.st_mtime;
+        }
+        int result = 0;
+        {
+            lzw::fd_input in( in_fd );
+            lzw::fd_output out( out_fd );
+            if ( checkpointed ) {
+                if ( !compress_checkpointed( in, out, out_fd, checkpoint, chain, resumed, checkpoint_path, objective ) )
+                    result = 1;
+            } else if ( compress && symbol_bits == 16 )
+                compress_symbols( in, out, max_code_given ? max_code : 262143, flavour );
+            else if ( compress && use_trie )
+                compress_file<lzw::code_trie>( in, out, max_code, objective, raw, live, filters, flavour, lookahead, parallel );
+            else if ( compress )
+                compress_file<lzw::code_hash>( in, out, max_code, objective, raw, live, filters, flavour, lookahead, parallel );
+            else {
+                switch ( decompress( in, out, max_code, memory_budget, flavour ) ) {
+                case DECOMPRESS_OK :
+                    break;
+                case DECOMPRESS_DAMAGED :
+                    std::cerr << "Error: damaged or unsupported compressed data\n";
+                    result = 1;
+                    break;
+                case DECOMPRESS_ARCHIVE :
+                    std::cerr << "Error: this is an archive, use --list or --extract\n";
+                    result = 1;
+                    break;
+                case DECOMPRESS_OVER_BUDGET :
+                    std::cerr << "Error: stream needs a dictionary bigger than the -mem limit\n";
+                    result = 1;
+                    break;
+                }
+            }
+            if ( !in.good() ) {
+                std::cerr << "Error: read failed: " << strerror( errno ) << "\n";
+                result = 1;
+            }
+            if ( !out.flush() ) {
+                std::cerr << "Error: write failed: " << strerror( errno ) << "\n";
+                result = 1;
+            }
+        }
+        if ( in_fd != 0 )
+            close( in_fd );
+        if ( out_fd != 1 && close( out_fd ) ) {
+            perror( argv[3] );
+            result = 1;
+        }
+        if ( checkpointed && !result )
+            unlink( checkpoint_path.c_str() );
+    return result;
 }
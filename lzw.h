@@ -8,56 +8,328 @@
 #define _LZW_DOT_H
 
 #include <string>
-#include <unordered_map>
+#include <vector>
+#include "lzw_dictionary.h"
+
+//
+// The dictionary used here is described in lzw_dictionary.h. Instead
+// of looking up complete strings, the compressor looks up the code
+// of the current match plus the next symbol, which is all it takes
+// to extend a match by one. The output is identical to the version
+// that used std::string keys.
+//
+// The work is done by the compressor and decompressor classes, which
+// own their dictionaries and can be used over and over. Each call to
+// compress() or decompress() starts a new stream with an empty
+// dictionary, but resetting the dictionary is O(1), and the memory it
+// grew into on earlier streams is kept. For a program that handles a
+// lot of small messages, keeping one of these objects around (see
+// lzw_pool.h for a ready-made way to do that) eliminates nearly all
+// of the setup cost. The free functions compress() and decompress()
+// just create a temporary object and use it once.
+//
+// The compressor is a template, basic_compressor, whose parameter is
+// the engine that holds its dictionary - one of the classes described
+// in lzw_dictionary.h. compressor is the version that uses the default,
+// code_hash, and compress() takes the engine as an optional template
+// argument, as in compress<lzw::code_trie>( in, out ). The decompressor
+// has no such choice to make: it only ever looks entries up by code, so
+// a plain vector indexed by code is as good as it gets.
+//
+// Both classes can be given a base_dictionary that was primed with
+// sample data. Both sides must use the same base, and the code
+// streams are told where the dictionary starts with preset().
+//
+// Both classes report peak_bytes(), the most memory their dictionary
+// has held at any one time, and the static peak_bytes_for(), which is
+// the most it can ever need for a given max_code. Since a dictionary
+// stops growing once max_code is reached, choosing max_code is all it
+// takes to cap the memory, and max_code_for_budget() picks the largest
+// one that fits in a given number of bytes. Both sides of a stream have
+// to agree on max_code, so a compressed stream that records it in its
+// header, as the lzw program does, carries the limit along with it.
+//
+// The compressor parses greedily by default, always extending the
+// current match as far as the dictionary allows. set_lookahead() turns
+// on flexible parsing instead, which looks at where each shorter split
+// of the match would leave the next one, and takes a split that
+// reaches well past the longest match with two codes. The decompressor doesn't need to
+// know: the codes are all in its dictionary, and the compressor keeps
+// its codes numbered the same way by skipping one whenever the entry
+// the decompressor adds is a string it already has. It costs more time
+// to compress, roughly one more search for every shorter split tried,
+// and nothing at all to decompress.
+//
 
 namespace lzw {
-template<class INPUT, class OUTPUT>
-void compress( INPUT &input, OUTPUT &output, const unsigned int max_code = 32767 )
+
+template<class ENGINE>
+class basic_compressor
 {
-    input_symbol_stream<INPUT> in( input );
-    output_code_stream<OUTPUT> out( output, max_code );
+public :
+    enum {
+        FLEXIBLE_WINDOW = 1 << 16,
+        SPLIT_MARGIN = 2
+    };
+    basic_compressor( const unsigned int max_code = 32767, const base_dictionary &base = base_dictionary::roots() )
+        : m_codes( base, max_code ),
+          m_lookahead( 0 ) {}
+    template<class INPUT, class OUTPUT>
+    void compress( INPUT &input, OUTPUT &output )
+    {
+        m_codes.reset();
+        resume( input, output );
+    }
+    //
+    // resume() compresses input as a complete code stream of its own,
+    // ending with EOF_CODE, but keeps the dictionary built by earlier
+    // calls, so the strings seen in the last stream are still available.
+    // This is how a sync flush works: the data so far can be decoded as
+    // soon as it is written, without losing the compression history.
+    // The matching decompressor has to call resume() on the same streams
+    // in the same order.
+    //
+    template<class INPUT, class OUTPUT>
+    void resume( INPUT &input, OUTPUT &output )
+    {
+        if ( m_lookahead ) {
+            resume_flexible( input, output );
+            return;
+        }
+        input_symbol_stream<INPUT> in( input );
+        output_code_stream<OUTPUT> out( output, m_codes.max_code() );
+        out.preset( m_codes.next_code() );
+        char c;
+        if ( !(in >> c) )
+            return;
+        unsigned int current_code = (unsigned char) c;
+        while ( in >> c ) {
+            const unsigned int symbol = (unsigned char) c;
+            const unsigned int code = m_codes.find( current_code, symbol );
+            if ( code != NO_CODE )
+                current_code = code;
+            else {
+                m_codes.add( current_code, symbol );
+                out << current_code;
+                current_code = symbol;
+            }
+        }
+        out << current_code;
+    }
+    //
+    // 0, the default, parses greedily. Otherwise, up to lookahead
+    // splits shorter than the longest match are tried at each step, so
+    // the time it takes grows with the lookahead and with the length
+    // of the matches. The output is the same whichever engine is used,
+    // but it depends on the lookahead, so anything that compresses the
+    // same data again to check it, like block_writer::restore(), has
+    // to use the same setting.
+    //
+    void set_lookahead( unsigned int lookahead ) { m_lookahead = lookahead; }
+    unsigned int lookahead() const { return m_lookahead; }
+    unsigned int max_code() const { return m_codes.max_code(); }
+    //
+    // The next code that would have been added to the dictionary,
+    // which is more than max_code if the last stream filled it up.
+    //
+    unsigned int next_code() const { return m_codes.next_code(); }
+    const base_dictionary &base() const { return m_codes.base(); }
+    size_t bytes() const { return m_codes.bytes(); }
+    size_t peak_bytes() const { return m_codes.peak_bytes(); }
+    static size_t peak_bytes_for( unsigned int max_code, const base_dictionary &base = base_dictionary::roots() )
+    {
+        return layered_dictionary<ENGINE>::peak_bytes_for( base, max_code );
+    }
+private :
+    //
+    // The input is read into a window, which is topped up whenever less
+    // than FLEXIBLE_WINDOW bytes are left ahead of the current position,
+    // so that's as far as a match can look. Every prefix of a string in
+    // the dictionary is in the dictionary too, so the code for each
+    // shorter split is found on the way to the longest match, and kept
+    // in m_prefix_codes. Until the end of the input, a match always
+    // stops short of the end of the window, so there is a next symbol
+    // to add an entry with, just as in the greedy loop.
+    //
+    // A shorter split always costs a dictionary entry, since the one the
+    // decompressor adds for it is the next longer split, which is there
+    // already. Taking every split that reaches even one symbol further
+    // made text files bigger, not smaller, so a split has to beat the
+    // longest match by more than SPLIT_MARGIN symbols, which was best or
+    // close to it on everything tried, and never more than a tenth of a
+    // percent worse than greedy.
+    //
+    template<class INPUT, class OUTPUT>
+    void resume_flexible( INPUT &input, OUTPUT &output )
+    {
+        input_symbol_stream<INPUT> in( input );
+        output_code_stream<OUTPUT> out( output, m_codes.max_code() );
+        out.preset( m_codes.next_code() );
+        m_window.clear();
+        size_t i = 0;
+        bool more = true;
+        for ( ; ; ) {
+            if ( more && m_window.size() - i < FLEXIBLE_WINDOW ) {
+                m_window.erase( 0, i );
+                i = 0;
+                char c;
+                while ( m_window.size() < 2 * FLEXIBLE_WINDOW && (more = (in >> c)) )
+                    m_window += c;
+            }
+            if ( i == m_window.size() )
+                return;
+            const size_t end = more ? m_window.size() - 1 : m_window.size();
+            unsigned int code = symbol_at( i );
+            m_prefix_codes.clear();
+            m_prefix_codes.push_back( code );
+            while ( i + m_prefix_codes.size() < end ) {
+                code = m_codes.find( code, symbol_at( i + m_prefix_codes.size() ) );
+                if ( code == NO_CODE )
+                    break;
+                m_prefix_codes.push_back( code );
+            }
+            const size_t longest = m_prefix_codes.size();
+            size_t length = longest;
+            if ( i + longest < m_window.size() ) {
+                size_t reach = longest + match_length( i + longest, end );
+                const size_t shortest = longest > m_lookahead ? longest - m_lookahead : 1;
+                for ( size_t split = longest - 1 ; split >= shortest ; split-- ) {
+                    const size_t split_reach = split + match_length( i + split, end );
+                    if ( split_reach > reach + SPLIT_MARGIN ) {
+                        reach = split_reach;
+                        length = split;
+                    }
+                }
+                if ( length < longest )
+                    m_codes.reserve();
+                else
+                    m_codes.add( m_prefix_codes[ length - 1 ], symbol_at( i + length ) );
+            }
+            out << m_prefix_codes[ length - 1 ];
+            i += length;
+        }
+    }
+    unsigned int symbol_at( size_t i ) const { return (unsigned char) m_window[ i ]; }
+    size_t match_length( size_t i, size_t end ) const
+    {
+        unsigned int code = symbol_at( i );
+        size_t length = 1;
+        while ( i + length < end && (code = m_codes.find( code, symbol_at( i + length ) )) != NO_CODE )
+            length++;
+        return length;
+    }
+    layered_dictionary<ENGINE> m_codes;
+    unsigned int m_lookahead;
+    std::string m_window;
+    std::vector<unsigned int> m_prefix_codes;
+};
 
-    std::unordered_map<std::string, unsigned int> codes( (max_code * 11)/10 );
-    for ( unsigned int i = 0 ; i < 256 ; i++ )
-        codes[std::string(1,i)] = i;
-    unsigned int next_code = 257;
-    std::string current_string;
-    char c;
-    while ( in >> c ) {
-        current_string = current_string + c;
-        if ( codes.find(current_string) == codes.end() ) {
-            if ( next_code <= max_code )
-                codes[ current_string ] = next_code++;
-            current_string.erase(current_string.size()-1);
-            out << codes[current_string];
-            current_string = c;
+typedef basic_compressor<code_hash> compressor;
+
+class decompressor
+{
+public :
+    decompressor( const unsigned int max_code = 32767, const base_dictionary &base = base_dictionary::roots() )
+        : m_strings( base, max_code ) {}
+    template<class INPUT, class OUTPUT>
+    void decompress( INPUT &input, OUTPUT &output )
+    {
+        m_strings.reset();
+        resume( input, output );
+    }
+    //
+    // Decodes a code stream written by compressor::resume(). The first
+    // code in each stream doesn't add a dictionary entry, on either side.
+    //
+    template<class INPUT, class OUTPUT>
+    void resume( INPUT &input, OUTPUT &output )
+    {
+        input_code_stream<INPUT> in( input, m_strings.max_code() );
+        in.preset( m_strings.next_code() );
+        output_symbol_stream<OUTPUT> out( output );
+        unsigned int previous_code = NO_CODE;
+        unsigned int code;
+        while ( in >> code ) {
+            if ( m_strings.contains( code ) )
+                m_strings.expand( code, m_current_string );
+            else {
+                if ( previous_code == NO_CODE || code != m_strings.next_code() )
+                    return;
+                m_current_string = m_previous_string + m_previous_string[0];
+            }
+            out << m_current_string;
+            if ( previous_code != NO_CODE )
+                m_strings.add( previous_code, (unsigned char) m_current_string[0] );
+            previous_code = code;
+            m_previous_string.swap( m_current_string );
         }
     }
-    if ( current_string.size() )
-        out << codes[current_string];
+    unsigned int max_code() const { return m_strings.max_code(); }
+    const base_dictionary &base() const { return m_strings.base(); }
+    //
+    // Only the dictionary is counted. The two string buffers used to
+    // write each code's string are as long as the longest string seen.
+    //
+    size_t bytes() const { return m_strings.bytes(); }
+    size_t peak_bytes() const { return m_strings.peak_bytes(); }
+    static size_t peak_bytes_for( unsigned int max_code, const base_dictionary &base = base_dictionary::roots() )
+    {
+        return layered_strings::peak_bytes_for( base, max_code );
+    }
+private :
+    layered_strings m_strings;
+    std::string m_previous_string;
+    std::string m_current_string;
+};
+
+//
+// The largest max_code, no bigger than the one asked for, whose
+// dictionary is sure to fit in budget bytes when used by CONTEXT, which
+// is compressor, decompressor, or any basic_compressor. Returns 0 if
+// not even 256 fits. The peak only grows with max_code, so a binary
+// search finds it.
+//
+template<class CONTEXT>
+unsigned int max_code_for_budget( size_t budget,
+                                  unsigned int max_code,
+                                  const base_dictionary &base = base_dictionary::roots() )
+{
+    if ( CONTEXT::peak_bytes_for( 256, base ) > budget )
+        return 0;
+    unsigned int low = 256;
+    unsigned int high = max_code;
+    while ( low < high ) {
+        const unsigned int middle = low + (high - low + 1) / 2;
+        if ( CONTEXT::peak_bytes_for( middle, base ) <= budget )
+            low = middle;
+        else
+            high = middle - 1;
+    }
+    return low;
 }
 
+template<class ENGINE = code_hash, class INPUT, class OUTPUT>
+void compress( INPUT &input, OUTPUT &output, const unsigned int max_code = 32767 )
+{
+    basic_compressor<ENGINE>( max_code ).compress( input, output );
+}
+
+template<class ENGINE = code_hash, class INPUT, class OUTPUT>
+void compress( INPUT &input, OUTPUT &output, const base_dictionary &base, const unsigned int max_code = 32767 )
+{
+    basic_compressor<ENGINE>( max_code, base ).compress( input, output );
+}
 
 template<class INPUT, class OUTPUT>
 void decompress( INPUT &input, OUTPUT &output, const unsigned int max_code = 32767  )
 {
-    input_code_stream<INPUT> in( input, max_code );
-    output_symbol_stream<OUTPUT> out( output );
+    decompressor( max_code ).decompress( input, output );
+}
 
-    std::unordered_map<unsigned int,std::string> strings( (max_code * 11) / 10 );
-    for ( int unsigned i = 0 ; i < 256 ; i++ )
-        strings[i] = std::string(1,i);
-    std::string previous_string;
-    unsigned int code;
-    unsigned int next_code = 257;
-    while ( in >> code ) {
-        if ( strings.find( code ) == strings.end() ) 
-            strings[ code ] = previous_string + previous_string[0];
-        out << strings[code];
-        if ( previous_string.size() && next_code <= max_code )
-            strings[next_code++] = previous_string + strings[code][0];
-        previous_string = strings[code];
-    }
+template<class INPUT, class OUTPUT>
+void decompress( INPUT &input, OUTPUT &output, const base_dictionary &base, const unsigned int max_code = 32767  )
+{
+    decompressor( max_code, base ).decompress( input, output );
 }
 
 }; //namespace lzw
@@ -0,0 +1,424 @@
+//
+// Copyright (c) 2011 Mark Nelson
+//
+// This software is licensed under the OSI MIT License, contained in
+// the file license.txt included with this project.
+//
+#ifndef LZW_ARCHIVE_DOT_H
+#define LZW_ARCHIVE_DOT_H
+
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "lzw_streambase.h"
+#include "lzw_memory.h"
+#include "lzw_header.h"
+#include "lzw_block.h"
+
+//
+// Compressing thousands of small files one at a time starts each of
+// them with an empty dictionary, and most of a small file goes by
+// before the dictionary knows anything worth knowing. Configuration
+// files and source code repeat each other as much as they repeat
+// themselves, so a solid archive, which runs all of the files through
+// one block stream end to end, keeps the dictionary from one file to
+// the next and does much better.
+//
+// The catch with a solid stream is getting one file back out without
+// decoding everything before it. The blocks already give us places to
+// start: every 'L' or 'S' block begins with an empty dictionary, so
+// decoding can start there. The archive writer notes where each of
+// these restart points is, in the archive and in the data, and a
+// trailing index gives the name, size and position of every member,
+// along with the last restart point before it. Extracting a member
+// means seeking to its restart point and decoding from there, which is
+// at most one reset interval of data before its first byte.
+//
+// The reset interval matters for compression too. Once the dictionary
+// is full it stops learning, and a stream of many different files
+// drifts away from what it learned much sooner than one big file does.
+// The block writer's usual limit of 16 bytes of input per code leaves a
+// full dictionary in use for too long, and an archive of source files
+// can come out bigger than the files compressed one by one. The writer
+// starts a new dictionary every 8 bytes per code instead, 256KB with
+// the default max_code, unless it is given some other interval, and
+// with that, the same files come out several percent smaller than
+// they do one at a time, more with a bigger max_code.
+//
+// An archive looks like this:
+//
+//    4 bytes   the magic number, "LwZa"
+//    header    a stream header, as in lzw_header.h, with HAS_BLOCKS
+//    blocks    the members end to end, as blocks from lzw_block.h,
+//              finishing with an 'E' block
+//    varint    the number of members, then for each one:
+//                 varint   length of the name, then the name
+//                 varint   size
+//                 varint   offset of the member in the data
+//                 varint   offset in the archive of its restart point
+//                 varint   offset in the data of its restart point
+//    8 bytes   offset in the archive of the index, little-endian
+//    4 bytes   "LwZi"
+//
+// Like the stream header, the magic number can't be mistaken for the
+// start of a bare code stream, and it isn't a stream header either, so
+// lzw -d can tell an archive apart from a compressed file and say so.
+// The index is at the end because the writer doesn't know where the
+// members will land until it has written them, and that way it never
+// has to seek.
+//
+
+namespace lzw {
+
+struct archive_member
+{
+    std::string name;
+    unsigned long long size;
+    unsigned long long offset;
+    unsigned long long restart;
+    unsigned long long restart_offset;
+};
+
+namespace archive_detail {
+
+inline const char *magic() { return "LwZa"; }
+inline const char *index_magic() { return "LwZi"; }
+enum { MAGIC_SIZE = 4, TRAILER_SIZE = 12 };
+
+struct restart_point
+{
+    unsigned long long restart;
+    unsigned long long offset;
+};
+
+//
+// Passes everything on to OUTPUT, counting the bytes, so the writer
+// knows where each block starts.
+//
+template<class OUTPUT>
+class counting_output
+{
+public :
+    counting_output( OUTPUT &output )
+        : m_output( output ),
+          m_count( 0 ) {}
+    void put( char c )
+    {
+        m_output.put( c );
+        m_count++;
+    }
+    void write( const char *data, size_t length )
+    {
+        m_output.write( data, length );
+        m_count += length;
+    }
+    unsigned long long tellp() const { return m_count; }
+private :
+    OUTPUT &m_output;
+    unsigned long long m_count;
+};
+
+//
+// Throws away the first skip bytes written to it, passes on the next
+// length bytes, and ignores anything after that.
+//
+template<class OUTPUT>
+class window_output
+{
+public :
+    window_output( OUTPUT &output, unsigned long long skip, unsigned long long length )
+        : m_output( output ),
+          m_skip( skip ),
+          m_length( length ) {}
+    void write( const char *data, size_t length )
+    {
+        if ( m_skip >= length ) {
+            m_skip -= length;
+            return;
+        }
+        data += m_skip;
+        length -= (size_t) m_skip;
+        m_skip = 0;
+        if ( length > m_length )
+            length = (size_t) m_length;
+        m_output.write( data, length );
+        m_length -= length;
+    }
+    bool done() const { return !m_length; }
+private :
+    OUTPUT &m_output;
+    unsigned long long m_skip;
+    unsigned long long m_length;
+};
+
+}; //namespace archive_detail
+
+//
+// add() starts a new member, and write() adds data to it, as much at a
+// time as is convenient. close(), which the destructor calls if nobody
+// else has, writes the last blocks and the index. The data is cut into
+// blocks without regard to where one member ends and the next begins,
+// so a block can hold pieces of many small files.
+//
+template<char FLAVOUR, class OUTPUT, class ENGINE = code_hash>
+class archive_writer
+{
+public :
+    enum { RESET_PER_CODE = 8 };
+    archive_writer( OUTPUT &output,
+                    unsigned int max_code = 32767,
+                    size_t block_size = block_writer::DEFAULT_BLOCK_SIZE,
+                    size_t reset = 0,
+                    const filter_chain &filters = filter_chain() )
+        : m_output( output ),
+          m_compressor( max_code ),
+          m_writer( m_compressor, block_size ),
+          m_block_size( block_size ? block_size : block_writer::DEFAULT_BLOCK_SIZE ),
+          m_position( 0 ),
+          m_blocks( 0 ),
+          m_closed( false )
+    {
+        if ( !reset )
+            reset = (size_t) ((max_code + 1ull) * RESET_PER_CODE);
+        m_writer.set_history_limit( reset );
+        if ( reset < m_block_size )
+            m_block_size = reset;
+        for ( int i = 0 ; i < archive_detail::MAGIC_SIZE ; i++ )
+            m_output.put( archive_detail::magic()[ i ] );
+        stream_header header;
+        header.set_blocks();
+        header.set_max_code( max_code );
+        header.set_filters( filters.specs() );
+        header.set_flavour( FLAVOUR );
+        header.write( m_output );
+        m_writer.set_filters( filters );
+        m_blocks = m_output.tellp();
+    }
+    ~archive_writer() { close(); }
+    void add( const std::string &name )
+    {
+        archive_member member;
+        member.name = name;
+        member.size = 0;
+        member.offset = m_position + m_pending.size();
+        member.restart = m_blocks;
+        member.restart_offset = 0;
+        m_members.push_back( member );
+    }
+    void write( const char *data, size_t length )
+    {
+        m_members.back().size += length;
+        m_pending.append( data, length );
+        size_t start = 0;
+        for ( ; m_pending.size() - start >= m_block_size ; start += m_block_size )
+            write_block( m_pending.data() + start, m_block_size );
+        m_pending.erase( 0, start );
+    }
+    void close()
+    {
+        if ( m_closed )
+            return;
+        m_closed = true;
+        if ( m_pending.size() )
+            write_block( m_pending.data(), m_pending.size() );
+        m_pending.clear();
+        m_writer.finish( m_output );
+        //
+        // Each member goes back to the last restart point at or before
+        // its first byte. Restart points are only ever at the start of
+        // a block, and the block holding that byte starts at or before
+        // it, so that restart point is the one in force for it.
+        //
+        size_t r = 0;
+        for ( size_t i = 0 ; i < m_members.size() ; i++ ) {
+            archive_member &member = m_members[ i ];
+            while ( r + 1 < m_restarts.size() && m_restarts[ r + 1 ].offset <= member.offset )
+                r++;
+            if ( r < m_restarts.size() ) {
+                member.restart = m_restarts[ r ].restart;
+                member.restart_offset = m_restarts[ r ].offset;
+            }
+        }
+        const unsigned long long index = m_output.tellp();
+        write_varint( m_output, m_members.size() );
+        for ( size_t i = 0 ; i < m_members.size() ; i++ ) {
+            const archive_member &member = m_members[ i ];
+            write_varint( m_output, member.name.size() );
+            m_output.write( member.name.data(), member.name.size() );
+            write_varint( m_output, member.size );
+            write_varint( m_output, member.offset );
+            write_varint( m_output, member.restart );
+            write_varint( m_output, member.restart_offset );
+        }
+        for ( int i = 0 ; i < 8 ; i++ )
+            m_output.put( char( index >> (i * 8) ) );
+        for ( int i = 0 ; i < archive_detail::MAGIC_SIZE ; i++ )
+            m_output.put( archive_detail::index_magic()[ i ] );
+    }
+    //
+    // Archives are written once and read many times, so they are a good
+    // place for the flexible parsing described in lzw.h, which makes
+    // compression slower but extraction no slower at all.
+    //
+    void set_lookahead( unsigned int lookahead ) { m_compressor.set_lookahead( lookahead ); }
+    const std::vector<archive_member> &members() const { return m_members; }
+    size_t restart_points() const { return m_restarts.size(); }
+private :
+    archive_writer( const archive_writer & );
+    archive_writer &operator=( const archive_writer & );
+    //
+    // length is never more than a block, so this writes exactly one
+    // block, and if the writer's chain is now just that block, or it
+    // was stored, it starts with an empty dictionary.
+    //
+    void write_block( const char *data, size_t length )
+    {
+        const unsigned long long start = m_output.tellp();
+        m_writer.template write<FLAVOUR>( m_output, data, length );
+        const unsigned long long chain = m_writer.chain_bytes();
+        if ( !chain || chain == m_output.tellp() - start ) {
+            const archive_detail::restart_point restart = { start, m_position };
+            m_restarts.push_back( restart );
+        }
+        m_position += length;
+    }
+    archive_detail::counting_output<OUTPUT> m_output;
+    basic_compressor<ENGINE> m_compressor;
+    basic_block_writer<ENGINE> m_writer;
+    size_t m_block_size;
+    unsigned long long m_position;
+    unsigned long long m_blocks;
+    std::string m_pending;
+    std::vector<archive_member> m_members;
+    std::vector<archive_detail::restart_point> m_restarts;
+    bool m_closed;
+};
+
+//
+// Reads the header and the index of an archive open on fd, using
+// pread(), so it doesn't matter where the file position is. Returns
+// false if the file can't be read, with errno set, or if it isn't an
+// archive or is damaged, with errno set to EINVAL.
+//
+class archive_index
+{
+public :
+    static bool present( const char *data, size_t length )
+    {
+        if ( length < archive_detail::MAGIC_SIZE )
+            return false;
+        for ( int i = 0 ; i < archive_detail::MAGIC_SIZE ; i++ )
+            if ( data[ i ] != archive_detail::magic()[ i ] )
+                return false;
+        return true;
+    }
+    bool read( int fd )
+    {
+        struct stat st;
+        if ( fstat( fd, &st ) )
+            return false;
+        const unsigned long long size = st.st_size;
+        std::string start( 4096, 0 );
+        char trailer[ archive_detail::TRAILER_SIZE ];
+        const long start_length = pread( fd, &start[ 0 ], start.size(), 0 );
+        if ( start_length < 0 ||
+             size < archive_detail::TRAILER_SIZE ||
+             pread( fd, trailer, sizeof( trailer ), size - sizeof( trailer ) ) != (long) sizeof( trailer ) )
+            return invalid( start_length < 0 );
+        start.resize( start_length );
+        if ( !present( start.data(), start.size() ) )
+            return invalid();
+        memory_input header_in( start );
+        header_in.skip( archive_detail::MAGIC_SIZE );
+        if ( !m_header.read( header_in ) || !m_header.has_blocks() || !m_filters.set( m_header.filters() ) )
+            return invalid();
+        m_blocks = header_in.tellg();
+        unsigned long long index = 0;
+        for ( int i = 0 ; i < 8 ; i++ )
+            index |= (unsigned long long) (unsigned char) trailer[ i ] << (i * 8);
+        for ( int i = 0 ; i < archive_detail::MAGIC_SIZE ; i++ )
+            if ( trailer[ 8 + i ] != archive_detail::index_magic()[ i ] )
+                return invalid();
+        if ( index < m_blocks || index > size - sizeof( trailer ) )
+            return invalid();
+        std::string data( (size_t) (size - sizeof( trailer ) - index), 0 );
+        if ( data.size() && pread( fd, &data[ 0 ], data.size(), index ) != (long) data.size() )
+            return invalid( true );
+        memory_input in( data );
+        unsigned long long count;
+        if ( !read_varint( in, count ) || count > data.size() )
+            return invalid();
+        m_members.resize( (size_t) count );
+        for ( size_t i = 0 ; i < m_members.size() ; i++ ) {
+            archive_member &member = m_members[ i ];
+            unsigned long long length;
+            if ( !read_varint( in, length ) || length > in.available() )
+                return invalid();
+            member.name.assign( in.next(), (size_t) length );
+            in.skip( (size_t) length );
+            if ( !read_varint( in, member.size ) ||
+                 !read_varint( in, member.offset ) ||
+                 !read_varint( in, member.restart ) ||
+                 !read_varint( in, member.restart_offset ) ||
+                 member.restart_offset > member.offset ||
+                 member.restart < m_blocks || member.restart >= index )
+                return invalid();
+        }
+        return !in.available() || invalid();
+    }
+    const stream_header &header() const { return m_header; }
+    const filter_chain &filters() const { return m_filters; }
+    const std::vector<archive_member> &members() const { return m_members; }
+    //
+    // Returns the first member with the given name, or 0 if there isn't
+    // one.
+    //
+    const archive_member *find( const std::string &name ) const
+    {
+        for ( size_t i = 0 ; i < m_members.size() ; i++ )
+            if ( m_members[ i ].name == name )
+                return &m_members[ i ];
+        return 0;
+    }
+private :
+    bool invalid( bool error = false )
+    {
+        if ( !error )
+            errno = EINVAL;
+        return false;
+    }
+    stream_header m_header;
+    filter_chain m_filters;
+    unsigned long long m_blocks;
+    std::vector<archive_member> m_members;
+};
+
+//
+// Decodes one member, with input positioned at its restart point, and
+// writes it to OUTPUT, which needs write(). Only the blocks from the
+// restart point to the end of the member are read. Returns false if
+// the blocks are damaged, or end before the member does.
+//
+template<char FLAVOUR, class INPUT, class OUTPUT>
+bool extract_member( INPUT &input,
+                     OUTPUT &output,
+                     const archive_member &member,
+                     decompressor &d,
+                     const filter_chain &filters )
+{
+    archive_detail::window_output<OUTPUT> window( output, member.offset - member.restart_offset, member.size );
+    block_reader reader( d );
+    reader.set_filters( filters );
+    reader.set_primed( false );
+    while ( !window.done() )
+        if ( !reader.template read_block<FLAVOUR>( input, window ) || reader.end() )
+            return false;
+    return true;
+}
+
+}; //namespace lzw
+
+#endif //#ifndef LZW_ARCHIVE_DOT_H
@@ -0,0 +1,814 @@
+//
+// Copyright (c) 2011 Mark Nelson
+//
+// This software is licensed under the OSI MIT License, contained in
+// the file license.txt included with this project.
+//
+#ifndef LZW_BLOCK_DOT_H
+#define LZW_BLOCK_DOT_H
+
+#include <algorithm>
+#include <string>
+#include <memory>
+#include <cmath>
+#include <cstddef>
+#include "lzw_streambase.h"
+#include "lzw_memory.h"
+#include "lzw_header.h"
+#include "lzw.h"
+#include "lzw_tune.h"
+#include "lzw_filter.h"
+
+//
+// LZW does a good job on text and other data with lots of repeated
+// strings, but when it is handed data that has already been compressed
+// or encrypted, it does worse than nothing. It spends all its time
+// adding strings to a dictionary that will never be used, and it
+// writes a code of 9 to 16 bits for nearly every input byte.
+//
+// The block format defined here gets around that by breaking the input
+// into blocks, each of which is either compressed or just copied
+// through. When a stream header has the HAS_BLOCKS flag set, it is
+// followed by a sequence of blocks, each of which starts with a type
+// byte:
+//
+//    'L'  an LZW block:
+//         varint    length of the original data
+//         varint    length of the code stream that follows
+//         bytes     the code stream, which starts with an empty
+//                   dictionary and ends with EOF_CODE
+//    'C'  an LZW block that continues the dictionary:
+//         laid out just like 'L', but the code stream picks up with
+//         the dictionary left behind by the previous 'L' or 'C' block
+//    'P'  an LZW block primed from the block before it:
+//         varint    length of the priming data, at most MAX_PRIME_SIZE
+//                   and no more than the length of the previous block
+//         varint    length of the original data
+//         varint    length of the code stream that follows
+//         bytes     the code stream, which picks up with the dictionary
+//                   left behind by compressing the last bytes of the
+//                   previous block's data, as many as the priming
+//                   length says, as a code stream of their own
+//    'S'  a stored block:
+//         varint    length of the data
+//         bytes     the data, exactly as it appeared in the input
+//    'E'  the end of the stream
+//
+// Recording both lengths in an LZW block means the decoder knows how
+// much output to expect before it starts, and can check that it got
+// exactly that much when it is done.
+//
+// block_writer decides which type to use in two steps. First, it takes
+// a quick look at the start of the block, and if the byte frequencies
+// there are nearly flat, it doesn't even try to compress, it just
+// writes a stored block. Looking at 4KB is enough to spot JPEG, gzip, or
+// encrypted data, and costs almost nothing compared to compressing a
+// block. Otherwise, the block is compressed, and if the result turns
+// out to be no smaller than the original, it is thrown away and the
+// block is stored instead. The worst case expansion is then a few
+// bytes per block.
+//
+// Primed blocks are for compressing blocks in parallel, as
+// lzw_parallel.h does. An 'L' block starts with an empty dictionary,
+// which costs a lot of ratio when blocks are independent, but a 'C'
+// block has to wait for the compressor to finish the block before it.
+// A 'P' block only needs the data of the block before, which is there
+// in the input from the start, so each worker can build a dictionary
+// from the tail of it, and then compress its own block. The decoder
+// has that data too, once it has decoded the block before, and builds
+// the same dictionary with prime(). It costs the decoder the time it
+// takes to compress and decompress the priming data, on top of the
+// block itself.
+//
+// Continuation blocks are what make a sync flush possible. A program
+// that sends compressed data over a socket as it is produced can't wait
+// for a megabyte of input to fill a block, but if every small batch of
+// data started a new dictionary, the compression ratio would be awful.
+// Instead, stream_writer::flush() ends the current code stream, padding
+// it out to a byte boundary, and writes it as a block that the receiver
+// can decode right away. The next batch goes in a 'C' block, which picks
+// up the same dictionary, so nothing is lost but a few bits of padding
+// and a few bytes of block header. Once a dictionary has been used for
+// a full block's worth of data, the writer starts a new one with an 'L'
+// block, as usual. A stored block always ends the chain, since the
+// compressor may have added strings from it to its dictionary before
+// deciding not to use them, and the decoder never sees those strings.
+//
+
+namespace lzw {
+
+enum block_type {
+    LZW_BLOCK = 'L',
+    CONTINUE_BLOCK = 'C',
+    STORED_BLOCK = 'S',
+    PRIMED_BLOCK = 'P',
+    END_BLOCK = 'E'
+};
+
+enum { MAX_PRIME_SIZE = 1 << 18 };
+
+//
+// Leaves c with the dictionary a 'P' block starts with, which is the
+// one left behind by compressing the priming data as a code stream of
+// its own, and puts that code stream in codes, so that a decompressor
+// can be brought to the same state by decoding it. Flexible parsing,
+// if c uses it, is turned off for the priming data, which the decoder
+// always parses greedily.
+//
+template<char FLAVOUR, class ENGINE>
+void prime( basic_compressor<ENGINE> &c, const char *data, size_t length, std::string &codes )
+{
+    const unsigned int lookahead = c.lookahead();
+    c.set_lookahead( 0 );
+    codes.clear();
+    {
+        memory_input in( data, length );
+        memory_output out( codes );
+        flavoured<memory_input,FLAVOUR> flavoured_in( in );
+        flavoured<memory_output,FLAVOUR> flavoured_out( out );
+        c.compress( flavoured_in, flavoured_out );
+    }
+    c.set_lookahead( lookahead );
+}
+
+//
+// Returns the order-0 entropy of the first sample_size bytes of the
+// data, in bits per byte. Random data scores very close to 8, text
+// usually scores somewhere between 4 and 5.
+//
+inline double sample_entropy( const char *data, size_t length, size_t sample_size = 4096 )
+{
+    if ( length > sample_size )
+        length = sample_size;
+    if ( !length )
+        return 0;
+    size_t counts[ 256 ] = { 0 };
+    for ( size_t i = 0 ; i < length ; i++ )
+        counts[ (unsigned char) data[ i ] ]++;
+    double entropy = 0;
+    for ( int i = 0 ; i < 256 ; i++ )
+        if ( counts[ i ] ) {
+            double p = (double) counts[ i ] / length;
+            entropy -= p * std::log( p );
+        }
+    return entropy / std::log( 2.0 );
+}
+
+//
+// Like the compressor, the writer is a template on the dictionary
+// engine, and block_writer is the one that uses the default.
+//
+// If the writer is given a filter_chain, each block is filtered before
+// anything else is done with it, so a stored block holds the filtered
+// data too, and the reader undoes the filters on every block.
+//
+template<class ENGINE>
+class basic_block_writer
+{
+public :
+    enum {
+        DEFAULT_BLOCK_SIZE = 1 << 20,
+        ENTROPY_SAMPLE = 4096,
+        HISTORY_PER_CODE = 16
+    };
+    basic_block_writer( basic_compressor<ENGINE> &c,
+                        size_t block_size = DEFAULT_BLOCK_SIZE,
+                        double entropy_limit = 7.5 )
+        : m_compressor( c ),
+          m_block_size( block_size ? block_size : DEFAULT_BLOCK_SIZE ),
+          m_history_limit( history_limit( m_block_size, c.max_code() ) ),
+          m_entropy_limit( entropy_limit ),
+          m_history( 0 ),
+          m_chain_bytes( 0 ),
+          m_stored_blocks( 0 ),
+          m_lzw_blocks( 0 ) {}
+    //
+    // Writes the data as one or more blocks, none of them longer than
+    // the block size. Each call writes out everything it is given, so
+    // the receiver can decode all of it as soon as it arrives. The
+    // dictionary is carried over from the last call as long as the
+    // total data compressed with it stays within the history limit.
+    //
+    template<char FLAVOUR, class OUTPUT>
+    void write( OUTPUT &output, const char *data, size_t length )
+    {
+        while ( length ) {
+            const size_t n = length < m_block_size ? length : m_block_size;
+            write_block<FLAVOUR>( output, data, n );
+            data += n;
+            length -= n;
+        }
+    }
+    //
+    // Writes data as one 'P' block, primed with the prime_length bytes
+    // that come before it, or as an 'L' block if prime_length is 0, or
+    // as a stored block if neither helps. The filters aren't applied
+    // here: both data and prime have to have been through them already,
+    // since the decoder primes with the data it has before it undoes
+    // them. The next call to write() starts a new dictionary.
+    //
+    template<char FLAVOUR, class OUTPUT>
+    void write_primed( OUTPUT &output, const char *prime_data, size_t prime_length, const char *data, size_t length )
+    {
+        m_history = 0;
+        m_chain_bytes = 0;
+        if ( length >= ENTROPY_SAMPLE && sample_entropy( data, length, ENTROPY_SAMPLE ) > m_entropy_limit ) {
+            write_stored( output, data, length );
+            return;
+        }
+        if ( prime_length > MAX_PRIME_SIZE ) {
+            prime_data += prime_length - MAX_PRIME_SIZE;
+            prime_length = MAX_PRIME_SIZE;
+        }
+        if ( prime_length )
+            prime<FLAVOUR>( m_compressor, prime_data, prime_length, m_packed );
+        pack<FLAVOUR>( data, length, prime_length != 0 );
+        if ( m_packed.size() >= length ) {
+            write_stored( output, data, length );
+            return;
+        }
+        output.put( char( prime_length ? PRIMED_BLOCK : LZW_BLOCK ) );
+        if ( prime_length )
+            write_varint( output, prime_length );
+        write_varint( output, length );
+        write_varint( output, m_packed.size() );
+        output.write( m_packed.data(), m_packed.size() );
+        m_lzw_blocks++;
+    }
+    template<class OUTPUT>
+    void finish( OUTPUT &output )
+    {
+        output.put( char( END_BLOCK ) );
+    }
+    void set_filters( const filter_chain &filters ) { m_filters = filters; }
+    //
+    // Starts a new dictionary at least every limit bytes of input,
+    // instead of every history_limit(). A new dictionary can only start
+    // with a new block, so a limit smaller than the block size just
+    // means every block starts one.
+    //
+    void set_history_limit( size_t limit ) { m_history_limit = limit; }
+    size_t stored_blocks() const { return m_stored_blocks; }
+    //
+    // The number of bytes of output written since the writer last
+    // started a new dictionary, which is 0 if the next block will start
+    // one. These are the blocks restore() needs.
+    //
+    unsigned long long chain_bytes() const { return m_chain_bytes; }
+    template<char FLAVOUR>
+    bool restore( const std::string &chain );
+    size_t lzw_blocks() const { return m_lzw_blocks; }
+    //
+    // How much input one dictionary is used for before the writer
+    // starts a new one.
+    //
+    static size_t history_limit( size_t block_size, unsigned int max_code )
+    {
+        const unsigned long long span = (max_code + 1ull) * HISTORY_PER_CODE;
+        return span > block_size ? (size_t) span : block_size;
+    }
+private :
+    template<char FLAVOUR, class OUTPUT>
+    void write_block( OUTPUT &output, const char *data, size_t length )
+    {
+        if ( !m_filters.empty() ) {
+            m_filtered.assign( data, length );
+            if ( length )
+                m_filters.encode( &m_filtered[ 0 ], length );
+            data = m_filtered.data();
+        }
+        if ( length >= ENTROPY_SAMPLE && sample_entropy( data, length, ENTROPY_SAMPLE ) > m_entropy_limit ) {
+            write_stored( output, data, length );
+            return;
+        }
+        const bool resume = m_history && m_history + length <= m_history_limit;
+        pack<FLAVOUR>( data, length, resume );
+        if ( m_packed.size() >= length ) {
+            write_stored( output, data, length );
+            return;
+        }
+        output.put( char( resume ? CONTINUE_BLOCK : LZW_BLOCK ) );
+        write_varint( output, length );
+        write_varint( output, m_packed.size() );
+        output.write( m_packed.data(), m_packed.size() );
+        const size_t bytes = 1 + varint_length( length ) + varint_length( m_packed.size() ) + m_packed.size();
+        m_history = resume ? m_history + length : length;
+        m_chain_bytes = resume ? m_chain_bytes + bytes : bytes;
+        m_lzw_blocks++;
+    }
+    template<char FLAVOUR>
+    void pack( const char *data, size_t length, bool resume )
+    {
+        m_packed.clear();
+        memory_input in( data, length );
+        memory_output out( m_packed );
+        flavoured<memory_input,FLAVOUR> flavoured_in( in );
+        flavoured<memory_output,FLAVOUR> flavoured_out( out );
+        if ( resume )
+            m_compressor.resume( flavoured_in, flavoured_out );
+        else
+            m_compressor.compress( flavoured_in, flavoured_out );
+    }
+    template<class OUTPUT>
+    void write_stored( OUTPUT &output, const char *data, size_t length )
+    {
+        output.put( char( STORED_BLOCK ) );
+        write_varint( output, length );
+        output.write( data, length );
+        m_history = 0;
+        m_chain_bytes = 0;
+        m_stored_blocks++;
+    }
+    basic_compressor<ENGINE> &m_compressor;
+    size_t m_block_size;
+    size_t m_history_limit;
+    double m_entropy_limit;
+    size_t m_history;
+    unsigned long long m_chain_bytes;
+    size_t m_stored_blocks;
+    size_t m_lzw_blocks;
+    std::string m_packed;
+    filter_chain m_filters;
+    std::string m_filtered;
+};
+
+typedef basic_block_writer<code_hash> block_writer;
+
+//
+// block_parser reads one block at a time, checks that it is well
+// formed, and hands back its type and contents without doing anything
+// with them: for a stored block, data() is the original data, and for an
+// LZW or continuation block, it is the code stream, and length() says how long the
+// data will be once it is decoded. Anything that needs to walk through
+// a block stream, like block_reader below, can be built on top of it.
+// INPUT needs read() and gcount() as well as get(), which std::istream
+// and the memory and file descriptor streams all provide.
+//
+class block_parser
+{
+public :
+    //
+    // The lengths in a block come from the input, so a damaged or
+    // hostile stream can claim a block of MAX_BLOCK_SIZE and then end.
+    // The data is read READ_CHUNK bytes at a time, so the buffer only
+    // grows as fast as the data actually arrives.
+    //
+    enum {
+        MAX_BLOCK_SIZE = 1 << 30,
+        READ_CHUNK = 1 << 16
+    };
+    block_parser()
+        : m_type( END_BLOCK ),
+          m_length( 0 ),
+          m_prime_length( 0 ) {}
+    //
+    // Returns false if the input is damaged or ends before the end
+    // marker. After the end marker, type() is END_BLOCK.
+    //
+    template<class INPUT>
+    bool next( INPUT &input )
+    {
+        char type;
+        if ( !input.get( type ) )
+            return false;
+        m_type = type;
+        m_prime_length = 0;
+        unsigned long long length;
+        unsigned long long data_length;
+        unsigned long long prime_length;
+        switch ( type ) {
+        case END_BLOCK :
+            m_length = 0;
+            m_data.clear();
+            return true;
+        case STORED_BLOCK :
+            if ( !read_varint( input, length ) || length > MAX_BLOCK_SIZE )
+                return false;
+            data_length = length;
+            break;
+        case PRIMED_BLOCK :
+            if ( !read_varint( input, prime_length ) || !prime_length || prime_length > MAX_PRIME_SIZE )
+                return false;
+            m_prime_length = (size_t) prime_length;
+            // fall through - the rest is laid out just like 'L'
+        case LZW_BLOCK :
+        case CONTINUE_BLOCK :
+            if ( !read_varint( input, length ) ||
+                 !read_varint( input, data_length ) ||
+                 length > MAX_BLOCK_SIZE ||
+                 data_length > MAX_BLOCK_SIZE )
+                return false;
+            break;
+        default :
+            return false;
+        }
+        m_length = (size_t) length;
+        m_data.clear();
+        while ( m_data.size() < data_length ) {
+            const size_t have = m_data.size();
+            const size_t chunk = std::min<size_t>( (size_t) data_length - have, READ_CHUNK );
+            m_data.resize( have + chunk );
+            input.read( &m_data[ have ], chunk );
+            if ( (size_t) input.gcount() != chunk )
+                return false;
+        }
+        return true;
+    }
+    char type() const { return m_type; }
+    size_t length() const { return m_length; }
+    //
+    // For a 'P' block, how many bytes from the end of the previous
+    // block it is primed with, and 0 for anything else.
+    //
+    size_t prime_length() const { return m_prime_length; }
+    const std::string &data() const { return m_data; }
+private :
+    char m_type;
+    size_t m_length;
+    size_t m_prime_length;
+    std::string m_data;
+};
+
+//
+// block_reader reads blocks until it sees the end marker, writing the
+// decoded data to OUTPUT, which needs write() as well as put(). read()
+// returns false if the data is damaged or ends before the end marker.
+// A program that wants to do something after each block, like flush
+// its output so a live stream is passed on promptly, can call
+// read_block() in a loop instead, until it returns false or end()
+// returns true.
+//
+// The reader keeps the last MAX_PRIME_SIZE bytes of each block, before
+// the filters are undone, in case the next one is a 'P' block, and
+// when one comes, it makes a compressor to prime the decompressor's
+// dictionary with them. That compressor never sees more than
+// MAX_PRIME_SIZE bytes at a time, so primer_bytes_for() can bound its
+// dictionary well below what max_code alone would allow. A stream
+// whose header doesn't have HAS_PRIMED can't have any 'P' blocks, and
+// set_primed( false ) tells the reader so: it treats a 'P' block as
+// damage, and doesn't bother keeping the tails.
+//
+class block_reader
+{
+public :
+    block_reader( decompressor &d )
+        : m_decompressor( d ),
+          m_primed_blocks( true ) {}
+    static size_t primer_bytes_for( unsigned int max_code, const base_dictionary &base = base_dictionary::roots() )
+    {
+        const unsigned long long limit = (unsigned long long) base.next_code() + MAX_PRIME_SIZE;
+        return compressor::peak_bytes_for( limit < max_code ? (unsigned int) limit : max_code, base );
+    }
+    template<char FLAVOUR, class INPUT, class OUTPUT>
+    bool read( INPUT &input, OUTPUT &output )
+    {
+        while ( read_block<FLAVOUR>( input, output ) )
+            if ( end() )
+                return true;
+        return false;
+    }
+    template<char FLAVOUR, class INPUT, class OUTPUT>
+    bool read_block( INPUT &input, OUTPUT &output )
+    {
+        if ( !m_parser.next( input ) )
+            return false;
+        switch ( m_parser.type() ) {
+        case STORED_BLOCK :
+            keep_tail( m_parser.data() );
+            if ( m_filters.empty() )
+                output.write( m_parser.data().data(), m_parser.data().size() );
+            else {
+                m_data = m_parser.data();
+                write_filtered( output );
+            }
+            break;
+        case PRIMED_BLOCK :
+            if ( !m_primed_blocks || !prime_decompressor<FLAVOUR>() )
+                return false;
+            return decode<FLAVOUR>( output, true );
+        case LZW_BLOCK :
+        case CONTINUE_BLOCK :
+            return decode<FLAVOUR>( output, m_parser.type() == CONTINUE_BLOCK );
+        }
+        return true;
+    }
+    bool end() const { return m_parser.type() == END_BLOCK; }
+    void set_filters( const filter_chain &filters ) { m_filters = filters; }
+    void set_primed( bool primed ) { m_primed_blocks = primed; }
+private :
+    template<class OUTPUT>
+    void write_filtered( OUTPUT &output )
+    {
+        if ( m_data.size() )
+            m_filters.decode( &m_data[ 0 ], m_data.size() );
+        output.write( m_data.data(), m_data.size() );
+    }
+    void keep_tail( const std::string &data )
+    {
+        if ( !m_primed_blocks )
+            return;
+        const size_t length = data.size() < MAX_PRIME_SIZE ? data.size() : MAX_PRIME_SIZE;
+        m_tail.assign( data, data.size() - length, length );
+    }
+    template<char FLAVOUR>
+    bool prime_decompressor()
+    {
+        const size_t length = m_parser.prime_length();
+        if ( length > m_tail.size() )
+            return false;
+        if ( !m_primer.get() )
+            m_primer.reset( new compressor( m_decompressor.max_code(), m_decompressor.base() ) );
+        prime<FLAVOUR>( *m_primer, m_tail.data() + m_tail.size() - length, length, m_codes );
+        m_primed.clear();
+        memory_input in( m_codes );
+        memory_output out( m_primed );
+        flavoured<memory_input,FLAVOUR> flavoured_in( in );
+        flavoured<memory_output,FLAVOUR> flavoured_out( out );
+        m_decompressor.decompress( flavoured_in, flavoured_out );
+        return true;
+    }
+    template<char FLAVOUR, class OUTPUT>
+    bool decode( OUTPUT &output, bool resume )
+    {
+        const size_t length = m_parser.length();
+        m_data.resize( length );
+        buffer_output out( length ? &m_data[ 0 ] : 0, length );
+        try {
+            memory_input in( m_parser.data() );
+            flavoured<memory_input,FLAVOUR> flavoured_in( in );
+            flavoured<buffer_output,FLAVOUR> flavoured_out( out );
+            if ( resume )
+                m_decompressor.resume( flavoured_in, flavoured_out );
+            else
+                m_decompressor.decompress( flavoured_in, flavoured_out );
+        } catch ( buffer_overflow & ) {
+            return false;
+        }
+        if ( out.tellp() != length )
+            return false;
+        keep_tail( m_data );
+        write_filtered( output );
+        return true;
+    }
+    decompressor &m_decompressor;
+    std::unique_ptr<compressor> m_primer;
+    bool m_primed_blocks;
+    block_parser m_parser;
+    std::string m_data;
+    std::string m_tail;
+    std::string m_codes;
+    std::string m_primed;
+    filter_chain m_filters;
+};
+
+//
+// restore() puts a writer back the way it was after writing chain,
+// which has to be the last chain_bytes() of its output, so that the
+// next block it writes is the same one it would have written then.
+// That lets a long compression job stop at a block boundary and carry
+// on later in a new process, with nothing saved but offsets: the code
+// streams all end on a byte boundary, so the only state that outlives
+// a block is the dictionary, and it can be rebuilt by decoding the
+// blocks in the chain and compressing them again. The new code streams
+// have to match the old ones exactly, so restore() returns false if
+// the blocks were written with other settings, and catches most kinds
+// of damage too, though not a change that still decodes cleanly. The
+// writer has to have been given the same filters, since the blocks
+// hold filtered data. Rebuilding costs at most one history_limit() of
+// data, however far into the job the chain is.
+//
+template<class ENGINE>
+template<char FLAVOUR>
+bool basic_block_writer<ENGINE>::restore( const std::string &chain )
+{
+    m_history = 0;
+    m_chain_bytes = 0;
+    decompressor d( m_compressor.max_code(), m_compressor.base() );
+    block_parser parser;
+    memory_input in( chain );
+    std::string data;
+    size_t history = 0;
+    while ( in.tellg() < chain.size() ) {
+        if ( !parser.next( in ) )
+            return false;
+        const bool resume = parser.type() == CONTINUE_BLOCK;
+        if ( (parser.type() != LZW_BLOCK && !resume) || resume != (history != 0) )
+            return false;
+        data.clear();
+        {
+            memory_input codes( parser.data() );
+            memory_output out( data );
+            flavoured<memory_input,FLAVOUR> flavoured_in( codes );
+            flavoured<memory_output,FLAVOUR> flavoured_out( out );
+            if ( resume )
+                d.resume( flavoured_in, flavoured_out );
+            else
+                d.decompress( flavoured_in, flavoured_out );
+        }
+        if ( data.size() != parser.length() )
+            return false;
+        m_packed.clear();
+        {
+            memory_input original( data );
+            memory_output out( m_packed );
+            flavoured<memory_input,FLAVOUR> flavoured_in( original );
+            flavoured<memory_output,FLAVOUR> flavoured_out( out );
+            if ( resume )
+                m_compressor.resume( flavoured_in, flavoured_out );
+            else
+                m_compressor.compress( flavoured_in, flavoured_out );
+        }
+        if ( m_packed != parser.data() )
+            return false;
+        history += data.size();
+    }
+    m_history = history;
+    m_chain_bytes = chain.size();
+    return true;
+}
+
+//
+// stream_writer is for data that arrives a piece at a time, and may
+// have to be sent on before there is a full block of it. write() saves
+// data up until it has a full block, and flush() writes whatever it has
+// right away, as one or more blocks the receiver can decode as soon as
+// they arrive, keeping the dictionary for the data that follows.
+// close(), which is also called by the destructor, flushes and writes
+// the end marker. Neither flush() nor close() flushes OUTPUT itself;
+// if it has a buffer of its own, that's up to the caller.
+//
+template<char FLAVOUR, class OUTPUT, class ENGINE = code_hash>
+class stream_writer
+{
+public :
+    stream_writer( OUTPUT &output,
+                   unsigned int max_code = 32767,
+                   size_t block_size = block_writer::DEFAULT_BLOCK_SIZE,
+                   const filter_chain &filters = filter_chain() )
+        : m_output( output ),
+          m_compressor( max_code ),
+          m_writer( m_compressor, block_size ),
+          m_block_size( block_size ? block_size : block_writer::DEFAULT_BLOCK_SIZE ),
+          m_closed( false )
+    {
+        stream_header header;
+        header.set_blocks();
+        header.set_max_code( max_code );
+        header.set_filters( filters.specs() );
+        header.set_flavour( FLAVOUR );
+        header.write( m_output );
+        m_writer.set_filters( filters );
+    }
+    ~stream_writer() { close(); }
+    void write( const char *data, size_t length )
+    {
+        m_pending.append( data, length );
+        if ( m_pending.size() >= m_block_size ) {
+            const size_t full = m_pending.size() - m_pending.size() % m_block_size;
+            m_writer.template write<FLAVOUR>( m_output, m_pending.data(), full );
+            m_pending.erase( 0, full );
+        }
+    }
+    void flush()
+    {
+        if ( m_pending.size() )
+            m_writer.template write<FLAVOUR>( m_output, m_pending.data(), m_pending.size() );
+        m_pending.clear();
+    }
+    void close()
+    {
+        if ( m_closed )
+            return;
+        flush();
+        m_writer.finish( m_output );
+        m_closed = true;
+    }
+    void set_lookahead( unsigned int lookahead ) { m_compressor.set_lookahead( lookahead ); }
+private :
+    stream_writer( const stream_writer & );
+    stream_writer &operator=( const stream_writer & );
+    OUTPUT &m_output;
+    basic_compressor<ENGINE> m_compressor;
+    basic_block_writer<ENGINE> m_writer;
+    size_t m_block_size;
+    std::string m_pending;
+    bool m_closed;
+};
+
+//
+// Writes the header and blocks for compress_blocks(). data holds the
+// first n bytes of the input, already read, and its size is the block
+// size.
+//
+template<char FLAVOUR, class ENGINE, class INPUT, class OUTPUT>
+void write_blocks( INPUT &input,
+                   OUTPUT &output,
+                   basic_compressor<ENGINE> &c,
+                   std::string &data,
+                   size_t n,
+                   const filter_chain &filters )
+{
+    stream_header header;
+    header.set_blocks();
+    header.set_max_code( c.max_code() );
+    header.set_filters( filters.specs() );
+    header.set_flavour( FLAVOUR );
+    header.write( output );
+    basic_block_writer<ENGINE> writer( c, data.size() );
+    writer.set_filters( filters );
+    while ( n ) {
+        writer.template write<FLAVOUR>( output, data.data(), n );
+        input.read( &data[ 0 ], data.size() );
+        n = (size_t) input.gcount();
+    }
+    writer.finish( output );
+}
+
+//
+// Compress everything from input, which can be any stream with read()
+// and gcount(), to output as a stream header followed by blocks. The
+// header records max_code, so the decoder doesn't have to be told what
+// it is. With one of the objectives from lzw_tune.h, max_code is picked
+// by trying the first block instead, after it has been through the
+// filters, which are recorded in the header too.
+// A lookahead other than 0 turns on flexible parsing, as described in
+// lzw.h, which the decoder doesn't need to be told about either.
+//
+template<char FLAVOUR, class ENGINE = code_hash, class INPUT, class OUTPUT>
+void compress_blocks( INPUT &input,
+                      OUTPUT &output,
+                      unsigned int max_code = 32767,
+                      size_t block_size = block_writer::DEFAULT_BLOCK_SIZE,
+                      const filter_chain &filters = filter_chain(),
+                      unsigned int lookahead = 0,
+                      tuning_objective objective = TUNE_NONE )
+{
+    if ( !block_size )
+        block_size = block_writer::DEFAULT_BLOCK_SIZE;
+    std::string data( block_size, 0 );
+    input.read( &data[ 0 ], block_size );
+    size_t n = (size_t) input.gcount();
+    if ( objective != TUNE_NONE ) {
+        std::string sample( data, 0, n );
+        if ( n )
+            filter_chain( filters ).encode( &sample[ 0 ], n );
+        max_code = choose_max_code<FLAVOUR>( sample.data(), n, objective );
+    }
+    basic_compressor<ENGINE> c( max_code );
+    c.set_lookahead( lookahead );
+    write_blocks<FLAVOUR>( input, output, c, data, n, filters );
+}
+
+//
+// The same, with a compressor the caller already has, such as one
+// leased from a context_pool, so a program that compresses one file
+// after another reuses the dictionary memory instead of growing it
+// again every time. The compressor's max_code goes in the header.
+//
+template<char FLAVOUR, class ENGINE, class INPUT, class OUTPUT>
+void compress_blocks( INPUT &input,
+                      OUTPUT &output,
+                      basic_compressor<ENGINE> &c,
+                      size_t block_size = block_writer::DEFAULT_BLOCK_SIZE,
+                      const filter_chain &filters = filter_chain() )
+{
+    if ( !block_size )
+        block_size = block_writer::DEFAULT_BLOCK_SIZE;
+    std::string data( block_size, 0 );
+    input.read( &data[ 0 ], block_size );
+    write_blocks<FLAVOUR>( input, output, c, data, (size_t) input.gcount(), filters );
+}
+
+//
+// Decompress the blocks that follow a header with HAS_BLOCKS set,
+// undoing the filters listed in the header, if any. primed should be
+// false if the header doesn't have HAS_PRIMED. The first version uses
+// a decompressor the caller already has.
+//
+template<char FLAVOUR, class INPUT, class OUTPUT>
+bool decompress_blocks( INPUT &input,
+                        OUTPUT &output,
+                        decompressor &d,
+                        const filter_chain &filters = filter_chain(),
+                        bool primed = true )
+{
+    block_reader reader( d );
+    reader.set_filters( filters );
+    reader.set_primed( primed );
+    return reader.read<FLAVOUR>( input, output );
+}
+
+template<char FLAVOUR, class INPUT, class OUTPUT>
+bool decompress_blocks( INPUT &input,
+                        OUTPUT &output,
+                        const unsigned int max_code = 32767,
+                        const filter_chain &filters = filter_chain(),
+                        bool primed = true )
+{
+    decompressor d( max_code );
+    return decompress_blocks<FLAVOUR>( input, output, d, filters, primed );
+}
+
+}; //namespace lzw
+
+#endif //#ifndef LZW_BLOCK_DOT_H
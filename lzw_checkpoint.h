@@ -0,0 +1,210 @@
+//
+// Copyright (c) 2011 Mark Nelson
+//
+// This software is licensed under the OSI MIT License, contained in
+// the file license.txt included with this project.
+//
+#ifndef LZW_CHECKPOINT_DOT_H
+#define LZW_CHECKPOINT_DOT_H
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include "lzw-fd.h"
+#include "lzw_header.h"
+#include "lzw_memory.h"
+#include "lzw_block.h"
+
+//
+// Compressing a file of a few terabytes takes hours, and if the job is
+// killed near the end, starting over throws all of that away. A
+// compress_checkpoint records how far a job has got, at a block
+// boundary, in a small side file, so that a new process can pick up
+// where the old one stopped. It holds:
+//
+//    the settings that decide what the output looks like: max_code,
+//    the code stream flavour, the dictionary engine, the block size,
+//    and the filters
+//
+//    how far into the input and the output the job had got, after the
+//    output up to that point was safely on disk
+//
+//    chain_bytes, the length of the blocks at the end of the output
+//    that were written with the current dictionary, from which
+//    basic_block_writer::restore() rebuilds it
+//
+//    the size and modification time of the input, so a checkpoint isn't
+//    used with a different file
+//
+// Nothing from the compressor itself needs saving. Every block ends its
+// code stream on a byte boundary, so there are never bits waiting to be
+// written, and the dictionary can be rebuilt from the blocks already in
+// the output. That keeps the side file to a few dozen bytes however big
+// the dictionary is, so it can be rewritten as often as we like.
+//
+// The file is:
+//
+//    bytes     the magic number, "LwZk"
+//    varint    the checkpoint format version, 2
+//    varint    max_code
+//    byte      the flavour, 'a' through 'd'
+//    byte      the engine, 'h' for code_hash or 't' for code_trie
+//    varint    block size
+//    varint    the number of filters, then a type and a parameter for
+//              each one, as in the stream header
+//    varint    interval, the input bytes between checkpoints
+//    varint    input offset
+//    varint    output offset
+//    varint    chain_bytes
+//    varint    input size
+//    varint    input modification time, in seconds
+//
+// save() writes a new copy and renames it over the old one, so a crash
+// while saving leaves the previous checkpoint in place.
+//
+
+namespace lzw {
+
+struct compress_checkpoint
+{
+    enum { VERSION = 2 };
+    enum { MAGIC_SIZE = 4 };
+    static const char *magic() { return "LwZk"; }
+    compress_checkpoint()
+        : max_code( 32767 ),
+          flavour( 'd' ),
+          engine( 'h' ),
+          block_size( block_writer::DEFAULT_BLOCK_SIZE ),
+          interval( 1ull << 30 ),
+          input_offset( 0 ),
+          output_offset( 0 ),
+          chain_bytes( 0 ),
+          input_size( 0 ),
+          input_time( 0 ) {}
+    unsigned int max_code;
+    char flavour;
+    char engine;
+    size_t block_size;
+    std::vector<filter_spec> filters;
+    unsigned long long interval;
+    unsigned long long input_offset;
+    unsigned long long output_offset;
+    unsigned long long chain_bytes;
+    unsigned long long input_size;
+    unsigned long long input_time;
+    template<class OUTPUT>
+    void write( OUTPUT &output ) const
+    {
+        for ( int i = 0 ; i < MAGIC_SIZE ; i++ )
+            output.put( magic()[ i ] );
+        write_varint( output, VERSION );
+        write_varint( output, max_code );
+        output.put( flavour );
+        output.put( engine );
+        write_varint( output, block_size );
+        write_varint( output, filters.size() );
+        for ( size_t i = 0 ; i < filters.size() ; i++ ) {
+            write_varint( output, filters[ i ].type );
+            write_varint( output, filters[ i ].parameter );
+        }
+        write_varint( output, interval );
+        write_varint( output, input_offset );
+        write_varint( output, output_offset );
+        write_varint( output, chain_bytes );
+        write_varint( output, input_size );
+        write_varint( output, input_time );
+    }
+    template<class INPUT>
+    bool read( INPUT &input )
+    {
+        char c;
+        for ( int i = 0 ; i < MAGIC_SIZE ; i++ )
+            if ( !input.get( c ) || c != magic()[ i ] )
+                return false;
+        unsigned long long version;
+        unsigned long long code;
+        unsigned long long size;
+        unsigned long long count;
+        if ( !read_varint( input, version ) || version != VERSION ||
+             !read_varint( input, code ) || code < 256 || code > LARGEST_MAX_CODE ||
+             !input.get( flavour ) || flavour < 'a' || flavour > 'd' ||
+             (flavour == 'b' && code > 0xffff) ||
+             !input.get( engine ) || (engine != 'h' && engine != 't') ||
+             !read_varint( input, size ) || !size || size > block_parser::MAX_BLOCK_SIZE ||
+             !read_varint( input, count ) || count > stream_header::MAX_FILTERS )
+            return false;
+        max_code = (unsigned int) code;
+        block_size = (size_t) size;
+        filters.resize( (size_t) count );
+        for ( size_t i = 0 ; i < filters.size() ; i++ ) {
+            unsigned long long type;
+            unsigned long long parameter;
+            if ( !read_varint( input, type ) || !read_varint( input, parameter ) ||
+                 type > 0xffffffffull || parameter > 0xffffffffull )
+                return false;
+            filters[ i ].type = (unsigned int) type;
+            filters[ i ].parameter = (unsigned int) parameter;
+        }
+        return read_varint( input, interval ) &&
+               read_varint( input, input_offset ) &&
+               read_varint( input, output_offset ) &&
+               read_varint( input, chain_bytes ) &&
+               read_varint( input, input_size ) &&
+               read_varint( input, input_time ) &&
+               chain_bytes <= output_offset;
+    }
+    //
+    // Returns false with errno set if the file can't be written. The
+    // new copy is synced before it replaces the old one.
+    //
+    bool save( const std::string &path ) const
+    {
+        std::string data;
+        memory_output out( data );
+        write( out );
+        const std::string temporary = path + ".new";
+        const int fd = open( temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666 );
+        if ( fd < 0 )
+            return false;
+        const bool written = fd_detail::write_all( fd, data.data(), data.size() ) && !fsync( fd );
+        if ( close( fd ) || !written ) {
+            const int error = errno;
+            unlink( temporary.c_str() );
+            errno = error;
+            return false;
+        }
+        return !rename( temporary.c_str(), path.c_str() );
+    }
+    //
+    // Returns false if the file can't be read, with errno set to ENOENT
+    // if it doesn't exist, or if it isn't a valid checkpoint, with errno
+    // set to EINVAL.
+    //
+    bool load( const std::string &path )
+    {
+        const int fd = open( path.c_str(), O_RDONLY );
+        if ( fd < 0 )
+            return false;
+        std::string data;
+        char buffer[ 256 ];
+        long n;
+        while ( (n = fd_detail::read_some( fd, buffer, sizeof( buffer ) )) > 0 && data.size() < 4096 )
+            data.append( buffer, n );
+        close( fd );
+        memory_input in( data );
+        if ( n < 0 )
+            return false;
+        if ( !read( in ) || in.tellg() != data.size() ) {
+            errno = EINVAL;
+            return false;
+        }
+        return true;
+    }
+};
+
+}; //namespace lzw
+
+#endif //#ifndef LZW_CHECKPOINT_DOT_H
@@ -0,0 +1,329 @@
+//
+// Copyright (c) 2011 Mark Nelson
+//
+// This software is licensed under the OSI MIT License, contained in
+// the file license.txt included with this project.
+//
+#ifndef LZW_CONCURRENT_DOT_H
+#define LZW_CONCURRENT_DOT_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include "lzw_streambase.h"
+#include "lzw_block.h"
+
+//
+// The compressor and the code streams are built for one caller with one
+// input, and a program with dozens of threads writing log records into
+// one compressed file would have to put a lock around stream_writer,
+// so that every thread that logs a line waits its turn to run the
+// dictionary. concurrent_writer keeps the dictionary work on a thread
+// of its own instead. Producers hand their records to mpsc_queue, which
+// takes a compare and swap and a copy, and the compressor thread takes
+// them off in batches and passes them on to a stream_writer.
+//
+// mpsc_queue is a bounded ring of slots, each with a sequence number
+// that says whose turn it is, after Dmitry Vyukov's bounded queue. A
+// producer claims the slot at the tail with a compare and swap on the
+// tail index, swaps its record in, and publishes it by bumping the
+// sequence. There is only one consumer, so taking a record out needs no
+// atomic read-modify-write at all. Records are std::strings, and the
+// consumer swaps its empty one into the slot in exchange, so buffers go
+// round and round instead of being allocated for every record.
+//
+// Memory is bounded twice over: by the number of slots, and by a limit
+// on the bytes waiting in the queue, so a burst of big records can't
+// use more than that either. A record bigger than the whole limit is
+// still let in when the queue is empty, so it can't wait forever. When
+// the queue is full, write() applies back-pressure: the producer waits
+// for the compressor to catch up, and is woken as soon as there is
+// room. try_write() returns false instead, for a producer that would
+// rather drop a record than wait. Producers never wait for anything
+// else, and never touch the dictionary.
+//
+// Neither side sleeps while there is work to do. The compressor thread
+// sleeps on a condition variable when the queue is empty, and a
+// producer only takes the mutex to wake it when it has said it is
+// sleeping. The flags and the queue are checked in opposite orders on
+// the two sides, with a full fence in between, so either the producer
+// sees the flag or the consumer sees the record. Producers waiting for
+// room work the same way.
+//
+// The records come out in the order they were queued, with each one
+// whole, and the output is an ordinary block stream that lzw -d reads.
+// When the queue runs dry, the compressor flushes the stream, at most
+// every flush_interval milliseconds, so that a reader following the
+// file sees records promptly without the blocks getting too small.
+// close() writes everything still queued, and the end marker, and
+// stops the thread. OUTPUT belongs to the compressor thread until then,
+// and needs flush(), as fd_output and std::ostream have.
+//
+
+namespace lzw {
+
+template<class T>
+class mpsc_queue
+{
+public :
+    mpsc_queue( size_t capacity )
+        : m_mask( round_up( capacity ) - 1 ),
+          m_slots( m_mask + 1 ),
+          m_tail( 0 ),
+          m_head( 0 )
+    {
+        for ( size_t i = 0 ; i < m_slots.size() ; i++ )
+            m_slots[ i ].sequence.store( i, std::memory_order_relaxed );
+    }
+    //
+    // Any number of threads can push at once. On success, value is
+    // swapped into the queue, and gets back whatever was in the slot.
+    // Returns false if the queue is full.
+    //
+    bool try_push( T &value )
+    {
+        size_t tail = m_tail.load( std::memory_order_relaxed );
+        for ( ; ; ) {
+            slot &s = m_slots[ tail & m_mask ];
+            const size_t sequence = s.sequence.load( std::memory_order_acquire );
+            const ptrdiff_t difference = (ptrdiff_t) (sequence - tail);
+            if ( difference == 0 ) {
+                if ( m_tail.compare_exchange_weak( tail, tail + 1, std::memory_order_relaxed ) ) {
+                    std::swap( s.value, value );
+                    s.sequence.store( tail + 1, std::memory_order_release );
+                    return true;
+                }
+            } else if ( difference < 0 )
+                return false;
+            else
+                tail = m_tail.load( std::memory_order_relaxed );
+        }
+    }
+    //
+    // Only one thread may pop. value is swapped with the record at the
+    // head. Returns false if the queue is empty.
+    //
+    bool try_pop( T &value )
+    {
+        slot &s = m_slots[ m_head & m_mask ];
+        if ( s.sequence.load( std::memory_order_acquire ) != m_head + 1 )
+            return false;
+        std::swap( s.value, value );
+        s.sequence.store( m_head + m_mask + 1, std::memory_order_release );
+        m_head++;
+        return true;
+    }
+    size_t capacity() const { return m_slots.size(); }
+private :
+    mpsc_queue( const mpsc_queue & );
+    mpsc_queue &operator=( const mpsc_queue & );
+    static size_t round_up( size_t capacity )
+    {
+        size_t size = 2;
+        while ( size < capacity )
+            size *= 2;
+        return size;
+    }
+    struct slot
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+    const size_t m_mask;
+    std::vector<slot> m_slots;
+    char m_pad1[ 64 ];
+    std::atomic<size_t> m_tail;
+    char m_pad2[ 64 ];
+    size_t m_head;
+};
+
+template<char FLAVOUR, class OUTPUT, class ENGINE = code_hash>
+class concurrent_writer
+{
+public :
+    enum {
+        DEFAULT_CAPACITY = 4096,
+        DEFAULT_MAX_BYTES = 16 << 20,
+        DEFAULT_FLUSH_INTERVAL = 100,
+        BATCH = 256
+    };
+    concurrent_writer( OUTPUT &output,
+                       unsigned int max_code = 32767,
+                       size_t capacity = DEFAULT_CAPACITY,
+                       size_t max_bytes = DEFAULT_MAX_BYTES,
+                       unsigned int flush_interval = DEFAULT_FLUSH_INTERVAL,
+                       const filter_chain &filters = filter_chain() )
+        : m_output( output ),
+          m_writer( output, max_code, block_writer::DEFAULT_BLOCK_SIZE, filters ),
+          m_queue( capacity ),
+          m_max_bytes( max_bytes ),
+          m_flush_interval( flush_interval ),
+          m_queued_bytes( 0 ),
+          m_consumer_sleeping( false ),
+          m_producers_waiting( 0 ),
+          m_closing( false ),
+          m_closed( false ),
+          m_records( 0 ),
+          m_waits( 0 ),
+          m_thread( &concurrent_writer::run, this ) {}
+    ~concurrent_writer() { close(); }
+    //
+    // Queues one record, waiting for room if the queue is full.
+    //
+    void write( const char *data, size_t length )
+    {
+        std::string record( data, length );
+        if ( push( record ) ) {
+            wake_consumer();
+            return;
+        }
+        m_waits++;
+        std::unique_lock<std::mutex> lock( m_mutex );
+        m_producers_waiting++;
+        std::atomic_thread_fence( std::memory_order_seq_cst );
+        while ( !push( record ) )
+            m_room.wait_for( lock, std::chrono::milliseconds( 10 ) );
+        m_producers_waiting--;
+        std::atomic_thread_fence( std::memory_order_seq_cst );
+        if ( m_consumer_sleeping.load( std::memory_order_relaxed ) )
+            m_work.notify_one();
+    }
+    //
+    // Queues one record if there is room, and returns false if there
+    // isn't.
+    //
+    bool try_write( const char *data, size_t length )
+    {
+        std::string record( data, length );
+        if ( !push( record ) )
+            return false;
+        wake_consumer();
+        return true;
+    }
+    //
+    // Every producer has to be finished before close() is called.
+    //
+    void close()
+    {
+        if ( m_closed )
+            return;
+        m_closed = true;
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_closing = true;
+            m_work.notify_one();
+        }
+        m_thread.join();
+    }
+    //
+    // The number of records the compressor thread has taken in.
+    //
+    unsigned long long records() const { return m_records; }
+    //
+    // How many times write() found the queue full and had to wait.
+    //
+    unsigned long long waits() const { return m_waits; }
+private :
+    concurrent_writer( const concurrent_writer & );
+    concurrent_writer &operator=( const concurrent_writer & );
+    bool push( std::string &record )
+    {
+        const size_t length = record.size();
+        const size_t queued = m_queued_bytes.fetch_add( length );
+        if ( (queued && queued + length > m_max_bytes) || !m_queue.try_push( record ) ) {
+            m_queued_bytes.fetch_sub( length );
+            return false;
+        }
+        return true;
+    }
+    void wake_consumer()
+    {
+        std::atomic_thread_fence( std::memory_order_seq_cst );
+        if ( m_consumer_sleeping.load( std::memory_order_relaxed ) ) {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_work.notify_one();
+        }
+    }
+    void run()
+    {
+        typedef std::chrono::steady_clock clock;
+        std::string record;
+        bool unflushed = false;
+        clock::time_point last_flush = clock::now();
+        const clock::duration interval = std::chrono::milliseconds( m_flush_interval );
+        for ( ; ; ) {
+            size_t n = 0;
+            size_t bytes = 0;
+            for ( ; n < BATCH && m_queue.try_pop( record ) ; n++ ) {
+                m_writer.write( record.data(), record.size() );
+                bytes += record.size();
+                record.clear();
+            }
+            if ( n ) {
+                m_queued_bytes.fetch_sub( bytes );
+                m_records.fetch_add( n, std::memory_order_relaxed );
+                unflushed = true;
+                std::atomic_thread_fence( std::memory_order_seq_cst );
+                if ( m_producers_waiting.load( std::memory_order_relaxed ) ) {
+                    std::lock_guard<std::mutex> lock( m_mutex );
+                    m_room.notify_all();
+                }
+                continue;
+            }
+            const clock::time_point now = clock::now();
+            if ( unflushed && now - last_flush >= interval ) {
+                m_writer.flush();
+                m_output.flush();
+                unflushed = false;
+                last_flush = now;
+            }
+            std::unique_lock<std::mutex> lock( m_mutex );
+            m_consumer_sleeping.store( true, std::memory_order_relaxed );
+            std::atomic_thread_fence( std::memory_order_seq_cst );
+            if ( m_queue.try_pop( record ) ) {
+                m_consumer_sleeping.store( false, std::memory_order_relaxed );
+                lock.unlock();
+                m_writer.write( record.data(), record.size() );
+                m_queued_bytes.fetch_sub( record.size() );
+                m_records.fetch_add( 1, std::memory_order_relaxed );
+                record.clear();
+                unflushed = true;
+                continue;
+            }
+            if ( m_closing )
+                break;
+            if ( unflushed )
+                m_work.wait_for( lock, interval - (now - last_flush) );
+            else
+                m_work.wait_for( lock, std::chrono::seconds( 1 ) );
+            m_consumer_sleeping.store( false, std::memory_order_relaxed );
+        }
+        m_writer.close();
+        m_output.flush();
+    }
+    OUTPUT &m_output;
+    stream_writer<FLAVOUR,OUTPUT,ENGINE> m_writer;
+    mpsc_queue<std::string> m_queue;
+    const size_t m_max_bytes;
+    const unsigned int m_flush_interval;
+    std::atomic<size_t> m_queued_bytes;
+    std::atomic<bool> m_consumer_sleeping;
+    std::atomic<unsigned int> m_producers_waiting;
+    bool m_closing;
+    bool m_closed;
+    std::atomic<unsigned long long> m_records;
+    std::atomic<unsigned long long> m_waits;
+    std::mutex m_mutex;
+    std::condition_variable m_work;
+    std::condition_variable m_room;
+    std::thread m_thread;
+};
+
+}; //namespace lzw
+
+#endif //#ifndef LZW_CONCURRENT_DOT_H
@@ -0,0 +1,363 @@
+//
+// Copyright (c) 2011 Mark Nelson
+//
+// This software is licensed under the OSI MIT License, contained in
+// the file license.txt included with this project.
+//
+#ifndef LZW_DAEMON_DOT_H
+#define LZW_DAEMON_DOT_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <cstdio>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "lzw_header.h"
+#include "lzw_memory.h"
+#include "lzw_tune.h"
+
+//
+// The protocol spoken by lzwd, the compression daemon, and its clients,
+// lzwc and lzwload. Running lzw once per file means paying for a new
+// process, and for growing a new dictionary from nothing, every time.
+// lzwd stays running, and its worker threads keep their dictionaries
+// from one request to the next, so all that is left is the work itself.
+//
+// Clients connect to a Unix domain socket, so the daemon can only be
+// reached from the same machine. The socket goes in a directory only
+// its owner can get into, $XDG_RUNTIME_DIR or else /tmp/lzwd-<uid>,
+// and lzwd creates it with mode 0600, but the permissions only hold if
+// lzwd was the one to create them. Anyone can bind a socket in a
+// directory they can write to, so both ends ask the kernel who is on
+// the other end with SO_PEERCRED: lzwd hangs up on anyone but its own
+// user and root, and a client won't send its data to a daemon run by
+// anyone else either. A connection can carry any number of requests,
+// one at a time: the client sends a request, waits for the response,
+// and can then send another.
+//
+// A request is:
+//
+//    byte      operation, COMPRESS_REQUEST or DECOMPRESS_REQUEST
+//    byte      flags, RAW_REQUEST to write a bare code stream with no
+//              header, as lzw -raw does, and FLAVOUR_REQUEST if the
+//              next byte is there
+//    byte      code stream flavour, 'a' through 'c', present if
+//              FLAVOUR_REQUEST is set, and 'd' if it isn't. For
+//              decompression, it only matters for a bare code stream,
+//              as with lzw -f -d.
+//    varint    max_code, or for compression, one of the objectives
+//              from lzw_tune.h, as given to lzw -max auto. These are
+//              all less than 256, the smallest real max_code, and come
+//              out of parse_request() in objective, not max_code. For
+//              decompression, max_code is only used for streams that
+//              don't record it.
+//    varint    the number of filters, then a type and a parameter for
+//              each one, as in the stream header
+//    varint    the length of the data
+//    bytes     the data
+//
+// And the response is:
+//
+//    byte      status, one of the daemon_status values
+//    varint    the length of the data
+//    bytes     the output, which is empty unless the status is OK
+//
+// The output of a compress request is exactly what lzw would write for
+// the same input and options, and a decompress request accepts anything
+// lzw -d does, so files can be moved freely between the two.
+//
+
+namespace lzw {
+
+enum daemon_operation {
+    COMPRESS_REQUEST = 'c',
+    DECOMPRESS_REQUEST = 'd'
+};
+
+enum {
+    RAW_REQUEST = 1,
+    FLAVOUR_REQUEST = 2
+};
+
+enum daemon_status {
+    DAEMON_OK,
+    DAEMON_BAD_DATA,
+    DAEMON_BAD_REQUEST,
+    DAEMON_NO_MEMORY
+};
+
+//
+// Requests bigger than this are refused, so that one client can't make
+// the daemon buffer an unlimited amount of data.
+//
+const unsigned long long MAX_REQUEST_DATA = 1ull << 30;
+const size_t MAX_REQUEST_HEADER = 256;
+
+//
+// Without $XDG_RUNTIME_DIR, which the login manager makes for each user
+// with mode 0700, the socket goes in a directory of our own in /tmp.
+//
+inline std::string daemon_private_directory()
+{
+    char name[ 32 ];
+    snprintf( name, sizeof( name ), "/tmp/lzwd-%u", (unsigned int) geteuid() );
+    return name;
+}
+
+//
+// The socket is found with -s, then the LZWD_SOCKET environment
+// variable, then in $XDG_RUNTIME_DIR, then in the private directory.
+//
+inline std::string daemon_socket_path( const char *given = 0 )
+{
+    if ( given )
+        return given;
+    const char *env = getenv( "LZWD_SOCKET" );
+    if ( env && *env )
+        return env;
+    const char *runtime = getenv( "XDG_RUNTIME_DIR" );
+    if ( runtime && *runtime == '/' )
+        return std::string( runtime ) + "/lzwd.sock";
+    return daemon_private_directory() + "/lzwd.sock";
+}
+
+//
+// lzwd calls this before it binds path. If path is in the private
+// directory, the directory is created if need be, and has to be a real
+// directory, not a link, that belongs to us and that nobody else can
+// get into. Returns false with errno set if it isn't.
+//
+inline bool prepare_daemon_directory( const std::string &path )
+{
+    const std::string directory = daemon_private_directory();
+    if ( path.compare( 0, directory.size() + 1, directory + "/" ) )
+        return true;
+    if ( mkdir( directory.c_str(), 0700 ) && errno != EEXIST )
+        return false;
+    struct stat status;
+    if ( lstat( directory.c_str(), &status ) )
+        return false;
+    if ( !S_ISDIR( status.st_mode ) || status.st_uid != geteuid() || (status.st_mode & 077) ) {
+        errno = EACCES;
+        return false;
+    }
+    return true;
+}
+
+//
+// True if the process on the other end of a connected socket belongs
+// to the same user as we do, or to root.
+//
+inline bool daemon_peer_trusted( int fd )
+{
+    ucred peer;
+    socklen_t length = sizeof( peer );
+    if ( getsockopt( fd, SOL_SOCKET, SO_PEERCRED, &peer, &length ) || length != sizeof( peer ) )
+        return false;
+    return peer.uid == geteuid() || peer.uid == 0;
+}
+
+inline bool daemon_address( const std::string &path, sockaddr_un &address )
+{
+    memset( &address, 0, sizeof( address ) );
+    address.sun_family = AF_UNIX;
+    if ( path.size() >= sizeof( address.sun_path ) )
+        return false;
+    memcpy( address.sun_path, path.data(), path.size() );
+    return true;
+}
+
+//
+// Returns a connected socket, or -1 with errno set. A daemon run by
+// another user is refused with EACCES.
+//
+inline int daemon_connect( const std::string &path )
+{
+    sockaddr_un address;
+    if ( !daemon_address( path, address ) ) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    const int fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if ( fd < 0 )
+        return -1;
+    if ( connect( fd, (sockaddr *) &address, sizeof( address ) ) ) {
+        const int error = errno;
+        close( fd );
+        errno = error;
+        return -1;
+    }
+    if ( !daemon_peer_trusted( fd ) ) {
+        close( fd );
+        errno = EACCES;
+        return -1;
+    }
+    return fd;
+}
+
+struct daemon_request
+{
+    daemon_request()
+        : operation( COMPRESS_REQUEST ),
+          flags( 0 ),
+          max_code( 32767 ),
+          objective( TUNE_NONE ),
+          flavour( 'd' ) {}
+    char operation;
+    //
+    // Only RAW_REQUEST: FLAVOUR_REQUEST is worked out from flavour.
+    //
+    unsigned int flags;
+    unsigned int max_code;
+    tuning_objective objective;
+    char flavour;
+    std::vector<filter_spec> filters;
+};
+
+//
+// Everything in a request up to the data itself. The client follows it
+// with the data, so a big file doesn't have to be copied to be sent.
+//
+template<class OUTPUT>
+void write_request_header( OUTPUT &output, const daemon_request &request, unsigned long long length )
+{
+    output.put( request.operation );
+    if ( request.flavour != 'd' ) {
+        output.put( char( request.flags | FLAVOUR_REQUEST ) );
+        output.put( request.flavour );
+    } else
+        output.put( char( request.flags ) );
+    if ( request.objective != TUNE_NONE )
+        write_varint( output, (unsigned int) request.objective );
+    else
+        write_varint( output, request.max_code );
+    write_varint( output, request.filters.size() );
+    for ( size_t i = 0 ; i < request.filters.size() ; i++ ) {
+        write_varint( output, request.filters[ i ].type );
+        write_varint( output, request.filters[ i ].parameter );
+    }
+    write_varint( output, length );
+}
+
+enum parse_result {
+    PARSE_MORE,
+    PARSE_DONE,
+    PARSE_BAD
+};
+
+//
+// The daemon reads requests from non-blocking sockets, so they arrive a
+// piece at a time. parse_request() looks at what has come in so far,
+// and says whether there is a complete request at the start of it. If
+// there is, it fills in the request, and sets data and length to the
+// data inside the buffer, and used to the size of the whole request.
+// used is set as soon as everything before the data has arrived, so
+// the caller knows how much more to wait for. Everything before the
+// data fits in MAX_REQUEST_HEADER bytes, so if that much has arrived
+// and it still can't be parsed, the request is bad.
+//
+inline parse_result parse_request( const char *buffer,
+                                   size_t size,
+                                   daemon_request &request,
+                                   size_t &data,
+                                   size_t &length,
+                                   size_t &used )
+{
+    const parse_result incomplete = size < MAX_REQUEST_HEADER ? PARSE_MORE : PARSE_BAD;
+    memory_input input( buffer, size );
+    char operation;
+    char flags;
+    char flavour = 'd';
+    unsigned long long max_code;
+    unsigned long long count;
+    if ( !input.get( operation ) || !input.get( flags ) ||
+         ((flags & FLAVOUR_REQUEST) && !input.get( flavour )) || !read_varint( input, max_code ) )
+        return incomplete;
+    if ( (operation != COMPRESS_REQUEST && operation != DECOMPRESS_REQUEST) ||
+         (flags & ~(RAW_REQUEST | FLAVOUR_REQUEST)) || flavour < 'a' || flavour > 'd' ||
+         max_code > LARGEST_MAX_CODE )
+        return PARSE_BAD;
+    if ( !read_varint( input, count ) )
+        return incomplete;
+    if ( count > stream_header::MAX_FILTERS )
+        return PARSE_BAD;
+    request.filters.resize( (size_t) count );
+    for ( size_t i = 0 ; i < request.filters.size() ; i++ ) {
+        unsigned long long type;
+        unsigned long long parameter;
+        if ( !read_varint( input, type ) || !read_varint( input, parameter ) )
+            return incomplete;
+        if ( type > 0xffffffffull || parameter > 0xffffffffull )
+            return PARSE_BAD;
+        request.filters[ i ].type = (unsigned int) type;
+        request.filters[ i ].parameter = (unsigned int) parameter;
+    }
+    unsigned long long data_length;
+    if ( !read_varint( input, data_length ) )
+        return incomplete;
+    if ( data_length > MAX_REQUEST_DATA )
+        return PARSE_BAD;
+    request.operation = operation;
+    request.flags = (unsigned char) flags & RAW_REQUEST;
+    request.flavour = flavour;
+    if ( max_code >= TUNE_SPEED && max_code <= TUNE_RATIO ) {
+        request.objective = tuning_objective( max_code );
+        request.max_code = daemon_request().max_code;
+    } else {
+        request.objective = TUNE_NONE;
+        request.max_code = (unsigned int) max_code;
+    }
+    data = input.tellg();
+    length = (size_t) data_length;
+    used = data + length;
+    return used <= size ? PARSE_DONE : PARSE_MORE;
+}
+
+template<class OUTPUT>
+void write_response_header( OUTPUT &output, daemon_status status, unsigned long long length )
+{
+    output.put( char( status ) );
+    write_varint( output, length );
+}
+
+//
+// Reads a response from a blocking stream, such as fd_input on the
+// client's socket. Returns false if the connection fails or the
+// response is malformed.
+//
+template<class INPUT>
+bool read_response( INPUT &input, daemon_status &status, std::string &data )
+{
+    char c;
+    unsigned long long length;
+    if ( !input.get( c ) || (unsigned char) c > DAEMON_NO_MEMORY ||
+         !read_varint( input, length ) || length > ~size_t( 0 ) )
+        return false;
+    status = daemon_status( (unsigned char) c );
+    data.resize( (size_t) length );
+    if ( !length )
+        return true;
+    input.read( &data[ 0 ], (size_t) length );
+    return (unsigned long long) input.gcount() == length;
+}
+
+inline const char *daemon_status_string( daemon_status status )
+{
+    switch ( status ) {
+    case DAEMON_OK : return "ok";
+    case DAEMON_BAD_DATA : return "damaged or unsupported compressed data";
+    case DAEMON_BAD_REQUEST : return "bad request";
+    case DAEMON_NO_MEMORY : return "out of memory";
+    }
+    return "unknown status";
+}
+
+}; //namespace lzw
+
+#endif //#ifndef LZW_DAEMON_DOT_H
@@ -0,0 +1,652 @@
+//
+// Copyright (c) 2011 Mark Nelson
+//
+// This software is licensed under the OSI MIT License, contained in
+// the file license.txt included with this project.
+//
+#ifndef LZW_DICTIONARY_DOT_H
+#define LZW_DICTIONARY_DOT_H
+
+#include <string>
+#include <vector>
+#include "lzw_pages.h"
+
+//
+// The original version of compress() kept its dictionary in an
+// unordered_map keyed by std::string, sized up front for max_code
+// entries, and loaded with the 256 single character strings before
+// the first symbol was read. That's easy to follow, but it means every
+// stream pays for a table sized for the worst case, plus a heap
+// allocated string for every entry.
+//
+// The classes here split the dictionary in two layers:
+//
+// base_dictionary holds the entries every stream starts with. At a
+// minimum that is the 256 roots, which don't need to be stored at all,
+// since the code for a single symbol is just its value. Optionally, the
+// base can be primed from a sample of typical data, in which case it
+// also holds the strings LZW would have added while compressing that
+// sample. A base_dictionary never changes after it is constructed, so
+// one instance can be shared by any number of streams, in any number of
+// threads, with no locking. base_dictionary::roots() returns a shared
+// instance holding just the roots, which is what compress() and
+// decompress() use by default.
+//
+// layered_dictionary and layered_strings are the per-stream overlays
+// used by the compressor and decompressor respectively. They hold only
+// the codes added by this stream, and they start out small and grow as
+// entries are added, so a short message costs a few kilobytes instead
+// of a table sized for max_code.
+//
+// Instead of storing complete strings, each entry is stored as the
+// code of its prefix plus one symbol. Every string in an LZW dictionary
+// is some shorter string in the dictionary plus one more symbol, so the
+// pair identifies the string exactly, and the compressor never needs
+// anything more than that to look up the next match.
+//
+// The compressor's overlay has to answer one question over and over:
+// what is the code for this prefix plus this symbol? How best to lay
+// that out in memory depends on max_code and on the data, so the
+// overlay is a template parameter, and three engines are provided:
+//
+//    code_hash     an open addressed hash table keyed on the pair. One
+//                  probe in the common case, and memory proportional to
+//                  the number of codes. This is the default.
+//    code_trie     a node per code, with each node's children kept in
+//                  a list sorted by symbol. Compact and predictable,
+//                  but a lookup may walk a long list of siblings near
+//                  the root.
+//    code_hybrid   a dense 256 entry row of children for each of the
+//                  lowest codes, which are the roots every match starts
+//                  from and so the hottest nodes in the dictionary,
+//                  with a code_hash for everything else. A root lookup
+//                  is a single array index, at the cost of a table that
+//                  is 256KB before the first entry is added.
+//
+// Each engine has find(), insert(), reset(), which must be O(1) so the
+// contexts can be reused cheaply, empty(), and bytes(), which reports
+// the memory it holds. The --perf mode of the lzw program runs all three
+// so they can be compared on real data.
+//
+// Each engine also keeps track of peak_bytes(), the most memory it has
+// ever held at once. That includes the moment when a table grows, and
+// the old and new arrays are both allocated, which is where the peak
+// always occurs. Since the engines grow by their own rules instead of
+// leaving it to std::vector, the worst case for a given range of codes
+// can be worked out in advance, and the static peak_bytes_for() does
+// just that. A program with a fixed memory budget can use it to find
+// the largest max_code that is sure to fit, which is what
+// max_code_for_budget() in lzw.h does. Per code, at the worst case, the
+// trie needs about 24 bytes, the hash table about 48 to 96 depending on
+// where max_code falls between powers of two, and the hybrid 256KB more
+// than the hash table. The decompressor's strings need 12 bytes per
+// code.
+//
+// The tables come from table_allocator in lzw_pages.h, which backs the
+// big ones with huge pages and rounds them up to whole pages, and the
+// rounding is counted in all of these figures.
+//
+// A stream compressed with a primed base can only be decompressed with
+// a base built from the same sample and max_code, and the code streams
+// have to be told where the dictionary starts, which is what the
+// preset() member of the code stream classes is for.
+//
+
+namespace lzw {
+
+const unsigned int FIRST_CODE = 257;
+const unsigned int NO_CODE = ~0u;
+
+//
+// The entry stored for each code, giving its prefix, the symbol that
+// ends it, and its length, which lets the decompressor write a string
+// from back to front without measuring it first.
+//
+struct dictionary_entry
+{
+    unsigned int prefix;
+    unsigned int length;
+    unsigned char symbol;
+};
+
+//
+// An open addressed hash table mapping (prefix,symbol) pairs to codes,
+// using linear probing. The table doubles in size whenever it gets
+// half full, so it only grows as big as the stream needs.
+//
+// Every slot is stamped with the generation it was written in, and
+// only slots from the current generation count as occupied. That makes
+// reset() O(1): it just starts a new generation, and all the old
+// entries vanish without the table being touched. The memory stays
+// allocated, so a table that is reset and reused for message after
+// message stops allocating once it has grown to fit the largest one.
+//
+class code_hash
+{
+public :
+    code_hash( size_t initial_size = 256 )
+        : m_count( 0 ),
+          m_generation( 1 )
+    {
+        const size_t size = initial_slots( initial_size );
+        m_slots.assign( size, empty_slot() );
+        m_mask = size - 1;
+        m_peak = bytes();
+    }
+    unsigned int find( unsigned int prefix, unsigned int symbol ) const
+    {
+        const unsigned long long key = make_key( prefix, symbol );
+        for ( size_t i = hash( key ) ; ; i = (i + 1) & m_mask ) {
+            const slot &s = m_slots[ i ];
+            if ( s.generation != m_generation )
+                return NO_CODE;
+            if ( s.key == key )
+                return s.code;
+        }
+    }
+    void insert( unsigned int prefix, unsigned int symbol, unsigned int code )
+    {
+        if ( (m_count + 1) * 2 > m_slots.size() )
+            grow();
+        place( make_key( prefix, symbol ), code );
+        m_count++;
+    }
+    void reset()
+    {
+        m_count = 0;
+        if ( ++m_generation == 0 ) {
+            m_slots.assign( m_slots.size(), empty_slot() );
+            m_generation = 1;
+        }
+    }
+    bool empty() const { return m_count == 0; }
+    size_t bytes() const { return table_footprint( m_slots.capacity() * sizeof( slot ) ); }
+    size_t peak_bytes() const { return m_peak; }
+    //
+    // The table doubles when an insert would make it more than half
+    // full, and while it is being rebuilt the old table, half the size
+    // of the new one, is still allocated.
+    //
+    static size_t peak_bytes_for( unsigned int first_code, unsigned int max_code, size_t initial_size = 256 )
+    {
+        const size_t entries = max_code >= first_code ? size_t( max_code ) - first_code + 1 : 0;
+        size_t size = initial_slots( initial_size );
+        size_t peak = table_footprint( size * sizeof( slot ) );
+        while ( entries * 2 > size ) {
+            peak = table_footprint( size * sizeof( slot ) ) + table_footprint( 2 * size * sizeof( slot ) );
+            size *= 2;
+        }
+        return peak;
+    }
+private :
+    struct slot
+    {
+        unsigned long long key;
+        unsigned int code;
+        unsigned int generation;
+    };
+    static size_t initial_slots( size_t initial_size )
+    {
+        size_t size = 16;
+        while ( size < initial_size )
+            size *= 2;
+        return size;
+    }
+    static slot empty_slot()
+    {
+        slot s = { 0, NO_CODE, 0 };
+        return s;
+    }
+    static unsigned long long make_key( unsigned int prefix, unsigned int symbol )
+    {
+        return ((unsigned long long) prefix << 32) | symbol;
+    }
+    size_t hash( unsigned long long key ) const
+    {
+        return (size_t) ((key * 0x9e3779b97f4a7c15ull) >> 32) & m_mask;
+    }
+    void place( unsigned long long key, unsigned int code )
+    {
+        size_t i = hash( key );
+        while ( m_slots[ i ].generation == m_generation )
+            i = (i + 1) & m_mask;
+        m_slots[ i ].key = key;
+        m_slots[ i ].code = code;
+        m_slots[ i ].generation = m_generation;
+    }
+    void grow()
+    {
+        slot_table old( m_slots.size() * 2, empty_slot() );
+        old.swap( m_slots );
+        m_mask = m_slots.size() - 1;
+        const size_t during = table_footprint( old.capacity() * sizeof( slot ) ) + bytes();
+        if ( during > m_peak )
+            m_peak = during;
+        const unsigned int generation = m_generation;
+        m_generation = 1;
+        for ( size_t i = 0 ; i < old.size() ; i++ )
+            if ( old[ i ].generation == generation )
+                place( old[ i ].key, old[ i ].code );
+    }
+    typedef std::vector< slot, table_allocator<slot> > slot_table;
+    slot_table m_slots;
+    size_t m_mask;
+    size_t m_count;
+    size_t m_peak;
+    unsigned int m_generation;
+};
+
+//
+// The trie keeps a node for every code that has children or is a
+// child, indexed by code, so the node array is never much bigger than
+// next_code. Since the children of a node are linked in order of their
+// symbols, a search can stop as soon as it passes the one it wants.
+// Generation stamps make reset() O(1), just like code_hash: a node only
+// has children if its first_child was written in this generation.
+// The node array at least doubles each time it grows, and it is grown
+// with reserve() so that its capacity is exactly what was asked for.
+//
+class code_trie
+{
+public :
+    code_trie()
+        : m_count( 0 ),
+          m_peak( 0 ),
+          m_generation( 1 ) {}
+    unsigned int find( unsigned int prefix, unsigned int symbol ) const
+    {
+        if ( prefix >= m_nodes.size() || m_nodes[ prefix ].generation != m_generation )
+            return NO_CODE;
+        unsigned int code = m_nodes[ prefix ].first_child;
+        while ( code != NO_CODE && m_nodes[ code ].symbol < symbol )
+            code = m_nodes[ code ].next_sibling;
+        if ( code != NO_CODE && m_nodes[ code ].symbol == symbol )
+            return code;
+        return NO_CODE;
+    }
+    void insert( unsigned int prefix, unsigned int symbol, unsigned int code )
+    {
+        const size_t needed = (prefix > code ? prefix : code) + 1;
+        if ( needed > m_nodes.size() )
+            grow( needed );
+        node &parent = m_nodes[ prefix ];
+        if ( parent.generation != m_generation ) {
+            parent.first_child = NO_CODE;
+            parent.generation = m_generation;
+        }
+        node &child = m_nodes[ code ];
+        child.first_child = NO_CODE;
+        child.generation = m_generation;
+        child.symbol = (unsigned char) symbol;
+        unsigned int *link = &parent.first_child;
+        while ( *link != NO_CODE && m_nodes[ *link ].symbol < symbol )
+            link = &m_nodes[ *link ].next_sibling;
+        child.next_sibling = *link;
+        *link = code;
+        m_count++;
+    }
+    void reset()
+    {
+        m_count = 0;
+        if ( ++m_generation == 0 ) {
+            m_nodes.assign( m_nodes.size(), empty_node() );
+            m_generation = 1;
+        }
+    }
+    bool empty() const { return m_count == 0; }
+    size_t bytes() const { return table_footprint( m_nodes.capacity() * sizeof( node ) ); }
+    size_t peak_bytes() const { return m_peak; }
+    //
+    // Codes are added in order, and a prefix is always a lower code
+    // than the entry that extends it, so the array grows the first time
+    // each new code doesn't fit, and the sizes it passes through are
+    // always the same.
+    //
+    static size_t peak_bytes_for( unsigned int first_code, unsigned int max_code )
+    {
+        size_t size = 0;
+        size_t peak = 0;
+        for ( size_t needed = size_t( first_code ) + 1 ; needed <= size_t( max_code ) + 1 ; needed = size + 1 ) {
+            const size_t grown = grown_size( size, needed );
+            const size_t during = table_footprint( size * sizeof( node ) ) + table_footprint( grown * sizeof( node ) );
+            if ( during > peak )
+                peak = during;
+            size = grown;
+        }
+        return peak;
+    }
+private :
+    struct node
+    {
+        unsigned int first_child;
+        unsigned int next_sibling;
+        unsigned int generation;
+        unsigned char symbol;
+    };
+    static node empty_node()
+    {
+        node n = { NO_CODE, NO_CODE, 0, 0 };
+        return n;
+    }
+    static size_t grown_size( size_t size, size_t needed )
+    {
+        return needed < 2 * size ? 2 * size : needed;
+    }
+    void grow( size_t needed )
+    {
+        const size_t size = grown_size( m_nodes.size(), needed );
+        if ( size > m_nodes.capacity() ) {
+            const size_t during = bytes() + table_footprint( size * sizeof( node ) );
+            if ( during > m_peak )
+                m_peak = during;
+            m_nodes.reserve( size );
+        }
+        m_nodes.resize( size, empty_node() );
+    }
+    std::vector< node, table_allocator<node> > m_nodes;
+    size_t m_count;
+    size_t m_peak;
+    unsigned int m_generation;
+};
+
+//
+// Each cell of the dense rows holds a code in its low 24 bits and the
+// generation it was written in in the high 8 bits, so a row lookup is
+// one load and one compare, and reset() only has to clear the rows once
+// every 255 generations. Codes that don't fit in 24 bits, which any
+// flavour can produce with a max_code above 2^24-1, go in the hash
+// table along with everything else.
+//
+template<unsigned int DENSE_CODES = 256>
+class code_hybrid
+{
+public :
+    code_hybrid()
+        : m_count( 0 ),
+          m_generation( 1 ),
+          m_wide_codes( false ) {}
+    unsigned int find( unsigned int prefix, unsigned int symbol ) const
+    {
+        if ( prefix < DENSE_CODES && !m_wide_codes ) {
+            if ( m_rows.empty() )
+                return NO_CODE;
+            const unsigned int cell = m_rows[ prefix * 256 + symbol ];
+            return (cell >> 24) == m_generation ? cell & 0xffffff : NO_CODE;
+        }
+        if ( prefix < DENSE_CODES && !m_rows.empty() ) {
+            const unsigned int cell = m_rows[ prefix * 256 + symbol ];
+            if ( (cell >> 24) == m_generation )
+                return cell & 0xffffff;
+        }
+        if ( m_hash.empty() )
+            return NO_CODE;
+        return m_hash.find( prefix, symbol );
+    }
+    void insert( unsigned int prefix, unsigned int symbol, unsigned int code )
+    {
+        if ( prefix < DENSE_CODES && code < (1u << 24) ) {
+            if ( m_rows.empty() )
+                m_rows.assign( DENSE_CODES * 256, 0 );
+            m_rows[ prefix * 256 + symbol ] = (m_generation << 24) | code;
+        } else {
+            m_wide_codes = m_wide_codes || prefix < DENSE_CODES;
+            m_hash.insert( prefix, symbol, code );
+        }
+        m_count++;
+    }
+    void reset()
+    {
+        m_count = 0;
+        m_wide_codes = false;
+        m_hash.reset();
+        if ( ++m_generation == 256 ) {
+            m_rows.assign( m_rows.size(), 0 );
+            m_generation = 1;
+        }
+    }
+    bool empty() const { return m_count == 0; }
+    size_t bytes() const { return m_rows.capacity() * sizeof( unsigned int ) + m_hash.bytes(); }
+    //
+    // The rows are allocated once and never grow, so the peak is just
+    // the rows plus the peak of the hash table. Working out in advance
+    // how many codes will land in the rows would mean knowing the data,
+    // so the worst case assumes the hash table gets all of them.
+    //
+    size_t peak_bytes() const { return m_rows.capacity() * sizeof( unsigned int ) + m_hash.peak_bytes(); }
+    static size_t peak_bytes_for( unsigned int first_code, unsigned int max_code )
+    {
+        const size_t rows = max_code >= first_code ? size_t( DENSE_CODES ) * 256 * sizeof( unsigned int ) : 0;
+        return rows + code_hash::peak_bytes_for( first_code, max_code );
+    }
+private :
+    std::vector<unsigned int> m_rows;
+    code_hash m_hash;
+    size_t m_count;
+    unsigned int m_generation;
+    bool m_wide_codes;
+};
+
+class base_dictionary
+{
+public :
+    base_dictionary()
+        : m_codes( 16 ) {}
+    //
+    // Priming the base runs the compressor's dictionary building over
+    // the sample, without producing any output. The decompressor will
+    // build an identical base from the same sample and max_code.
+    //
+    base_dictionary( const std::string &sample, unsigned int max_code )
+        : m_codes( 16 )
+    {
+        if ( sample.empty() )
+            return;
+        unsigned int current = (unsigned char) sample[ 0 ];
+        for ( size_t i = 1 ; i < sample.size() ; i++ ) {
+            unsigned int symbol = (unsigned char) sample[ i ];
+            unsigned int code = find( current, symbol );
+            if ( code != NO_CODE )
+                current = code;
+            else {
+                if ( next_code() <= max_code )
+                    add( current, symbol );
+                current = symbol;
+            }
+        }
+    }
+    static const base_dictionary &roots()
+    {
+        static const base_dictionary shared;
+        return shared;
+    }
+    unsigned int next_code() const { return FIRST_CODE + (unsigned int) m_entries.size(); }
+    unsigned int find( unsigned int prefix, unsigned int symbol ) const
+    {
+        if ( m_entries.empty() )
+            return NO_CODE;
+        return m_codes.find( prefix, symbol );
+    }
+    const dictionary_entry &entry( unsigned int code ) const { return m_entries[ code - FIRST_CODE ]; }
+private :
+    void add( unsigned int prefix, unsigned int symbol )
+    {
+        dictionary_entry e = { prefix, length( prefix ) + 1, (unsigned char) symbol };
+        m_codes.insert( prefix, symbol, next_code() );
+        m_entries.push_back( e );
+    }
+    unsigned int length( unsigned int code ) const
+    {
+        return code < FIRST_CODE ? 1 : entry( code ).length;
+    }
+    code_hash m_codes;
+    std::vector<dictionary_entry> m_entries;
+};
+
+//
+// The compressor's view of the dictionary: lookups check the shared
+// base first, then the codes this stream has added on its own, which
+// are kept in whichever ENGINE the compressor was built with.
+//
+template<class ENGINE = code_hash>
+class layered_dictionary
+{
+public :
+    layered_dictionary( const base_dictionary &base, unsigned int max_code )
+        : m_base( base ),
+          m_next_code( base.next_code() ),
+          m_max_code( max_code ) {}
+    unsigned int find( unsigned int prefix, unsigned int symbol ) const
+    {
+        unsigned int code = m_base.find( prefix, symbol );
+        if ( code == NO_CODE && !m_overlay.empty() )
+            code = m_overlay.find( prefix, symbol );
+        return code;
+    }
+    void add( unsigned int prefix, unsigned int symbol )
+    {
+        if ( m_next_code <= m_max_code )
+            m_overlay.insert( prefix, symbol, m_next_code++ );
+    }
+    //
+    // Uses up the next code without adding anything. The decompressor
+    // adds an entry for every code but the first, even when the string
+    // is one it already has, so a compressor that emits a code which
+    // stops short of the longest match has to skip a code to stay in
+    // step. The duplicate is never looked up, so it isn't stored.
+    //
+    void reserve()
+    {
+        if ( m_next_code <= m_max_code )
+            m_next_code++;
+    }
+    unsigned int next_code() const { return m_next_code; }
+    void reset()
+    {
+        m_overlay.reset();
+        m_next_code = m_base.next_code();
+    }
+    const base_dictionary &base() const { return m_base; }
+    unsigned int max_code() const { return m_max_code; }
+    //
+    // The base is shared by every stream, and isn't counted here.
+    //
+    size_t bytes() const { return m_overlay.bytes(); }
+    size_t peak_bytes() const { return m_overlay.peak_bytes(); }
+    static size_t peak_bytes_for( const base_dictionary &base, unsigned int max_code )
+    {
+        return ENGINE::peak_bytes_for( base.next_code(), max_code );
+    }
+private :
+    const base_dictionary &m_base;
+    ENGINE m_overlay;
+    unsigned int m_next_code;
+    unsigned int m_max_code;
+};
+
+//
+// The decompressor's view of the dictionary. It never has to search
+// for a string, it only has to turn codes back into strings, so the
+// overlay is just a vector of entries indexed by code. The vector
+// doubles in size as it grows, but never past the number of entries
+// max_code allows.
+//
+class layered_strings
+{
+public :
+    layered_strings( const base_dictionary &base, unsigned int max_code )
+        : m_base( base ),
+          m_first_code( base.next_code() ),
+          m_max_code( max_code ),
+          m_peak( 0 ) {}
+    bool contains( unsigned int code ) const
+    {
+        return code < 256 || (code >= FIRST_CODE && code < next_code());
+    }
+    void add( unsigned int prefix, unsigned int symbol )
+    {
+        if ( next_code() <= m_max_code ) {
+            dictionary_entry e = { prefix, length( prefix ) + 1, (unsigned char) symbol };
+            if ( m_entries.size() == m_entries.capacity() )
+                grow();
+            m_entries.push_back( e );
+        }
+    }
+    unsigned int next_code() const { return m_first_code + (unsigned int) m_entries.size(); }
+    //
+    // Clearing a vector of plain structures doesn't free anything,
+    // so this is O(1), and the capacity is kept for the next stream.
+    //
+    void reset() { m_entries.clear(); }
+    const base_dictionary &base() const { return m_base; }
+    unsigned int max_code() const { return m_max_code; }
+    size_t bytes() const { return table_footprint( m_entries.capacity() * sizeof( dictionary_entry ) ); }
+    size_t peak_bytes() const { return m_peak; }
+    static size_t peak_bytes_for( const base_dictionary &base, unsigned int max_code )
+    {
+        const size_t limit = entry_limit( base.next_code(), max_code );
+        size_t capacity = 0;
+        size_t peak = 0;
+        while ( capacity < limit ) {
+            const size_t grown = grown_capacity( capacity, limit );
+            const size_t during = table_footprint( capacity * sizeof( dictionary_entry ) ) +
+                                  table_footprint( grown * sizeof( dictionary_entry ) );
+            if ( during > peak )
+                peak = during;
+            capacity = grown;
+        }
+        return peak;
+    }
+    //
+    // Write the string for a code into s, working from the last
+    // symbol back to the first by following the chain of prefixes.
+    //
+    void expand( unsigned int code, std::string &s ) const
+    {
+        s.resize( length( code ) );
+        size_t i = s.size();
+        while ( code >= FIRST_CODE ) {
+            const dictionary_entry &e = entry( code );
+            s[ --i ] = e.symbol;
+            code = e.prefix;
+        }
+        s[ --i ] = (char) code;
+    }
+private :
+    const dictionary_entry &entry( unsigned int code ) const
+    {
+        if ( code < m_first_code )
+            return m_base.entry( code );
+        return m_entries[ code - m_first_code ];
+    }
+    unsigned int length( unsigned int code ) const
+    {
+        return code < FIRST_CODE ? 1 : entry( code ).length;
+    }
+    static size_t entry_limit( unsigned int first_code, unsigned int max_code )
+    {
+        return max_code >= first_code ? size_t( max_code ) - first_code + 1 : 0;
+    }
+    static size_t grown_capacity( size_t capacity, size_t limit )
+    {
+        const size_t grown = capacity ? 2 * capacity : 256;
+        return grown < limit ? grown : limit;
+    }
+    void grow()
+    {
+        const size_t capacity = m_entries.capacity();
+        const size_t grown = grown_capacity( capacity, entry_limit( m_first_code, m_max_code ) );
+        const size_t during = bytes() + table_footprint( grown * sizeof( dictionary_entry ) );
+        if ( during > m_peak )
+            m_peak = during;
+        m_entries.reserve( grown );
+    }
+    const base_dictionary &m_base;
+    std::vector< dictionary_entry, table_allocator<dictionary_entry> > m_entries;
+    unsigned int m_first_code;
+    unsigned int m_max_code;
+    size_t m_peak;
+};
+
+}; //namespace lzw
+
+#endif //#ifndef LZW_DICTIONARY_DOT_H
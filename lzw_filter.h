@@ -0,0 +1,415 @@
+//
+// Copyright (c) 2011 Mark Nelson
+//
+// This software is licensed under the OSI MIT License, contained in
+// the file license.txt included with this project.
+//
+#ifndef LZW_FILTER_DOT_H
+#define LZW_FILTER_DOT_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "lzw_header.h"
+#if defined( __SSE2__ ) || defined( _M_X64 ) || (defined( _M_IX86_FP ) && _M_IX86_FP >= 2)
+#define LZW_FILTER_SSE2
+#include <emmintrin.h>
+#endif
+
+//
+// LZW finds repeated strings, and a table of numbers often doesn't have
+// many. A counter that goes up by one each time never repeats itself,
+// and a column of 32 bit readings that change a little at a time only
+// repeats in its high order bytes, which are spread out between the
+// low order bytes that are different every time. A filter rearranges
+// data like that into a form with more repeats, before it is
+// compressed, and puts it back after it is decompressed:
+//
+//    delta:N     replaces each byte with its difference from the byte N
+//                positions back, so a sequence of N byte values that goes
+//                up or down steadily turns into the same few bytes over
+//                and over. delta:1 is the plain byte delta that works
+//                for 8 bit samples, and for bigger values it's usually
+//                best after planes.
+//    planes:N    treats the data as N byte records, and writes the first
+//                byte of every record, then the second byte of every
+//                record, and so on, so the bytes that change slowly end
+//                up next to each other. Any bytes at the end that don't
+//                make up a whole record are left where they are.
+//
+// Filters can be chained, as in planes:4,delta:1 for a table of 32 bit
+// integers, and are applied to each block on its own, in order, then
+// undone in reverse order after the block is decoded. The chain is
+// recorded in the stream header, so the decoder doesn't have to be told.
+//
+// Filtering has to keep up with memory, or it would cost as much as it
+// saves, so the common cases use SSE2 when the compiler targets it:
+// delta with any stride in both directions, since the decoder's running
+// sum can still be done sixteen bytes at a time, and planes with 2, 4
+// and 8 byte records, which split and merge with the pack and unpack
+// instructions. Everything else, and any odd bytes at the end, is done
+// with plain loops, which produce exactly the same results.
+//
+
+namespace lzw {
+
+enum filter_type {
+    DELTA_FILTER = 1,
+    PLANE_FILTER = 2
+};
+
+namespace filter_detail {
+
+inline void delta_encode( unsigned char *data, size_t length, size_t stride )
+{
+    if ( length <= stride )
+        return;
+    size_t i = length;
+#ifdef LZW_FILTER_SSE2
+    //
+    // Working from the end back, each chunk reads bytes that haven't
+    // been changed yet, even when they overlap the chunk itself.
+    //
+    while ( i >= stride + 16 ) {
+        i -= 16;
+        const __m128i current = _mm_loadu_si128( (const __m128i *) (data + i) );
+        const __m128i previous = _mm_loadu_si128( (const __m128i *) (data + i - stride) );
+        _mm_storeu_si128( (__m128i *) (data + i), _mm_sub_epi8( current, previous ) );
+    }
+#endif
+    while ( i-- > stride )
+        data[ i ] -= data[ i - stride ];
+}
+
+#ifdef LZW_FILTER_SSE2
+//
+// A running sum with a stride of 1, 2, 4, or 8 inside one register takes
+// log2(16 / stride) shifts and adds. The sum carried in from the last
+// chunk is its final stride bytes, repeated across the register.
+//
+template<int STRIDE>
+inline __m128i prefix_sum( __m128i x )
+{
+    if ( STRIDE <= 1 )
+        x = _mm_add_epi8( x, _mm_slli_si128( x, 1 ) );
+    if ( STRIDE <= 2 )
+        x = _mm_add_epi8( x, _mm_slli_si128( x, 2 ) );
+    if ( STRIDE <= 4 )
+        x = _mm_add_epi8( x, _mm_slli_si128( x, 4 ) );
+    return _mm_add_epi8( x, _mm_slli_si128( x, 8 ) );
+}
+
+template<int STRIDE>
+inline __m128i repeat_last( __m128i x )
+{
+    switch ( STRIDE ) {
+    case 1 :
+        x = _mm_unpackhi_epi8( x, x );
+        x = _mm_unpackhi_epi16( x, x );
+        return _mm_shuffle_epi32( x, 0xff );
+    case 2 :
+        return _mm_shuffle_epi32( _mm_shufflehi_epi16( x, 0xff ), 0xff );
+    case 4 :
+        return _mm_shuffle_epi32( x, 0xff );
+    default :
+        return _mm_unpackhi_epi64( x, x );
+    }
+}
+
+template<int STRIDE>
+inline size_t delta_decode_small( unsigned char *data, size_t length )
+{
+    __m128i carry = _mm_setzero_si128();
+    size_t i = 0;
+    for ( ; i + 16 <= length ; i += 16 ) {
+        __m128i x = _mm_loadu_si128( (const __m128i *) (data + i) );
+        x = _mm_add_epi8( prefix_sum<STRIDE>( x ), carry );
+        _mm_storeu_si128( (__m128i *) (data + i), x );
+        carry = repeat_last<STRIDE>( x );
+    }
+    return i;
+}
+#endif
+
+inline void delta_decode( unsigned char *data, size_t length, size_t stride )
+{
+    size_t i = stride;
+#ifdef LZW_FILTER_SSE2
+    switch ( stride ) {
+    case 1 : i = delta_decode_small<1>( data, length ) ; break;
+    case 2 : i = delta_decode_small<2>( data, length ) ; break;
+    case 4 : i = delta_decode_small<4>( data, length ) ; break;
+    case 8 : i = delta_decode_small<8>( data, length ) ; break;
+    default :
+        //
+        // With a stride of 16 or more, the bytes a chunk adds in are
+        // already finished, so there's no dependency inside a chunk.
+        //
+        if ( stride >= 16 )
+            for ( ; i + 16 <= length ; i += 16 ) {
+                const __m128i current = _mm_loadu_si128( (const __m128i *) (data + i) );
+                const __m128i previous = _mm_loadu_si128( (const __m128i *) (data + i - stride) );
+                _mm_storeu_si128( (__m128i *) (data + i), _mm_add_epi8( current, previous ) );
+            }
+    }
+    if ( i < stride )
+        i = stride;
+#endif
+    for ( ; i < length ; i++ )
+        data[ i ] += data[ i - stride ];
+}
+
+#ifdef LZW_FILTER_SSE2
+//
+// Splitting 32 bytes into the 16 at even offsets and the 16 at odd
+// offsets, and its inverse. Everything else is built out of these.
+//
+inline void split( __m128i a, __m128i b, __m128i &even, __m128i &odd )
+{
+    const __m128i mask = _mm_set1_epi16( 0x00ff );
+    even = _mm_packus_epi16( _mm_and_si128( a, mask ), _mm_and_si128( b, mask ) );
+    odd = _mm_packus_epi16( _mm_srli_epi16( a, 8 ), _mm_srli_epi16( b, 8 ) );
+}
+
+inline void merge( __m128i even, __m128i odd, __m128i &a, __m128i &b )
+{
+    a = _mm_unpacklo_epi8( even, odd );
+    b = _mm_unpackhi_epi8( even, odd );
+}
+
+inline __m128i load( const unsigned char *p ) { return _mm_loadu_si128( (const __m128i *) p ); }
+inline void store( unsigned char *p, __m128i x ) { _mm_storeu_si128( (__m128i *) p, x ); }
+
+//
+// Each pass handles 16 records, so every plane gets 16 bytes. Returns
+// the number of records done.
+//
+inline size_t planes_encode_sse2( const unsigned char *in, unsigned char *out, size_t records, size_t width )
+{
+    size_t r = 0;
+    if ( width == 2 )
+        for ( ; r + 16 <= records ; r += 16 ) {
+            __m128i p0, p1;
+            split( load( in + 2 * r ), load( in + 2 * r + 16 ), p0, p1 );
+            store( out + r, p0 );
+            store( out + records + r, p1 );
+        }
+    else if ( width == 4 )
+        for ( ; r + 16 <= records ; r += 16 ) {
+            const unsigned char *p = in + 4 * r;
+            __m128i e0, o0, e1, o1, p0, p1, p2, p3;
+            split( load( p ), load( p + 16 ), e0, o0 );
+            split( load( p + 32 ), load( p + 48 ), e1, o1 );
+            split( e0, e1, p0, p2 );
+            split( o0, o1, p1, p3 );
+            store( out + r, p0 );
+            store( out + records + r, p1 );
+            store( out + 2 * records + r, p2 );
+            store( out + 3 * records + r, p3 );
+        }
+    else if ( width == 8 )
+        for ( ; r + 16 <= records ; r += 16 ) {
+            const unsigned char *p = in + 8 * r;
+            __m128i e[ 4 ], o[ 4 ], ee[ 2 ], eo[ 2 ], oe[ 2 ], oo[ 2 ], planes[ 8 ];
+            for ( int k = 0 ; k < 4 ; k++ )
+                split( load( p + 32 * k ), load( p + 32 * k + 16 ), e[ k ], o[ k ] );
+            for ( int k = 0 ; k < 2 ; k++ ) {
+                split( e[ 2 * k ], e[ 2 * k + 1 ], ee[ k ], eo[ k ] );
+                split( o[ 2 * k ], o[ 2 * k + 1 ], oe[ k ], oo[ k ] );
+            }
+            split( ee[ 0 ], ee[ 1 ], planes[ 0 ], planes[ 4 ] );
+            split( eo[ 0 ], eo[ 1 ], planes[ 2 ], planes[ 6 ] );
+            split( oe[ 0 ], oe[ 1 ], planes[ 1 ], planes[ 5 ] );
+            split( oo[ 0 ], oo[ 1 ], planes[ 3 ], planes[ 7 ] );
+            for ( int k = 0 ; k < 8 ; k++ )
+                store( out + k * records + r, planes[ k ] );
+        }
+    return r;
+}
+
+inline size_t planes_decode_sse2( const unsigned char *in, unsigned char *out, size_t records, size_t width )
+{
+    size_t r = 0;
+    if ( width == 2 )
+        for ( ; r + 16 <= records ; r += 16 ) {
+            __m128i a, b;
+            merge( load( in + r ), load( in + records + r ), a, b );
+            store( out + 2 * r, a );
+            store( out + 2 * r + 16, b );
+        }
+    else if ( width == 4 )
+        for ( ; r + 16 <= records ; r += 16 ) {
+            unsigned char *p = out + 4 * r;
+            __m128i e0, e1, o0, o1, a, b;
+            merge( load( in + r ), load( in + 2 * records + r ), e0, e1 );
+            merge( load( in + records + r ), load( in + 3 * records + r ), o0, o1 );
+            merge( e0, o0, a, b );
+            store( p, a );
+            store( p + 16, b );
+            merge( e1, o1, a, b );
+            store( p + 32, a );
+            store( p + 48, b );
+        }
+    else if ( width == 8 )
+        for ( ; r + 16 <= records ; r += 16 ) {
+            unsigned char *p = out + 8 * r;
+            __m128i planes[ 8 ], ee[ 2 ], eo[ 2 ], oe[ 2 ], oo[ 2 ], e[ 4 ], o[ 4 ];
+            for ( int k = 0 ; k < 8 ; k++ )
+                planes[ k ] = load( in + k * records + r );
+            merge( planes[ 0 ], planes[ 4 ], ee[ 0 ], ee[ 1 ] );
+            merge( planes[ 2 ], planes[ 6 ], eo[ 0 ], eo[ 1 ] );
+            merge( planes[ 1 ], planes[ 5 ], oe[ 0 ], oe[ 1 ] );
+            merge( planes[ 3 ], planes[ 7 ], oo[ 0 ], oo[ 1 ] );
+            for ( int k = 0 ; k < 2 ; k++ ) {
+                merge( ee[ k ], eo[ k ], e[ 2 * k ], e[ 2 * k + 1 ] );
+                merge( oe[ k ], oo[ k ], o[ 2 * k ], o[ 2 * k + 1 ] );
+            }
+            for ( int k = 0 ; k < 4 ; k++ ) {
+                __m128i a, b;
+                merge( e[ k ], o[ k ], a, b );
+                store( p + 32 * k, a );
+                store( p + 32 * k + 16, b );
+            }
+        }
+    return r;
+}
+#endif
+
+inline void planes_encode( const unsigned char *in, unsigned char *out, size_t length, size_t width )
+{
+    const size_t records = length / width;
+    size_t r = 0;
+#ifdef LZW_FILTER_SSE2
+    r = planes_encode_sse2( in, out, records, width );
+#endif
+    for ( ; r < records ; r++ )
+        for ( size_t j = 0 ; j < width ; j++ )
+            out[ j * records + r ] = in[ r * width + j ];
+    memcpy( out + records * width, in + records * width, length - records * width );
+}
+
+inline void planes_decode( const unsigned char *in, unsigned char *out, size_t length, size_t width )
+{
+    const size_t records = length / width;
+    size_t r = 0;
+#ifdef LZW_FILTER_SSE2
+    r = planes_decode_sse2( in, out, records, width );
+#endif
+    for ( ; r < records ; r++ )
+        for ( size_t j = 0 ; j < width ; j++ )
+            out[ r * width + j ] = in[ j * records + r ];
+    memcpy( out + records * width, in + records * width, length - records * width );
+}
+
+}; //namespace filter_detail
+
+class filter_chain
+{
+public :
+    enum {
+        MAX_FILTERS = 8,
+        MAX_DELTA = 1 << 16,
+        MAX_PLANES = 256
+    };
+    filter_chain() {}
+    //
+    // Returns false, and leaves the chain alone, if the list has
+    // filters that don't exist or parameters that are out of range.
+    //
+    bool set( const std::vector<filter_spec> &specs )
+    {
+        if ( specs.size() > MAX_FILTERS )
+            return false;
+        for ( size_t i = 0 ; i < specs.size() ; i++ )
+            if ( !valid( specs[ i ] ) )
+                return false;
+        m_specs = specs;
+        return true;
+    }
+    //
+    // Parses a list like "planes:4,delta:1". A filter without a
+    // parameter gets 1 for delta and 4 for planes.
+    //
+    bool parse( const std::string &text )
+    {
+        std::vector<filter_spec> specs;
+        size_t start = 0;
+        while ( start <= text.size() ) {
+            size_t end = text.find( ',', start );
+            if ( end == std::string::npos )
+                end = text.size();
+            const std::string item = text.substr( start, end - start );
+            const size_t colon = item.find( ':' );
+            const std::string name = item.substr( 0, colon );
+            filter_spec spec;
+            if ( name == "delta" )
+                spec.type = DELTA_FILTER;
+            else if ( name == "planes" )
+                spec.type = PLANE_FILTER;
+            else
+                return false;
+            spec.parameter = spec.type == DELTA_FILTER ? 1 : 4;
+            if ( colon != std::string::npos ) {
+                const std::string number = item.substr( colon + 1 );
+                char *stop;
+                spec.parameter = (unsigned int) strtoul( number.c_str(), &stop, 10 );
+                if ( number.empty() || *stop )
+                    return false;
+            }
+            specs.push_back( spec );
+            start = end + 1;
+        }
+        return set( specs );
+    }
+    static bool valid( const filter_spec &spec )
+    {
+        switch ( spec.type ) {
+        case DELTA_FILTER :
+            return spec.parameter >= 1 && spec.parameter <= MAX_DELTA;
+        case PLANE_FILTER :
+            return spec.parameter >= 2 && spec.parameter <= MAX_PLANES;
+        default :
+            return false;
+        }
+    }
+    const std::vector<filter_spec> &specs() const { return m_specs; }
+    bool empty() const { return m_specs.empty(); }
+    void encode( char *data, size_t length )
+    {
+        for ( size_t i = 0 ; i < m_specs.size() ; i++ )
+            apply( m_specs[ i ], (unsigned char *) data, length, true );
+    }
+    void decode( char *data, size_t length )
+    {
+        for ( size_t i = m_specs.size() ; i-- ; )
+            apply( m_specs[ i ], (unsigned char *) data, length, false );
+    }
+private :
+    void apply( const filter_spec &spec, unsigned char *data, size_t length, bool encode )
+    {
+        if ( spec.type == DELTA_FILTER ) {
+            if ( encode )
+                filter_detail::delta_encode( data, length, spec.parameter );
+            else
+                filter_detail::delta_decode( data, length, spec.parameter );
+            return;
+        }
+        m_scratch.resize( length );
+        if ( !length )
+            return;
+        unsigned char *scratch = (unsigned char *) &m_scratch[ 0 ];
+        if ( encode )
+            filter_detail::planes_encode( data, scratch, length, spec.parameter );
+        else
+            filter_detail::planes_decode( data, scratch, length, spec.parameter );
+        memcpy( data, scratch, length );
+    }
+    std::vector<filter_spec> m_specs;
+    std::string m_scratch;
+};
+
+}; //namespace lzw
+
+#endif //#ifndef LZW_FILTER_DOT_H
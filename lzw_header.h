@@ -0,0 +1,320 @@
+//
+// Copyright (c) 2011 Mark Nelson
+//
+// This software is licensed under the OSI MIT License, contained in
+// the file license.txt included with this project.
+//
+#ifndef LZW_HEADER_DOT_H
+#define LZW_HEADER_DOT_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "lzw_streambase.h"
+
+//
+// The code streams in lzw-a.h through lzw-d.h carry nothing but codes,
+// which keeps the article simple, but it means a decoder has no idea
+// how much output it is going to produce. The optional stream header
+// defined here can precede the code stream to fix that, and the flags
+// byte leaves room for other fields to be added later.
+//
+// The header looks like this:
+//
+//    4 bytes   magic number
+//    1 byte    flags
+//    varint    original size, present if HAS_SIZE is set
+//    varint    max_code, present if HAS_MAX_CODE is set
+//    varint    symbol size in bytes, present if HAS_SYMBOLS is set
+//    varint    alphabet size, present if HAS_SYMBOLS is set
+//    varint    number of filters, present if HAS_FILTERS is set,
+//              followed by a varint type and a varint parameter for
+//              each filter, in the order they were applied
+//    1 byte    code stream flavour, 'a' through 'd', present if
+//              HAS_FLAVOUR is set
+//
+// If HAS_BLOCKS is set, the header is followed by a sequence of blocks
+// as described in lzw_block.h, otherwise by a single code stream. If
+// HAS_SYMBOLS is set, the code stream holds symbols bigger than a byte,
+// as described in lzw_symbols.h. The filters are described in
+// lzw_filter.h; the header just carries them. HAS_PRIMED goes with
+// HAS_BLOCKS, and says that some of the blocks may be 'P' blocks, which
+// take more memory to decode than the others, so a decoder with a
+// memory limit can know before it starts. Without it, a 'P' block is
+// damage.
+//
+// Without HAS_FLAVOUR, the code streams are lzw-d, which is what every
+// stream was before the flag was added, so set_flavour( 'd' ) leaves it
+// clear and the header comes out the same as it always did. A decoder
+// that reads the flavour from the header can pick the right code
+// stream classes itself, instead of having to be built or told to
+// match the encoder.
+//
+// Integers are written as little-endian base 128 varints, seven bits
+// to a byte with the high bit set on all but the last byte.
+//
+// The magic number was chosen so that it can't be confused with the
+// start of a headerless stream from any of the four flavours. The
+// second byte is odd, which can never happen in lzw-c or lzw-d, where
+// the first code is always less than 256 and so has bit 8 clear. In
+// lzw-b the second byte is always zero, and in lzw-a it is a digit or
+// a newline. So a decoder can tell whether a header is present just by
+// looking at the first four bytes.
+//
+
+namespace lzw {
+
+struct filter_spec
+{
+    unsigned int type;
+    unsigned int parameter;
+};
+
+template<class T>
+void write_varint( T &output, unsigned long long value )
+{
+    while ( value >= 0x80 ) {
+        output.put( char( (value & 0x7f) | 0x80 ) );
+        value >>= 7;
+    }
+    output.put( char( value ) );
+}
+
+//
+// The number of bytes write_varint() uses for value.
+//
+inline size_t varint_length( unsigned long long value )
+{
+    size_t length = 1;
+    for ( ; value >= 0x80 ; value >>= 7 )
+        length++;
+    return length;
+}
+
+template<class T>
+bool read_varint( T &input, unsigned long long &value )
+{
+    value = 0;
+    for ( int shift = 0 ; shift < 64 ; shift += 7 ) {
+        char c;
+        if ( !input.get( c ) )
+            return false;
+        value |= (unsigned long long) (c & 0x7f) << shift;
+        if ( !(c & 0x80) )
+            return true;
+    }
+    return false;
+}
+
+class stream_header
+{
+public :
+    enum {
+        HAS_SIZE = 0x01,
+        HAS_BLOCKS = 0x02,
+        HAS_MAX_CODE = 0x04,
+        HAS_SYMBOLS = 0x08,
+        HAS_FILTERS = 0x10,
+        HAS_FLAVOUR = 0x20,
+        HAS_PRIMED = 0x40,
+        KNOWN_FLAGS = HAS_SIZE | HAS_BLOCKS | HAS_MAX_CODE | HAS_SYMBOLS | HAS_FILTERS | HAS_FLAVOUR |
+                      HAS_PRIMED
+    };
+    enum { MAX_FILTERS = 16 };
+    enum { MAGIC_SIZE = 4 };
+    stream_header()
+        : m_flags( 0 ),
+          m_size( 0 ),
+          m_max_code( 0 ),
+          m_symbol_size( 1 ),
+          m_alphabet_size( 256 ),
+          m_flavour( 'd' ) {}
+    static const char *magic() { return "LwZ\x1a"; }
+    //
+    // Returns true if the data starts with a stream header. This
+    // only checks the magic number, read() does the rest.
+    //
+    static bool present( const char *data, size_t length )
+    {
+        if ( length < MAGIC_SIZE )
+            return false;
+        for ( int i = 0 ; i < MAGIC_SIZE ; i++ )
+            if ( data[ i ] != magic()[ i ] )
+                return false;
+        return true;
+    }
+    bool has_blocks() const { return (m_flags & HAS_BLOCKS) != 0; }
+    void set_blocks() { m_flags |= HAS_BLOCKS; }
+    bool has_primed() const { return (m_flags & HAS_PRIMED) != 0; }
+    void set_primed() { m_flags |= HAS_PRIMED | HAS_BLOCKS; }
+    bool has_size() const { return (m_flags & HAS_SIZE) != 0; }
+    unsigned long long size() const { return m_size; }
+    void set_size( unsigned long long size )
+    {
+        m_flags |= HAS_SIZE;
+        m_size = size;
+    }
+    bool has_max_code() const { return (m_flags & HAS_MAX_CODE) != 0; }
+    unsigned int max_code() const { return m_max_code; }
+    void set_max_code( unsigned int max_code )
+    {
+        m_flags |= HAS_MAX_CODE;
+        m_max_code = max_code;
+    }
+    bool has_symbols() const { return (m_flags & HAS_SYMBOLS) != 0; }
+    unsigned int symbol_size() const { return m_symbol_size; }
+    unsigned int alphabet_size() const { return m_alphabet_size; }
+    void set_symbols( unsigned int symbol_size, unsigned int alphabet_size )
+    {
+        m_flags |= HAS_SYMBOLS;
+        m_symbol_size = symbol_size;
+        m_alphabet_size = alphabet_size;
+    }
+    bool has_filters() const { return (m_flags & HAS_FILTERS) != 0; }
+    const std::vector<filter_spec> &filters() const { return m_filters; }
+    //
+    // An empty list clears the flag, so callers can pass theirs along
+    // whether it has anything in it or not.
+    //
+    void set_filters( const std::vector<filter_spec> &filters )
+    {
+        m_filters = filters;
+        if ( filters.empty() )
+            m_flags &= ~HAS_FILTERS;
+        else
+            m_flags |= HAS_FILTERS;
+    }
+    bool has_flavour() const { return (m_flags & HAS_FLAVOUR) != 0; }
+    char flavour() const { return m_flavour; }
+    void set_flavour( char flavour )
+    {
+        m_flavour = flavour;
+        if ( flavour == 'd' )
+            m_flags &= ~HAS_FLAVOUR;
+        else
+            m_flags |= HAS_FLAVOUR;
+    }
+    template<class T>
+    void write( T &output ) const
+    {
+        for ( int i = 0 ; i < MAGIC_SIZE ; i++ )
+            output.put( magic()[ i ] );
+        output.put( char( m_flags ) );
+        if ( m_flags & HAS_SIZE )
+            write_varint( output, m_size );
+        if ( m_flags & HAS_MAX_CODE )
+            write_varint( output, m_max_code );
+        if ( m_flags & HAS_SYMBOLS ) {
+            write_varint( output, m_symbol_size );
+            write_varint( output, m_alphabet_size );
+        }
+        if ( m_flags & HAS_FILTERS ) {
+            write_varint( output, m_filters.size() );
+            for ( size_t i = 0 ; i < m_filters.size() ; i++ ) {
+                write_varint( output, m_filters[ i ].type );
+                write_varint( output, m_filters[ i ].parameter );
+            }
+        }
+        if ( m_flags & HAS_FLAVOUR )
+            output.put( m_flavour );
+    }
+    //
+    // read() returns false if the magic number doesn't match, if
+    // the stream ends early, or if the header has flags set that
+    // this version of the code doesn't understand.
+    //
+    template<class T>
+    bool read( T &input )
+    {
+        char c;
+        for ( int i = 0 ; i < MAGIC_SIZE ; i++ )
+            if ( !input.get( c ) || c != magic()[ i ] )
+                return false;
+        if ( !input.get( c ) )
+            return false;
+        m_flags = c & 0xff;
+        if ( (m_flags & ~KNOWN_FLAGS) || ((m_flags & HAS_PRIMED) && !(m_flags & HAS_BLOCKS)) )
+            return false;
+        if ( (m_flags & HAS_SIZE) && !read_varint( input, m_size ) )
+            return false;
+        if ( m_flags & HAS_MAX_CODE ) {
+            unsigned long long max_code;
+            if ( !read_varint( input, max_code ) || max_code < 256 || max_code > LARGEST_MAX_CODE )
+                return false;
+            m_max_code = (unsigned int) max_code;
+        }
+        if ( m_flags & HAS_SYMBOLS ) {
+            unsigned long long symbol_size;
+            unsigned long long alphabet_size;
+            if ( !read_varint( input, symbol_size ) || !read_varint( input, alphabet_size ) ||
+                 (symbol_size != 1 && symbol_size != 2 && symbol_size != 4) ||
+                 !alphabet_size || alphabet_size > 0xffffffffull )
+                return false;
+            m_symbol_size = (unsigned int) symbol_size;
+            m_alphabet_size = (unsigned int) alphabet_size;
+        }
+        m_filters.clear();
+        if ( m_flags & HAS_FILTERS ) {
+            unsigned long long count;
+            if ( !read_varint( input, count ) || !count || count > MAX_FILTERS )
+                return false;
+            for ( unsigned long long i = 0 ; i < count ; i++ ) {
+                unsigned long long type;
+                unsigned long long parameter;
+                if ( !read_varint( input, type ) || !read_varint( input, parameter ) ||
+                     type > 0xffffffffull || parameter > 0xffffffffull )
+                    return false;
+                filter_spec spec = { (unsigned int) type, (unsigned int) parameter };
+                m_filters.push_back( spec );
+            }
+        }
+        m_flavour = 'd';
+        if ( m_flags & HAS_FLAVOUR ) {
+            if ( !input.get( m_flavour ) || m_flavour < 'a' || m_flavour > 'd' ||
+                 (m_flavour == 'b' && has_max_code() && m_max_code > 0xffff) )
+                return false;
+        }
+        return true;
+    }
+private :
+    unsigned int m_flags;
+    unsigned long long m_size;
+    unsigned int m_max_code;
+    unsigned int m_symbol_size;
+    unsigned int m_alphabet_size;
+    std::vector<filter_spec> m_filters;
+    char m_flavour;
+};
+
+//
+// When reading from a stream that can't be rewound, like a pipe, the
+// bytes examined while looking for the magic number are gone if it turns
+// out there is no header. replay_input hands those bytes back first, and
+// then carries on reading from the underlying stream, so a headerless
+// code stream can still be decoded from the beginning.
+//
+template<class T>
+class replay_input
+{
+public :
+    replay_input( T &input, const std::string &replay )
+        : m_input( input ),
+          m_replay( replay ),
+          m_next( 0 ) {}
+    bool get( char &c )
+    {
+        if ( m_next < m_replay.size() ) {
+            c = m_replay[ m_next++ ];
+            return true;
+        }
+        return (bool) m_input.get( c );
+    }
+private :
+    T &m_input;
+    std::string m_replay;
+    size_t m_next;
+};
+
+}; //namespace lzw
+
+#endif //#ifndef LZW_HEADER_DOT_H
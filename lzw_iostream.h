@@ -0,0 +1,61 @@
+//
+// Copyright (c) 2011 Mark Nelson
+//
+// This software is licensed under the OSI MIT License, contained in
+// the file license.txt included with this project.
+//
+#ifndef LZW_IOSTREAM_DOT_H
+#define LZW_IOSTREAM_DOT_H
+
+#include "lzw_streambase.h"
+#include <iostream>
+
+//
+// The symbol stream classes for std::istream and std::ostream are the
+// same no matter which flavour of code stream is in use, so they live
+// here, and are included by lzw-a.h through lzw-d.h.
+//
+
+namespace lzw {
+//
+// It's tempting to try to read characters using the ifstream
+// extraction operator, as in m_impl >> c, but that operator
+// skips over whitespace, so we don't get an exact copy of 
+// the input stream. Using get() works around this problem.
+//
+template<>
+class input_symbol_stream<std::istream> {
+public :
+    input_symbol_stream( std::istream &input ) 
+        : m_input( input ) {}
+    bool operator>>( char &c )
+    {
+        if ( !m_input.get( c ) )
+            return false;
+        else
+            return true;
+    }
+private :
+    std::istream &m_input;
+};
+//
+// Using the insertion operator to output strings seems to work properly,
+// even when the strings contain binary data, so this implementation is
+// as simple as we could hope for.
+//
+template<>
+class output_symbol_stream<std::ostream> {
+public :
+    output_symbol_stream( std::ostream &output ) 
+        : m_output( output ) {}
+    void operator<<( const std::string &s )
+    {
+        m_output << s;
+    }
+private :
+    std::ostream &m_output;
+};
+
+}; //namespace lzw
+
+#endif //#ifndef LZW_IOSTREAM_DOT_H
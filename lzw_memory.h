@@ -0,0 +1,178 @@
+//
+// Copyright (c) 2011 Mark Nelson
+//
+// This software is licensed under the OSI MIT License, contained in
+// the file license.txt included with this project.
+//
+#ifndef LZW_MEMORY_DOT_H
+#define LZW_MEMORY_DOT_H
+
+#include "lzw_streambase.h"
+#include <string>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+
+//
+// memory_input and memory_output are minimal byte streams that read from
+// a block of memory and append to a std::string. They implement just
+// enough of the iostreams interface - get(char&), put(char), and write() -
+// to be used with any of the flavoured code streams, without paying for
+// the sentry objects and locale machinery that come with std::istream.
+// This is what the C library interface in liblzw.cpp uses.
+//
+// buffer_output writes into a fixed block of memory supplied by the
+// caller. When the size of the output is known in advance, which is
+// the case when the stream header records the original size, this
+// lets decompress() write its strings straight into the destination
+// with a single allocation and no copying.
+//
+// The code streams write their final bytes from a destructor, where
+// throwing an exception isn't an option, so buffer_output itself never
+// throws. Once the buffer fills up it stops storing data and just keeps
+// count, so tellp() tells you how big the buffer needed to be. The
+// symbol stream for buffer_output is stricter: it throws buffer_overflow
+// the moment a string won't fit, which stops decompress() in its tracks
+// instead of letting it decode data there is no room for.
+//
+
+namespace lzw {
+
+class memory_input
+{
+public :
+    memory_input( const char *data, size_t length )
+        : m_count( 0 ),
+          m_begin( data ),
+          m_next( data ),
+          m_end( data + length ) {}
+    memory_input( const std::string &data )
+        : m_count( 0 ),
+          m_begin( data.data() ),
+          m_next( data.data() ),
+          m_end( data.data() + data.size() ) {}
+    bool get( char &c )
+    {
+        if ( m_next == m_end )
+            return false;
+        c = *m_next++;
+        return true;
+    }
+    //
+    // Like std::istream::read(), this copies as much as is available,
+    // up to length bytes, and gcount() reports how much that was.
+    //
+    memory_input &read( char *data, size_t length )
+    {
+        m_count = length < size_t( m_end - m_next ) ? length : size_t( m_end - m_next );
+        memcpy( data, m_next, m_count );
+        m_next += m_count;
+        return *this;
+    }
+    size_t gcount() const { return m_count; }
+    size_t tellg() const { return m_next - m_begin; }
+    //
+    // A reader that decodes straight out of the buffer, like the lzw-c
+    // code stream in lzw-c.h, looks at the unread bytes with next() and
+    // available(), then says how many of them it used with skip().
+    //
+    const char *next() const { return m_next; }
+    size_t available() const { return m_end - m_next; }
+    void skip( size_t length ) { m_next += length; }
+private :
+    size_t m_count;
+    const char *m_begin;
+    const char *m_next;
+    const char *m_end;
+};
+
+class memory_output
+{
+public :
+    memory_output( std::string &buffer )
+        : m_buffer( buffer ) {}
+    void put( char c ) { m_buffer.push_back( c ); }
+    void write( const char *data, size_t length ) { m_buffer.append( data, length ); }
+    size_t tellp() const { return m_buffer.size(); }
+private :
+    std::string &m_buffer;
+};
+
+class buffer_overflow : public std::length_error
+{
+public :
+    buffer_overflow()
+        : std::length_error( "lzw output buffer overflow" ) {}
+};
+
+class buffer_output
+{
+public :
+    buffer_output( char *data, size_t capacity )
+        : m_data( data ),
+          m_capacity( capacity ),
+          m_length( 0 ) {}
+    bool put( char c )
+    {
+        if ( m_length < m_capacity )
+            m_data[ m_length ] = c;
+        return ++m_length <= m_capacity;
+    }
+    bool write( const char *data, size_t length )
+    {
+        if ( m_length <= m_capacity && length <= m_capacity - m_length )
+            memcpy( m_data + m_length, data, length );
+        m_length += length;
+        return m_length <= m_capacity;
+    }
+    bool overflow() const { return m_length > m_capacity; }
+    size_t tellp() const { return m_length; }
+private :
+    char *m_data;
+    size_t m_capacity;
+    size_t m_length;
+};
+
+template<>
+class input_symbol_stream<memory_input> {
+public :
+    input_symbol_stream( memory_input &input )
+        : m_input( input ) {}
+    bool operator>>( char &c )
+    {
+        return m_input.get( c );
+    }
+private :
+    memory_input &m_input;
+};
+
+template<>
+class output_symbol_stream<memory_output> {
+public :
+    output_symbol_stream( memory_output &output )
+        : m_output( output ) {}
+    void operator<<( const std::string &s )
+    {
+        m_output.write( s.data(), s.size() );
+    }
+private :
+    memory_output &m_output;
+};
+
+template<>
+class output_symbol_stream<buffer_output> {
+public :
+    output_symbol_stream( buffer_output &output )
+        : m_output( output ) {}
+    void operator<<( const std::string &s )
+    {
+        if ( !m_output.write( s.data(), s.size() ) )
+            throw buffer_overflow();
+    }
+private :
+    buffer_output &m_output;
+};
+
+}; //namespace lzw
+
+#endif //#ifndef LZW_MEMORY_DOT_H
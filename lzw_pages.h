@@ -0,0 +1,162 @@
+//
+// Copyright (c) 2011 Mark Nelson
+//
+// This software is licensed under the OSI MIT License, contained in
+// the file license.txt included with this project.
+//
+#ifndef LZW_PAGES_DOT_H
+#define LZW_PAGES_DOT_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#if defined( __linux__ )
+#include <sys/mman.h>
+#endif
+
+//
+// With a default max_code of 32767, every table the dictionary engines
+// use fits comfortably in the caches. With max_code in the millions,
+// the tables run to hundreds of megabytes, every lookup lands on a
+// random page, and with 4KB pages nearly every one of them misses the
+// TLB as well as the cache. Backing the big tables with 2MB pages cuts
+// the number of pages by a factor of 512, which is enough for the TLB
+// to cover a table of a gigabyte or so.
+//
+// table_allocator is the allocator the engines in lzw_dictionary.h
+// give their vectors. Anything smaller than LARGE_TABLE_SIZE comes
+// from operator new as usual. Bigger tables are mapped directly, in
+// whole huge pages, aligned to a huge page boundary. What happens
+// next depends on huge_pages():
+//
+//    HUGE_PAGES_TRANSPARENT  the default. The mapping is marked with
+//                            madvise( MADV_HUGEPAGE ), so the kernel
+//                            backs it with transparent huge pages if
+//                            it can, even when THP is set to madvise
+//                            mode rather than always.
+//    HUGE_PAGES_RESERVED     the table is mapped from the pool of
+//                            reserved hugetlb pages, which is set up
+//                            with vm.nr_hugepages. These are never
+//                            swapped or split, but there are only as
+//                            many as the administrator set aside, so
+//                            when the pool runs dry the table falls
+//                            back to a transparent mapping.
+//    HUGE_PAGES_OFF          ordinary pages, for comparison.
+//
+// Whatever the setting, a big table takes up whole huge pages, so
+// table_footprint() rounds its size up, and the engines count the
+// rounded size in bytes() and peak_bytes_for(). That way a memory
+// budget works out the same whatever the setting, and on any system.
+// On systems other than Linux, big tables come from operator new, and
+// huge_pages() has no effect.
+//
+
+namespace lzw {
+
+enum huge_page_mode {
+    HUGE_PAGES_OFF,
+    HUGE_PAGES_TRANSPARENT,
+    HUGE_PAGES_RESERVED
+};
+
+const size_t HUGE_PAGE_SIZE = size_t( 1 ) << 21;
+const size_t LARGE_TABLE_SIZE = 4 * HUGE_PAGE_SIZE;
+
+//
+// The setting applies to tables allocated from then on, in every
+// thread, so it should be chosen before any contexts are created.
+//
+inline huge_page_mode &huge_pages()
+{
+    static huge_page_mode mode = HUGE_PAGES_TRANSPARENT;
+    return mode;
+}
+
+inline size_t table_footprint( size_t bytes )
+{
+    if ( bytes < LARGE_TABLE_SIZE )
+        return bytes;
+    return (bytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+}
+
+#if defined( __linux__ )
+
+inline void *allocate_table( size_t bytes )
+{
+    if ( bytes < LARGE_TABLE_SIZE )
+        return ::operator new( bytes );
+    const size_t size = table_footprint( bytes );
+    const int protection = PROT_READ | PROT_WRITE;
+#if defined( MAP_HUGETLB ) && defined( MAP_HUGE_SHIFT )
+    if ( huge_pages() == HUGE_PAGES_RESERVED ) {
+        const int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (21 << MAP_HUGE_SHIFT);
+        void *p = mmap( 0, size, protection, flags, -1, 0 );
+        if ( p != MAP_FAILED )
+            return p;
+    }
+#endif
+    //
+    // mmap() only promises ordinary page alignment, so map an extra
+    // huge page and trim off whatever lies outside the aligned part.
+    //
+    char *p = (char *) mmap( 0, size + HUGE_PAGE_SIZE, protection, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if ( p == (char *) MAP_FAILED )
+        throw std::bad_alloc();
+    char *aligned = (char *) (((size_t) p + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+    if ( aligned != p )
+        munmap( p, aligned - p );
+    if ( aligned + size != p + size + HUGE_PAGE_SIZE )
+        munmap( aligned + size, (p + size + HUGE_PAGE_SIZE) - (aligned + size) );
+#ifdef MADV_HUGEPAGE
+    if ( huge_pages() != HUGE_PAGES_OFF )
+        madvise( aligned, size, MADV_HUGEPAGE );
+#endif
+    return aligned;
+}
+
+inline void free_table( void *p, size_t bytes )
+{
+    if ( bytes < LARGE_TABLE_SIZE )
+        ::operator delete( p );
+    else
+        munmap( p, table_footprint( bytes ) );
+}
+
+#else
+
+inline void *allocate_table( size_t bytes ) { return ::operator new( bytes ); }
+inline void free_table( void *p, size_t ) { ::operator delete( p ); }
+
+#endif
+
+template<class T>
+class table_allocator : public std::allocator<T>
+{
+public :
+    template<class U>
+    struct rebind
+    {
+        typedef table_allocator<U> other;
+    };
+    table_allocator() {}
+    template<class U>
+    table_allocator( const table_allocator<U> & ) {}
+    T *allocate( size_t n, const void * = 0 )
+    {
+        return static_cast<T *>( allocate_table( n * sizeof( T ) ) );
+    }
+    void deallocate( T *p, size_t n )
+    {
+        free_table( p, n * sizeof( T ) );
+    }
+};
+
+template<class T, class U>
+bool operator==( const table_allocator<T> &, const table_allocator<U> & ) { return true; }
+
+template<class T, class U>
+bool operator!=( const table_allocator<T> &, const table_allocator<U> & ) { return false; }
+
+}; //namespace lzw
+
+#endif //#ifndef LZW_PAGES_DOT_H
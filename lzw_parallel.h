@@ -0,0 +1,234 @@
+//
+// Copyright (c) 2011 Mark Nelson
+//
+// This software is licensed under the OSI MIT License, contained in
+// the file license.txt included with this project.
+//
+#ifndef LZW_PARALLEL_DOT_H
+#define LZW_PARALLEL_DOT_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include "lzw_streambase.h"
+#include "lzw_memory.h"
+#include "lzw_header.h"
+#include "lzw_block.h"
+
+//
+// LZW is a chain: every code depends on the dictionary built by all of
+// the ones before it, so one stream can only be compressed by one core.
+// Blocks that each start with an empty dictionary can be compressed at
+// the same time, but the first few thousand codes of every block are
+// spent relearning strings the block before already knew, which costs
+// a lot of ratio with blocks of a megabyte or less.
+//
+// parallel_writer gets most of that back with the 'P' blocks described
+// in lzw_block.h. A block's dictionary is primed by compressing the
+// last prime_size bytes of the block before it, which is just input,
+// so it doesn't have to wait for anything. The writer collects one
+// block for each thread, runs the filters over them, and then has
+// each thread prime its own compressor and compress its own block into
+// memory, after which the blocks are written out in order. The first
+// block of the stream has nothing before it, and is an ordinary 'L'
+// block. The decoder is the ordinary block_reader, which primes its
+// dictionary the same way before each 'P' block, so decoding is still
+// done on one core, and a little slower than for 'L' blocks. It needs
+// more memory, too, for the compressor that does the priming, so the
+// header gets HAS_PRIMED, and a decoder with a memory limit can allow
+// for it before it starts.
+//
+// Priming costs each thread prime_size more bytes of compression per
+// block, and it isn't free for the ratio either: an LZW dictionary
+// stops growing when it is full, so every code the priming data adds is
+// one the block can't use for itself. By default a block is primed
+// with one byte for each code in the dictionary, which fills something
+// like a quarter of it with text. With the default max_code, the block
+// writer doesn't chain blocks together anyway, and priming moves the
+// ratio by a percent or so either way. With bigger dictionaries, which
+// a single stream carries from block to block, priming gets back a
+// good part of what independent blocks give up.
+//
+// Each thread has its own dictionary, so the memory is the threads
+// times what one compressor would need, plus two blocks per thread:
+// the one being compressed, and its output.
+//
+
+namespace lzw {
+
+enum { AUTO_PRIME_SIZE = MAX_PRIME_SIZE + 1 };
+
+inline size_t default_prime_size( unsigned int max_code )
+{
+    const size_t size = size_t( max_code ) + 1;
+    return size < MAX_PRIME_SIZE ? size : MAX_PRIME_SIZE;
+}
+
+template<char FLAVOUR, class ENGINE = code_hash>
+class parallel_writer
+{
+public :
+    parallel_writer( unsigned int max_code = 32767,
+                     unsigned int threads = 0,
+                     size_t block_size = block_writer::DEFAULT_BLOCK_SIZE,
+                     size_t prime_size = AUTO_PRIME_SIZE,
+                     const filter_chain &filters = filter_chain() )
+        : m_block_size( block_size ? block_size : block_writer::DEFAULT_BLOCK_SIZE ),
+          m_prime_size( prime_size == AUTO_PRIME_SIZE ? default_prime_size( max_code ) :
+                        prime_size < MAX_PRIME_SIZE ? prime_size : MAX_PRIME_SIZE ),
+          m_filters( filters ),
+          m_tail_length( 0 )
+    {
+        if ( !threads )
+            threads = std::thread::hardware_concurrency();
+        if ( !threads )
+            threads = 1;
+        for ( unsigned int i = 0 ; i < threads ; i++ )
+            m_workers.push_back( std::unique_ptr<worker>( new worker( max_code, m_block_size ) ) );
+    }
+    //
+    // Data is saved up until there is a block for every thread, and
+    // then they are all compressed at once.
+    //
+    template<class OUTPUT>
+    void write( OUTPUT &output, const char *data, size_t length )
+    {
+        const size_t batch = m_block_size * m_workers.size();
+        while ( length ) {
+            const size_t room = m_tail_length + batch - m_pending.size();
+            const size_t n = length < room ? length : room;
+            m_pending.append( data, n );
+            data += n;
+            length -= n;
+            if ( m_pending.size() == m_tail_length + batch )
+                write_batch( output );
+        }
+    }
+    template<class OUTPUT>
+    void finish( OUTPUT &output )
+    {
+        if ( m_pending.size() > m_tail_length )
+            write_batch( output );
+        output.put( char( END_BLOCK ) );
+    }
+    void set_lookahead( unsigned int lookahead )
+    {
+        for ( size_t i = 0 ; i < m_workers.size() ; i++ )
+            m_workers[ i ]->compressor.set_lookahead( lookahead );
+    }
+    unsigned int threads() const { return (unsigned int) m_workers.size(); }
+    size_t prime_size() const { return m_prime_size; }
+private :
+    parallel_writer( const parallel_writer & );
+    parallel_writer &operator=( const parallel_writer & );
+    struct worker
+    {
+        worker( unsigned int max_code, size_t block_size )
+            : compressor( max_code ),
+              writer( compressor, block_size ) {}
+        basic_compressor<ENGINE> compressor;
+        basic_block_writer<ENGINE> writer;
+        std::string output;
+        const char *prime;
+        size_t prime_length;
+        const char *data;
+        size_t length;
+    };
+    //
+    // m_pending starts with the tail of the last block of the previous
+    // batch, already filtered, and the blocks of this batch follow it.
+    // Each block's priming data is whatever of the prime_size bytes
+    // before it belongs to the block before.
+    //
+    template<class OUTPUT>
+    void write_batch( OUTPUT &output )
+    {
+        size_t blocks = 0;
+        for ( size_t start = m_tail_length ; start < m_pending.size() ; start += m_block_size, blocks++ ) {
+            worker &w = *m_workers[ blocks ];
+            const size_t previous = blocks ? m_block_size : m_tail_length;
+            w.prime_length = previous < m_prime_size ? previous : m_prime_size;
+            w.length = m_pending.size() - start < m_block_size ? m_pending.size() - start : m_block_size;
+            if ( !m_filters.empty() )
+                m_filters.encode( &m_pending[ start ], w.length );
+            w.prime = m_pending.data() + start - w.prime_length;
+            w.data = m_pending.data() + start;
+        }
+        std::vector<std::thread> threads;
+        for ( size_t i = 1 ; i < blocks ; i++ )
+            threads.push_back( std::thread( &parallel_writer::compress_block, m_workers[ i ].get() ) );
+        compress_block( m_workers[ 0 ].get() );
+        for ( size_t i = 0 ; i < threads.size() ; i++ )
+            threads[ i ].join();
+        for ( size_t i = 0 ; i < blocks ; i++ )
+            output.write( m_workers[ i ]->output.data(), m_workers[ i ]->output.size() );
+        const worker &last = *m_workers[ blocks - 1 ];
+        m_tail_length = last.length < m_prime_size ? last.length : m_prime_size;
+        m_pending.erase( 0, m_pending.size() - m_tail_length );
+    }
+    static void compress_block( worker *w )
+    {
+        w->output.clear();
+        memory_output out( w->output );
+        w->writer.template write_primed<FLAVOUR>( out, w->prime, w->prime_length, w->data, w->length );
+    }
+    const size_t m_block_size;
+    const size_t m_prime_size;
+    filter_chain m_filters;
+    std::vector< std::unique_ptr<worker> > m_workers;
+    std::string m_pending;
+    size_t m_tail_length;
+};
+
+//
+// Compresses everything from input, which needs read() and gcount(), to
+// output as a stream header followed by blocks, just as compress_blocks()
+// does, but with threads compressing blocks at the same time. threads
+// is the number of cores if it is 0, and prime_size follows max_code
+// unless it is given. With one of the objectives from lzw_tune.h, the
+// first block is used to pick max_code, as compress_blocks() does.
+//
+template<char FLAVOUR, class ENGINE = code_hash, class INPUT, class OUTPUT>
+void compress_parallel( INPUT &input,
+                        OUTPUT &output,
+                        unsigned int max_code = 32767,
+                        unsigned int threads = 0,
+                        size_t prime_size = AUTO_PRIME_SIZE,
+                        size_t block_size = block_writer::DEFAULT_BLOCK_SIZE,
+                        const filter_chain &filters = filter_chain(),
+                        unsigned int lookahead = 0,
+                        tuning_objective objective = TUNE_NONE )
+{
+    if ( !block_size )
+        block_size = block_writer::DEFAULT_BLOCK_SIZE;
+    std::string data( block_size, 0 );
+    input.read( &data[ 0 ], block_size );
+    size_t n = (size_t) input.gcount();
+    if ( objective != TUNE_NONE ) {
+        std::string sample( data, 0, n );
+        if ( n )
+            filter_chain( filters ).encode( &sample[ 0 ], n );
+        max_code = choose_max_code<FLAVOUR>( sample.data(), n, objective );
+    }
+    parallel_writer<FLAVOUR,ENGINE> writer( max_code, threads, block_size, prime_size, filters );
+    writer.set_lookahead( lookahead );
+    stream_header header;
+    header.set_blocks();
+    if ( writer.prime_size() )
+        header.set_primed();
+    header.set_max_code( max_code );
+    header.set_filters( filters.specs() );
+    header.set_flavour( FLAVOUR );
+    header.write( output );
+    while ( n ) {
+        writer.write( output, data.data(), n );
+        input.read( &data[ 0 ], data.size() );
+        n = (size_t) input.gcount();
+    }
+    writer.finish( output );
+}
+
+}; //namespace lzw
+
+#endif //#ifndef LZW_PARALLEL_DOT_H
@@ -0,0 +1,147 @@
+//
+// Copyright (c) 2011 Mark Nelson
+//
+// This software is licensed under the OSI MIT License, contained in
+// the file license.txt included with this project.
+//
+#ifndef LZW_PERF_DOT_H
+#define LZW_PERF_DOT_H
+
+//
+// perf_counters is a thin wrapper around the Linux perf_event_open()
+// system call. It is used by the --perf mode of lzw.cpp to find out
+// where the time goes in compress() and decompress() - whether the
+// dictionary lookups are stalling on cache misses, or whether the
+// processor is tripping over mispredicted branches.
+//
+// Each counter is opened on its own rather than as a group. That costs
+// a little accuracy, but it means that if one event isn't supported by
+// the processor (or the hypervisor hides it) the remaining counters
+// still work. Counters that can't be opened are simply reported as
+// unavailable, and on systems other than Linux all of them are.
+//
+
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+namespace lzw {
+
+class perf_counters
+{
+public :
+    enum event {
+        CYCLES,
+        INSTRUCTIONS,
+        L1D_MISSES,
+        LLC_MISSES,
+        BRANCH_MISSES,
+        EVENT_COUNT
+    };
+    perf_counters()
+        : m_nanoseconds( 0 )
+    {
+        for ( int i = 0 ; i < EVENT_COUNT ; i++ ) {
+            m_fd[ i ] = -1;
+            m_value[ i ] = 0;
+        }
+#ifdef __linux__
+        open( CYCLES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES );
+        open( INSTRUCTIONS, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS );
+        open( L1D_MISSES, PERF_TYPE_HW_CACHE,
+              PERF_COUNT_HW_CACHE_L1D |
+              (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+              (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) );
+        open( LLC_MISSES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES );
+        open( BRANCH_MISSES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES );
+#else
+        m_error = "hardware counters are only supported on Linux";
+#endif
+    }
+    ~perf_counters()
+    {
+#ifdef __linux__
+        for ( int i = 0 ; i < EVENT_COUNT ; i++ )
+            if ( m_fd[ i ] >= 0 )
+                close( m_fd[ i ] );
+#endif
+    }
+    void start()
+    {
+#ifdef __linux__
+        for ( int i = 0 ; i < EVENT_COUNT ; i++ )
+            if ( m_fd[ i ] >= 0 ) {
+                ioctl( m_fd[ i ], PERF_EVENT_IOC_RESET, 0 );
+                ioctl( m_fd[ i ], PERF_EVENT_IOC_ENABLE, 0 );
+            }
+#endif
+        m_start = std::chrono::steady_clock::now();
+    }
+    void stop()
+    {
+        std::chrono::steady_clock::time_point finish = std::chrono::steady_clock::now();
+#ifdef __linux__
+        for ( int i = 0 ; i < EVENT_COUNT ; i++ )
+            if ( m_fd[ i ] >= 0 ) {
+                ioctl( m_fd[ i ], PERF_EVENT_IOC_DISABLE, 0 );
+                long long count;
+                if ( read( m_fd[ i ], &count, sizeof(count) ) == sizeof(count) )
+                    m_value[ i ] = count;
+                else
+                    m_value[ i ] = 0;
+            }
+#endif
+        m_nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>( finish - m_start ).count();
+    }
+    bool available( event e ) const { return m_fd[ e ] >= 0; }
+    bool any_available() const
+    {
+        for ( int i = 0 ; i < EVENT_COUNT ; i++ )
+            if ( m_fd[ i ] >= 0 )
+                return true;
+        return false;
+    }
+    long long value( event e ) const { return m_value[ e ]; }
+    long long nanoseconds() const { return m_nanoseconds; }
+    //
+    // If one or more counters could not be opened, this holds
+    // the reason the first one failed, suitable for printing.
+    //
+    const std::string &error() const { return m_error; }
+private :
+    perf_counters( const perf_counters & );
+    perf_counters &operator=( const perf_counters & );
+#ifdef __linux__
+    void open( event e, unsigned int type, unsigned long long config )
+    {
+        perf_event_attr attr;
+        memset( &attr, 0, sizeof(attr) );
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        m_fd[ e ] = (int) syscall( __NR_perf_event_open, &attr, 0, -1, -1, 0 );
+        if ( m_fd[ e ] < 0 && m_error.empty() )
+            m_error = strerror( errno );
+    }
+#endif
+    int m_fd[ EVENT_COUNT ];
+    long long m_value[ EVENT_COUNT ];
+    long long m_nanoseconds;
+    std::chrono::steady_clock::time_point m_start;
+    std::string m_error;
+};
+
+}; //namespace lzw
+
+#endif //#ifndef LZW_PERF_DOT_H
@@ -0,0 +1,91 @@
+//
+// Copyright (c) 2011 Mark Nelson
+//
+// This software is licensed under the OSI MIT License, contained in
+// the file license.txt included with this project.
+//
+#ifndef LZW_POOL_DOT_H
+#define LZW_POOL_DOT_H
+
+#include <vector>
+#include "lzw.h"
+
+//
+// context_pool keeps a small stash of compressor or decompressor
+// objects for each thread, so code that compresses one message at a
+// time doesn't have to thread its own context through every call to
+// avoid the setup cost. Usage looks like this:
+//
+//    lzw::context_pool<lzw::compressor>::lease c( max_code );
+//    c->compress( in, out );
+//
+// The lease takes a context with a matching max_code and base from the
+// calling thread's pool, or creates one if there isn't one, and puts it
+// back when it goes out of scope. Since each thread has its own pool,
+// no locking is needed. The pool holds at most MAX_IDLE contexts per
+// thread; any more than that are deleted when they are returned.
+//
+
+namespace lzw {
+
+template<class CONTEXT>
+class context_pool
+{
+public :
+    enum { MAX_IDLE = 8 };
+    class lease
+    {
+    public :
+        lease( unsigned int max_code = 32767, const base_dictionary &base = base_dictionary::roots() )
+            : m_context( context_pool::acquire( max_code, base ) ) {}
+        ~lease() { context_pool::release( m_context ); }
+        CONTEXT &operator*() const { return *m_context; }
+        CONTEXT *operator->() const { return m_context; }
+    private :
+        lease( const lease & );
+        lease &operator=( const lease & );
+        CONTEXT *m_context;
+    };
+private :
+    //
+    // The idle list deletes whatever it still holds when its
+    // thread exits.
+    //
+    struct idle_list
+    {
+        std::vector<CONTEXT *> contexts;
+        ~idle_list()
+        {
+            for ( size_t i = 0 ; i < contexts.size() ; i++ )
+                delete contexts[ i ];
+        }
+    };
+    static idle_list &idle()
+    {
+        static thread_local idle_list list;
+        return list;
+    }
+    static CONTEXT *acquire( unsigned int max_code, const base_dictionary &base )
+    {
+        std::vector<CONTEXT *> &contexts = idle().contexts;
+        for ( size_t i = contexts.size() ; i-- > 0 ; )
+            if ( contexts[ i ]->max_code() == max_code && &contexts[ i ]->base() == &base ) {
+                CONTEXT *context = contexts[ i ];
+                contexts.erase( contexts.begin() + i );
+                return context;
+            }
+        return new CONTEXT( max_code, base );
+    }
+    static void release( CONTEXT *context )
+    {
+        std::vector<CONTEXT *> &contexts = idle().contexts;
+        if ( contexts.size() < MAX_IDLE )
+            contexts.push_back( context );
+        else
+            delete context;
+    }
+};
+
+}; //namespace lzw
+
+#endif //#ifndef LZW_POOL_DOT_H
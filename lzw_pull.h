@@ -0,0 +1,186 @@
+//
+// Copyright (c) 2011 Mark Nelson
+//
+// This software is licensed under the OSI MIT License, contained in
+// the file license.txt included with this project.
+//
+#ifndef LZW_PULL_DOT_H
+#define LZW_PULL_DOT_H
+
+#include <string>
+#include <cstddef>
+#include <iterator>
+#include "lzw_streambase.h"
+#include "lzw_dictionary.h"
+
+//
+// decompress() pushes the whole stream through to its output before it
+// returns, which is a waste for a program that only wants to look at
+// the start of the data, to sniff a file type or show the first few
+// lines. pull_decompressor turns that around: the caller asks for the
+// next chunk of output, and the decoder reads only as many codes as it
+// takes to produce it. When the caller stops asking, the decoder simply
+// stops, and nothing past that point is ever read from the input.
+//
+// It reads codes with the same input_code_stream as decompress(), and
+// builds the same dictionary, so any flavour works, and so does a base
+// dictionary. The decoding loop is the one from decompressor::resume(),
+// except that all of its state lives in members, so it can stop after
+// any code and pick up again later. A chunk ends at the first code that
+// takes it to chunk_size bytes or more, so it can run over by one
+// string. The chunks can be pulled three ways:
+//
+//    next( chunk )     replaces chunk with the next one, returning false
+//                      when there are no more
+//    read( data, n )   copies up to n bytes, like fread(), returning
+//                      the number copied, which is 0 at the end
+//    begin(), end()    an input range of chunks, for a range-based for
+//                      loop or any algorithm that takes input iterators
+//
+// Like decompress(), the decoder stops at EOF_CODE, or at the end of
+// the input. If it finds a code that can't be right, it stops there
+// too, and damaged() returns true.
+//
+// A program that only needs the first line of a file can write:
+//
+//    lzw::pull_decompressor<'d',lzw::fd_input> pull( in, max_code );
+//    for ( auto &chunk : pull ) {
+//        size_t newline = chunk.find( '\n' );
+//        line.append( chunk, 0, newline );
+//        if ( newline != std::string::npos )
+//            break;
+//    }
+//
+// For the block format in lzw_block.h, block_reader::read_block() is
+// the pull interface: it decodes one block each time it is called.
+//
+
+namespace lzw {
+
+template<char FLAVOUR, class INPUT>
+class pull_decompressor
+{
+public :
+    enum { DEFAULT_CHUNK_SIZE = 4096 };
+    pull_decompressor( INPUT &input,
+                       unsigned int max_code = 32767,
+                       size_t chunk_size = DEFAULT_CHUNK_SIZE,
+                       const base_dictionary &base = base_dictionary::roots() )
+        : m_input( input ),
+          m_codes( m_input, max_code ),
+          m_strings( base, max_code ),
+          m_chunk_size( chunk_size ? chunk_size : 1 ),
+          m_previous_code( NO_CODE ),
+          m_done( false ),
+          m_damaged( false ),
+          m_offset( 0 )
+    {
+        m_codes.preset( m_strings.next_code() );
+    }
+    bool next( std::string &chunk )
+    {
+        chunk.clear();
+        if ( m_offset < m_pending.size() ) {
+            chunk.assign( m_pending, m_offset, std::string::npos );
+            m_pending.clear();
+            m_offset = 0;
+        }
+        unsigned int code;
+        while ( chunk.size() < m_chunk_size && !m_done ) {
+            if ( !(m_codes >> code) ) {
+                m_done = true;
+                break;
+            }
+            if ( m_strings.contains( code ) )
+                m_strings.expand( code, m_current_string );
+            else {
+                if ( m_previous_code == NO_CODE || code != m_strings.next_code() ) {
+                    m_done = m_damaged = true;
+                    break;
+                }
+                m_current_string = m_previous_string + m_previous_string[0];
+            }
+            chunk += m_current_string;
+            if ( m_previous_code != NO_CODE )
+                m_strings.add( m_previous_code, (unsigned char) m_current_string[0] );
+            m_previous_code = code;
+            m_previous_string.swap( m_current_string );
+        }
+        return !chunk.empty();
+    }
+    size_t read( char *data, size_t length )
+    {
+        size_t copied = 0;
+        while ( copied < length ) {
+            if ( m_offset == m_pending.size() ) {
+                m_offset = 0;
+                if ( !next( m_pending ) )
+                    break;
+            }
+            size_t n = m_pending.size() - m_offset;
+            if ( n > length - copied )
+                n = length - copied;
+            m_pending.copy( data + copied, n, m_offset );
+            m_offset += n;
+            copied += n;
+        }
+        return copied;
+    }
+    bool done() const { return m_done && m_offset == m_pending.size(); }
+    bool damaged() const { return m_damaged; }
+    //
+    // The iterator holds the current chunk, so dereferencing it is
+    // cheap, and incrementing it decodes the next one. Like any input
+    // iterator, only one pass is possible, and copies of an iterator all
+    // advance the same decoder.
+    //
+    class iterator
+    {
+    public :
+        typedef std::input_iterator_tag iterator_category;
+        typedef std::string value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const std::string *pointer;
+        typedef const std::string &reference;
+        iterator()
+            : m_owner( 0 ) {}
+        explicit iterator( pull_decompressor *owner )
+            : m_owner( owner )
+        {
+            ++*this;
+        }
+        reference operator*() const { return m_chunk; }
+        pointer operator->() const { return &m_chunk; }
+        iterator &operator++()
+        {
+            if ( m_owner && !m_owner->next( m_chunk ) )
+                m_owner = 0;
+            return *this;
+        }
+        bool operator==( const iterator &other ) const { return m_owner == other.m_owner; }
+        bool operator!=( const iterator &other ) const { return m_owner != other.m_owner; }
+    private :
+        pull_decompressor *m_owner;
+        std::string m_chunk;
+    };
+    iterator begin() { return iterator( this ); }
+    iterator end() { return iterator(); }
+private :
+    pull_decompressor( const pull_decompressor & );
+    pull_decompressor &operator=( const pull_decompressor & );
+    flavoured<INPUT,FLAVOUR> m_input;
+    input_code_stream< flavoured<INPUT,FLAVOUR> > m_codes;
+    layered_strings m_strings;
+    size_t m_chunk_size;
+    unsigned int m_previous_code;
+    std::string m_previous_string;
+    std::string m_current_string;
+    bool m_done;
+    bool m_damaged;
+    std::string m_pending;
+    size_t m_offset;
+};
+
+}; //namespace lzw
+
+#endif //#ifndef LZW_PULL_DOT_H
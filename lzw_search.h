@@ -0,0 +1,314 @@
+//
+// Copyright (c) 2011 Mark Nelson
+//
+// This software is licensed under the OSI MIT License, contained in
+// the file license.txt included with this project.
+//
+#ifndef LZW_SEARCH_DOT_H
+#define LZW_SEARCH_DOT_H
+
+#include <string>
+#include <vector>
+#include "lzw_streambase.h"
+#include "lzw_dictionary.h"
+
+//
+// compressed_search looks for a pattern in LZW compressed data without
+// decompressing it. The obvious way to search a compressed file is to
+// decompress it and scan the output, which means writing out every
+// byte just to throw it away. But each code in an LZW stream stands for
+// a string the decoder has seen before, and whatever we learned about
+// that string the first time is still true. So instead of rebuilding
+// the strings, the search builds a small record for each code, and
+// processes a whole code in one step.
+//
+// The pattern is turned into a KMP automaton, where state k means the
+// last k bytes seen match the first k bytes of the pattern, and state m
+// is a complete match. For each code, the record holds:
+//
+//    length       the length of the string
+//    state0       the state the automaton ends up in after reading the
+//                 string, starting from state 0
+//    match_link   the longest prefix of the string, possibly the whole
+//                 string, that ends with a complete match when read
+//                 from state 0, or NO_CODE if there is none. Following
+//                 these links back through the prefixes lists every
+//                 match in the string.
+//    newlines     the number of newlines in the string, so matches can
+//                 be reported by line
+//    head_owner   the code for the first m bytes of the string
+//
+// Each of these is computed from the record for the prefix in constant
+// time, when the code is added to the dictionary.
+//
+// When a code arrives and the automaton is in state 0, the record says
+// everything there is to know: the new state is state0, and the matches
+// are found by walking match_link. When the automaton is in state q > 0,
+// a match that started in earlier codes might finish in this one, so
+// the search steps through the string one byte at a time, using the
+// bytes from head_owner. But it only has to do that until the state is
+// no bigger than the number of bytes it has read from this string. From
+// then on, the longest partial match lies entirely inside the string, so
+// the state is the same as if it had started from 0, and the record
+// takes over again. That takes at most m steps, so matches that cross
+// code boundaries cost a little extra, and everything else costs a few
+// memory references per code, no matter how long the strings are.
+//
+// The search is told about matches by calling a handler with a
+// search_match, giving the offset of the start of the match in the
+// uncompressed data, and the number of the line the match starts on,
+// counting from 1. Matches are reported in order of their offsets.
+//
+// search_codes() reads one code stream up to its EOF_CODE, starting
+// with an empty dictionary, unless it is told to resume with the one
+// left by the last code stream, as it must for a continuation block.
+// search_bytes() scans bytes that aren't compressed at all, such as a
+// stored block. The automaton state and the
+// position carry over from one call to the next, so a match can span
+// two blocks.
+//
+// A 'P' block from lzw_block.h starts with the dictionary built from
+// the end of the block before it. tail() gets those bytes back from
+// the codes of the last code stream, by walking their prefixes, and
+// prime_codes() builds the dictionary from the code stream prime()
+// makes of them, without searching it or moving the position.
+//
+
+namespace lzw {
+
+struct search_match
+{
+    unsigned long long offset;
+    unsigned long long line;
+};
+
+class compressed_search
+{
+public :
+    compressed_search( const std::string &pattern, unsigned int max_code = 32767 )
+        : m_pattern( pattern ),
+          m_max_code( max_code ),
+          m_pattern_newlines( 0 ),
+          m_state( 0 ),
+          m_position( 0 ),
+          m_lines( 0 )
+    {
+        build_automaton();
+        m_entries.resize( FIRST_CODE );
+        for ( unsigned int i = 0 ; i < 256 ; i++ ) {
+            entry &e = m_entries[ i ];
+            e.prefix = NO_CODE;
+            e.length = 1;
+            e.state0 = m_automaton[ i ];
+            e.match_link = e.state0 == m_pattern.size() ? i : NO_CODE;
+            e.newlines = i == '\n';
+            e.head_owner = i;
+            e.first = (unsigned char) i;
+            e.symbol = (unsigned char) i;
+        }
+        m_head.resize( m_pattern.size() );
+    }
+    template<char FLAVOUR, class INPUT, class HANDLER>
+    bool search_codes( INPUT &input, HANDLER &handler, bool resume = false )
+    {
+        if ( !resume )
+            m_entries.resize( FIRST_CODE );
+        m_stream_codes.clear();
+        return read_codes<FLAVOUR>( input, &handler );
+    }
+    template<char FLAVOUR, class INPUT>
+    bool prime_codes( INPUT &input )
+    {
+        m_entries.resize( FIRST_CODE );
+        return read_codes<FLAVOUR>( input, (ignore_matches *) 0 );
+    }
+    //
+    // Returns false if the last code stream didn't hold that much data.
+    //
+    bool tail( size_t length, std::string &data ) const
+    {
+        size_t first = m_stream_codes.size();
+        size_t total = 0;
+        while ( total < length && first )
+            total += m_entries[ m_stream_codes[ --first ] ].length;
+        if ( total < length )
+            return false;
+        data.resize( total );
+        size_t end = total;
+        for ( size_t i = m_stream_codes.size() ; i-- > first ; )
+            for ( unsigned int code = m_stream_codes[ i ] ; code != NO_CODE ; code = m_entries[ code ].prefix )
+                data[ --end ] = m_entries[ code ].symbol;
+        data.erase( 0, total - length );
+        return true;
+    }
+    template<class HANDLER>
+    void search_bytes( const char *data, size_t length, HANDLER &handler )
+    {
+        m_stream_codes.clear();
+        const unsigned int m = (unsigned int) m_pattern.size();
+        for ( size_t i = 0 ; i < length ; i++ ) {
+            const unsigned char c = data[ i ];
+            m_state = m_automaton[ m_state * 256 + c ];
+            m_lines += c == '\n';
+            if ( m_state == m )
+                report( m_position + i + 1, m_lines, handler );
+        }
+        m_position += length;
+    }
+    //
+    // Each member of a multi-member file can have its own max_code.
+    //
+    void set_max_code( unsigned int max_code ) { m_max_code = max_code; }
+    unsigned int max_code() const { return m_max_code; }
+    //
+    // The number of uncompressed bytes searched so far.
+    //
+    unsigned long long position() const { return m_position; }
+private :
+    struct ignore_matches
+    {
+        void operator()( const search_match & ) {}
+    };
+    //
+    // Without a handler, the codes only build the dictionary.
+    //
+    template<char FLAVOUR, class INPUT, class HANDLER>
+    bool read_codes( INPUT &input, HANDLER *handler )
+    {
+        flavoured<INPUT,FLAVOUR> flavoured_input( input );
+        input_code_stream< flavoured<INPUT,FLAVOUR> > in( flavoured_input, m_max_code );
+        in.preset( (unsigned int) m_entries.size() );
+        unsigned int previous = NO_CODE;
+        unsigned int code;
+        while ( in >> code ) {
+            const unsigned int next_code = (unsigned int) m_entries.size();
+            const bool room = previous != NO_CODE && next_code <= m_max_code;
+            if ( code == next_code && room )
+                add( previous, m_entries[ previous ].first );
+            else if ( code == EOF_CODE || code >= next_code )
+                return false;
+            else if ( room )
+                add( previous, m_entries[ code ].first );
+            if ( handler ) {
+                scan( code, *handler );
+                m_stream_codes.push_back( code );
+            }
+            previous = code;
+        }
+        return true;
+    }
+    struct entry
+    {
+        unsigned int prefix;
+        unsigned int length;
+        unsigned int state0;
+        unsigned int match_link;
+        unsigned int newlines;
+        unsigned int head_owner;
+        unsigned char first;
+        unsigned char symbol;
+    };
+    //
+    // The standard KMP construction: each state copies the transitions
+    // of the state we would fall back to on a mismatch, then overrides
+    // the one for the next pattern byte. The match state m gets the
+    // transitions of the fallback state, so overlapping matches are
+    // found.
+    //
+    void build_automaton()
+    {
+        const unsigned int m = (unsigned int) m_pattern.size();
+        m_automaton.assign( (m + 1) * 256, 0 );
+        unsigned int fallback = 0;
+        for ( unsigned int j = 0 ; j < m ; j++ ) {
+            const unsigned char c = m_pattern[ j ];
+            m_pattern_newlines += c == '\n';
+            if ( j ) {
+                for ( int i = 0 ; i < 256 ; i++ )
+                    m_automaton[ j * 256 + i ] = m_automaton[ fallback * 256 + i ];
+                fallback = m_automaton[ fallback * 256 + c ];
+            }
+            m_automaton[ j * 256 + c ] = j + 1;
+        }
+        for ( int i = 0 ; i < 256 ; i++ )
+            m_automaton[ m * 256 + i ] = m ? m_automaton[ fallback * 256 + i ] : 0;
+    }
+    void add( unsigned int prefix, unsigned char symbol )
+    {
+        const unsigned int code = (unsigned int) m_entries.size();
+        const entry p = m_entries[ prefix ];
+        entry e;
+        e.prefix = prefix;
+        e.length = p.length + 1;
+        e.state0 = m_automaton[ p.state0 * 256 + symbol ];
+        e.match_link = e.state0 == m_pattern.size() ? code : p.match_link;
+        e.newlines = p.newlines + (symbol == '\n');
+        e.head_owner = e.length <= m_pattern.size() ? code : p.head_owner;
+        e.first = p.first;
+        e.symbol = symbol;
+        m_entries.push_back( e );
+    }
+    template<class HANDLER>
+    void scan( unsigned int code, HANDLER &handler )
+    {
+        const entry &e = m_entries[ code ];
+        unsigned int state = m_state;
+        unsigned int used = 0;
+        unsigned int newlines = 0;
+        if ( state ) {
+            const unsigned int m = (unsigned int) m_pattern.size();
+            unsigned int owner = e.head_owner;
+            for ( unsigned int i = m_entries[ owner ].length ; i-- ; owner = m_entries[ owner ].prefix )
+                m_head[ i ] = m_entries[ owner ].symbol;
+            while ( used < e.length && state > used ) {
+                const unsigned char c = m_head[ used++ ];
+                state = m_automaton[ state * 256 + c ];
+                newlines += c == '\n';
+                if ( state == m )
+                    report( m_position + used, m_lines + newlines, handler );
+            }
+        }
+        if ( used < e.length ) {
+            state = e.state0;
+            m_ends.clear();
+            unsigned int link = e.match_link;
+            while ( link != NO_CODE && m_entries[ link ].length > used ) {
+                m_ends.push_back( link );
+                const unsigned int prefix = m_entries[ link ].prefix;
+                link = prefix == NO_CODE ? NO_CODE : m_entries[ prefix ].match_link;
+            }
+            for ( size_t i = m_ends.size() ; i-- ; ) {
+                const entry &match = m_entries[ m_ends[ i ] ];
+                report( m_position + match.length, m_lines + match.newlines, handler );
+            }
+        }
+        m_state = state;
+        m_position += e.length;
+        m_lines += e.newlines;
+    }
+    //
+    // end is the offset just past the last byte of the match, and
+    // newlines is the number of newlines before that point.
+    //
+    template<class HANDLER>
+    void report( unsigned long long end, unsigned long long newlines, HANDLER &handler )
+    {
+        search_match match = { end - m_pattern.size(), newlines - m_pattern_newlines + 1 };
+        handler( match );
+    }
+    std::string m_pattern;
+    unsigned int m_max_code;
+    unsigned int m_pattern_newlines;
+    std::vector<unsigned int> m_automaton;
+    std::vector<entry> m_entries;
+    std::vector<unsigned int> m_ends;
+    std::vector<unsigned int> m_stream_codes;
+    std::string m_head;
+    unsigned int m_state;
+    unsigned long long m_position;
+    unsigned long long m_lines;
+};
+
+}; //namespace lzw
+
+#endif //#ifndef LZW_SEARCH_DOT_H
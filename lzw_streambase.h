@@ -87,12 +87,24 @@ public :
 
 const unsigned int EOF_CODE = 256;
 
+//
+// The biggest max_code any of the code streams will accept. Codes are
+// unsigned ints, and NO_CODE, ~0u, is reserved to mean no code at all,
+// so this leaves the top bit free as well, which keeps the arithmetic
+// in lzw-d.h, which doubles the point where the code size grows, from
+// overflowing. lzw-b is stuck at 16 bits no matter what. A dictionary
+// this big would need tens of gigabytes, so in practice the memory
+// runs out long before the codes do.
+//
+const unsigned int LARGEST_MAX_CODE = 0x7fffffff;
+
 template<typename T>
 class input_code_stream
 {
 public :
     input_code_stream( T &, unsigned int );
     bool operator>>( unsigned int &i );
+    void preset( unsigned int next_code );
 };
 
 //
@@ -108,6 +120,60 @@ class output_code_stream
 public :
     output_code_stream( T &, unsigned int );
     void operator<<( const unsigned int i );
+    void preset( unsigned int next_code );
+};
+
+//
+// Both code stream classes have a preset() member, which is called
+// when the dictionary starts out holding more than the 256 roots,
+// as it does when a primed base_dictionary is used. The argument
+// is the first code the dictionary will assign. Code streams with
+// a fixed code width can ignore it, but a stream like lzw-d that
+// grows the code width along with the dictionary has to skip ahead.
+//
+
+//
+// The four flavours of code stream in lzw-a.h through lzw-d.h were
+// originally written as specializations for std::istream and
+// std::ostream, which meant that only one of them could be included
+// in a given program. To let them coexist, each flavour now
+// specializes the code streams for flavoured<T,FLAVOUR>, a tiny
+// wrapper around a reference to any byte stream T that supports
+// get(char&) and put(char) the way the iostreams classes do.
+// Calling compress() with flavoured<std::ostream,'c'> selects the
+// lzw-c format at compile time, with no runtime cost, while a
+// flavoured<std::ostream,'d'> in the same program selects lzw-d.
+//
+// The symbol streams don't depend on the flavour, so the
+// specializations below just pass through to the symbol stream
+// for the wrapped type.
+//
+
+template<class T, char FLAVOUR>
+class flavoured
+{
+public :
+    flavoured( T &stream ) 
+        : m_stream( stream ) {}
+    T &stream() const { return m_stream; }
+private :
+    T &m_stream;
+};
+
+template<class T, char FLAVOUR>
+class input_symbol_stream< flavoured<T,FLAVOUR> > : public input_symbol_stream<T>
+{
+public :
+    input_symbol_stream( flavoured<T,FLAVOUR> input ) 
+        : input_symbol_stream<T>( input.stream() ) {}
+};
+
+template<class T, char FLAVOUR>
+class output_symbol_stream< flavoured<T,FLAVOUR> > : public output_symbol_stream<T>
+{
+public :
+    output_symbol_stream( flavoured<T,FLAVOUR> output ) 
+        : output_symbol_stream<T>( output.stream() ) {}
 };
 
 }; //namespace lzw
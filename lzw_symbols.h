@@ -0,0 +1,400 @@
+//
+// Copyright (c) 2011 Mark Nelson
+//
+// This software is licensed under the OSI MIT License, contained in
+// the file license.txt included with this project.
+//
+#ifndef LZW_SYMBOLS_DOT_H
+#define LZW_SYMBOLS_DOT_H
+
+#include <cstddef>
+#include <vector>
+#include "lzw_streambase.h"
+#include "lzw_dictionary.h"
+#include "lzw_header.h"
+#include "lzw_block.h"
+
+//
+// Everything in lzw.h works on bytes, which is what the article is
+// about, and what a file is. But a lot of data is really a sequence of
+// bigger symbols: UTF-16 text, the token numbers that come out of a
+// tokenizer, sensor IDs in a log. Compressing those a byte at a time
+// works, but LZW then has to learn every symbol as a two or four byte
+// string before it can start learning the sequences it is really made
+// of, and each step of the compressor only covers half or a quarter of
+// a symbol. The classes here run LZW directly on the symbols.
+//
+// The only thing about the algorithm that depends on the alphabet is
+// the set of root codes, the single symbol strings every dictionary
+// starts with. The alphabet class describes them. It takes the symbol
+// type and the number of symbols, which defaults to every value the
+// type can hold for 8 and 16 bit types. Wider types have to say how
+// many symbols they use, since the roots take up that many codes.
+//
+// The code streams in lzw-a.h through lzw-d.h reserve EOF_CODE, 256,
+// so symbol s gets root code s below that and s + 1 from there on, and
+// the first code added to the dictionary is one past the last root.
+// For an alphabet of 256 that's exactly the byte format, and for any
+// alphabet the code streams don't have to change at all: preset() tells
+// lzw-d how wide the codes start out, and lzw-c sizes its codes from
+// max_code, which is never allowed to be less than the last root.
+// lzw-b's 16 bit codes can only carry alphabets of up to 65,000 or so.
+//
+// symbol_compressor and symbol_decompressor work like compressor and
+// decompressor, except that they read and write symbols through get()
+// and put() on their own input and output types, which also makes it
+// easy to feed them from memory. Two of those are here:
+// symbol_array_input and symbol_vector_output. Since the dictionary
+// engines other than code_hash store symbols as bytes, the compressor
+// always uses code_hash.
+//
+// compress_symbol_stream() and decompress_symbol_stream() handle the
+// common case of symbols stored in a file, little-endian, which is
+// what the lzw program's -sym option uses. The stream has a header
+// with HAS_SYMBOLS set, recording the symbol size and alphabet, and
+// then uses the block format from lzw_block.h, except that the code
+// streams in the LZW blocks are made of symbols. If the length of the
+// input isn't a whole number of symbols, the bytes left over at the
+// end go in a stored block. A big alphabet takes longer to learn, so
+// the blocks are bigger than usual, 8MB by default.
+//
+
+namespace lzw {
+
+const size_t SYMBOL_BLOCK_SIZE = 1 << 23;
+
+template<class SYMBOL>
+struct default_alphabet_size
+{
+    static const unsigned int value = sizeof( SYMBOL ) <= 2 ? 1u << (8 * sizeof( SYMBOL )) : 0;
+};
+
+template<class SYMBOL, unsigned int SIZE = default_alphabet_size<SYMBOL>::value>
+struct alphabet
+{
+    static_assert( SIZE != 0, "symbols wider than 16 bits need an explicit alphabet size" );
+    typedef SYMBOL symbol_type;
+    static const unsigned int size = SIZE;
+    static const unsigned int first_code = (SIZE > EOF_CODE ? SIZE : EOF_CODE) + 1;
+    static bool contains( SYMBOL s ) { return (unsigned long long) s < SIZE; }
+    static unsigned int root( SYMBOL s )
+    {
+        const unsigned int value = (unsigned int) s;
+        return value + (value >= EOF_CODE);
+    }
+    static bool is_root( unsigned int code ) { return code < first_code && code != EOF_CODE; }
+    static SYMBOL symbol( unsigned int root ) { return SYMBOL( root - (root > EOF_CODE) ); }
+    //
+    // A max_code that doesn't leave room for all the roots is raised
+    // to the last one, on both sides of the stream.
+    //
+    static unsigned int fit_max_code( unsigned int max_code )
+    {
+        return max_code < first_code - 1 ? first_code - 1 : max_code;
+    }
+};
+
+template<class SYMBOL>
+class symbol_array_input
+{
+public :
+    symbol_array_input( const SYMBOL *data, size_t length )
+        : m_next( data ),
+          m_end( data + length ) {}
+    bool get( SYMBOL &s )
+    {
+        if ( m_next == m_end )
+            return false;
+        s = *m_next++;
+        return true;
+    }
+private :
+    const SYMBOL *m_next;
+    const SYMBOL *m_end;
+};
+
+template<class SYMBOL>
+class symbol_vector_output
+{
+public :
+    symbol_vector_output( std::vector<SYMBOL> &data )
+        : m_data( data ) {}
+    void put( SYMBOL s ) { m_data.push_back( s ); }
+private :
+    std::vector<SYMBOL> &m_data;
+};
+
+//
+// compress() returns false if it meets a symbol that isn't in the
+// alphabet. The code stream is ended at that point, so the output is
+// still a valid stream, holding everything before the bad symbol.
+//
+template<class ALPHABET>
+class symbol_compressor
+{
+public :
+    typedef typename ALPHABET::symbol_type symbol_type;
+    symbol_compressor( const unsigned int max_code = ALPHABET::first_code + 65535 )
+        : m_next_code( ALPHABET::first_code ),
+          m_max_code( ALPHABET::fit_max_code( max_code ) ) {}
+    template<class INPUT, class OUTPUT>
+    bool compress( INPUT &input, OUTPUT &output )
+    {
+        m_codes.reset();
+        m_next_code = ALPHABET::first_code;
+        output_code_stream<OUTPUT> out( output, m_max_code );
+        out.preset( m_next_code );
+        symbol_type s;
+        if ( !input.get( s ) )
+            return true;
+        if ( !ALPHABET::contains( s ) )
+            return false;
+        unsigned int current_code = ALPHABET::root( s );
+        while ( input.get( s ) ) {
+            if ( !ALPHABET::contains( s ) ) {
+                out << current_code;
+                return false;
+            }
+            const unsigned int symbol = (unsigned int) s;
+            const unsigned int code = m_codes.empty() ? NO_CODE : m_codes.find( current_code, symbol );
+            if ( code != NO_CODE )
+                current_code = code;
+            else {
+                if ( m_next_code <= m_max_code )
+                    m_codes.insert( current_code, symbol, m_next_code++ );
+                out << current_code;
+                current_code = ALPHABET::root( s );
+            }
+        }
+        out << current_code;
+        return true;
+    }
+    unsigned int max_code() const { return m_max_code; }
+    size_t peak_bytes() const { return m_codes.peak_bytes(); }
+private :
+    code_hash m_codes;
+    unsigned int m_next_code;
+    unsigned int m_max_code;
+};
+
+//
+// decompress() returns false if the code stream is damaged.
+//
+template<class ALPHABET>
+class symbol_decompressor
+{
+public :
+    typedef typename ALPHABET::symbol_type symbol_type;
+    symbol_decompressor( const unsigned int max_code = ALPHABET::first_code + 65535 )
+        : m_max_code( ALPHABET::fit_max_code( max_code ) ) {}
+    template<class INPUT, class OUTPUT>
+    bool decompress( INPUT &input, OUTPUT &output )
+    {
+        m_entries.clear();
+        input_code_stream<INPUT> in( input, m_max_code );
+        in.preset( ALPHABET::first_code );
+        unsigned int previous_code = NO_CODE;
+        unsigned int code;
+        while ( in >> code ) {
+            if ( contains( code ) )
+                expand( code, m_current );
+            else {
+                if ( previous_code == NO_CODE || code != next_code() )
+                    return false;
+                m_current = m_previous;
+                m_current.push_back( m_previous[ 0 ] );
+            }
+            for ( size_t i = 0 ; i < m_current.size() ; i++ )
+                output.put( m_current[ i ] );
+            if ( previous_code != NO_CODE && next_code() <= m_max_code ) {
+                entry e = { previous_code, length( previous_code ) + 1, m_current[ 0 ] };
+                m_entries.push_back( e );
+            }
+            previous_code = code;
+            m_previous.swap( m_current );
+        }
+        return true;
+    }
+    unsigned int max_code() const { return m_max_code; }
+private :
+    struct entry
+    {
+        unsigned int prefix;
+        unsigned int length;
+        symbol_type symbol;
+    };
+    unsigned int next_code() const { return ALPHABET::first_code + (unsigned int) m_entries.size(); }
+    bool contains( unsigned int code ) const
+    {
+        return ALPHABET::is_root( code ) || (code >= ALPHABET::first_code && code < next_code());
+    }
+    unsigned int length( unsigned int code ) const
+    {
+        return code < ALPHABET::first_code ? 1 : m_entries[ code - ALPHABET::first_code ].length;
+    }
+    void expand( unsigned int code, std::vector<symbol_type> &s ) const
+    {
+        s.resize( length( code ) );
+        size_t i = s.size();
+        while ( code >= ALPHABET::first_code ) {
+            const entry &e = m_entries[ code - ALPHABET::first_code ];
+            s[ --i ] = e.symbol;
+            code = e.prefix;
+        }
+        s[ --i ] = ALPHABET::symbol( code );
+    }
+    std::vector<entry> m_entries;
+    std::vector<symbol_type> m_previous;
+    std::vector<symbol_type> m_current;
+    unsigned int m_max_code;
+};
+
+template<class ALPHABET, class INPUT, class OUTPUT>
+bool compress_symbols( INPUT &input, OUTPUT &output, const unsigned int max_code = ALPHABET::first_code + 65535 )
+{
+    return symbol_compressor<ALPHABET>( max_code ).compress( input, output );
+}
+
+template<class ALPHABET, class INPUT, class OUTPUT>
+bool decompress_symbols( INPUT &input, OUTPUT &output, const unsigned int max_code = ALPHABET::first_code + 65535 )
+{
+    return symbol_decompressor<ALPHABET>( max_code ).decompress( input, output );
+}
+
+//
+// Symbols packed little-endian in a byte stream. An incomplete symbol
+// at the end of the input is treated as the end of the input.
+//
+template<class SYMBOL, class INPUT>
+class packed_symbol_input
+{
+public :
+    packed_symbol_input( INPUT &input )
+        : m_input( input ) {}
+    bool get( SYMBOL &s )
+    {
+        char bytes[ sizeof( SYMBOL ) ];
+        m_input.read( bytes, sizeof( SYMBOL ) );
+        if ( (size_t) m_input.gcount() < sizeof( SYMBOL ) )
+            return false;
+        unsigned long long value = 0;
+        for ( size_t i = sizeof( SYMBOL ) ; i-- ; )
+            value = (value << 8) | (unsigned char) bytes[ i ];
+        s = SYMBOL( value );
+        return true;
+    }
+private :
+    INPUT &m_input;
+};
+
+template<class SYMBOL, class OUTPUT>
+class packed_symbol_output
+{
+public :
+    packed_symbol_output( OUTPUT &output )
+        : m_output( output ) {}
+    void put( SYMBOL s )
+    {
+        char bytes[ sizeof( SYMBOL ) ];
+        unsigned long long value = (unsigned long long) s;
+        for ( size_t i = 0 ; i < sizeof( SYMBOL ) ; i++, value >>= 8 )
+            bytes[ i ] = char( value & 0xff );
+        m_output.write( bytes, sizeof( SYMBOL ) );
+    }
+private :
+    OUTPUT &m_output;
+};
+
+//
+// Compress little-endian symbols from input, which needs read() and
+// gcount(), to output, writing the header as well. Returns false if
+// the input holds a symbol outside the alphabet.
+//
+template<char FLAVOUR, class ALPHABET, class INPUT, class OUTPUT>
+bool compress_symbol_stream( INPUT &input,
+                             OUTPUT &output,
+                             unsigned int max_code,
+                             size_t block_size = SYMBOL_BLOCK_SIZE )
+{
+    typedef typename ALPHABET::symbol_type symbol_type;
+    max_code = ALPHABET::fit_max_code( max_code );
+    block_size -= block_size % sizeof( symbol_type );
+    if ( !block_size )
+        block_size = SYMBOL_BLOCK_SIZE;
+    stream_header header;
+    header.set_blocks();
+    header.set_max_code( max_code );
+    header.set_symbols( sizeof( symbol_type ), ALPHABET::size );
+    header.set_flavour( FLAVOUR );
+    header.write( output );
+    symbol_compressor<ALPHABET> compressor( max_code );
+    std::string data( block_size, 0 );
+    std::string packed;
+    bool ok = true;
+    for ( ; ; ) {
+        input.read( &data[ 0 ], block_size );
+        const size_t n = (size_t) input.gcount();
+        const size_t whole = n - n % sizeof( symbol_type );
+        if ( whole ) {
+            packed.clear();
+            memory_input in( data.data(), whole );
+            memory_output out( packed );
+            packed_symbol_input<symbol_type,memory_input> symbols( in );
+            flavoured<memory_output,FLAVOUR> flavoured_out( out );
+            ok = compressor.compress( symbols, flavoured_out ) && ok;
+            output.put( char( LZW_BLOCK ) );
+            write_varint( output, whole );
+            write_varint( output, packed.size() );
+            output.write( packed.data(), packed.size() );
+        }
+        if ( whole < n ) {
+            output.put( char( STORED_BLOCK ) );
+            write_varint( output, n - whole );
+            output.write( data.data() + whole, n - whole );
+        }
+        if ( n < block_size )
+            break;
+    }
+    output.put( char( END_BLOCK ) );
+    return ok;
+}
+
+//
+// Decompress the blocks that follow a header with HAS_SYMBOLS set to
+// match ALPHABET. OUTPUT needs write() as well as put().
+//
+template<char FLAVOUR, class ALPHABET, class INPUT, class OUTPUT>
+bool decompress_symbol_stream( INPUT &input, OUTPUT &output, unsigned int max_code )
+{
+    typedef typename ALPHABET::symbol_type symbol_type;
+    symbol_decompressor<ALPHABET> decompressor( max_code );
+    block_parser parser;
+    std::string data;
+    while ( parser.next( input ) ) {
+        switch ( parser.type() ) {
+        case END_BLOCK :
+            return true;
+        case STORED_BLOCK :
+            output.write( parser.data().data(), parser.data().size() );
+            break;
+        case LZW_BLOCK : {
+            data.clear();
+            memory_input in( parser.data() );
+            memory_output out( data );
+            flavoured<memory_input,FLAVOUR> flavoured_in( in );
+            packed_symbol_output<symbol_type,memory_output> symbols( out );
+            if ( !decompressor.decompress( flavoured_in, symbols ) || data.size() != parser.length() )
+                return false;
+            output.write( data.data(), data.size() );
+            break;
+        }
+        default :
+            return false;
+        }
+    }
+    return false;
+}
+
+}; //namespace lzw
+
+#endif //#ifndef LZW_SYMBOLS_DOT_H
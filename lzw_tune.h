@@ -0,0 +1,105 @@
+//
+// Copyright (c) 2011 Mark Nelson
+//
+// This software is licensed under the OSI MIT License, contained in
+// the file license.txt included with this project.
+//
+#ifndef LZW_TUNE_DOT_H
+#define LZW_TUNE_DOT_H
+
+#include <string>
+#include <cstddef>
+#include "lzw_streambase.h"
+#include "lzw_memory.h"
+#include "lzw.h"
+
+//
+// There is no one best value for max_code. A small dictionary stays in
+// cache and is quick to search, and on short or varied data it loses
+// very little, since a big dictionary never gets a chance to fill up.
+// On large, repetitive data, a big dictionary can hold the long strings
+// that pay off, and the ratio generally improves as max_code goes up.
+//
+// choose_max_code() settles the question empirically, by compressing a
+// sample of the data with a range of sizes, each about four times the
+// last, and picking the smallest one whose output is within some
+// tolerance of the best. The tolerance
+// comes from the objective: TUNE_RATIO only accepts the best result,
+// TUNE_SPEED gives up as much as 5% to get a smaller table, and
+// TUNE_BALANCED splits the difference at 1%. Comparing sizes instead of
+// timing the trials means the same data always gets the same answer.
+//
+// When the data is compressed in blocks, each block starts with an
+// empty dictionary, so a sample the size of one block is an accurate
+// preview of what every block will see. The price is compressing that
+// sample several times over, which for a full 1MB block costs about
+// as much as compressing another 5 or 6MB of data.
+//
+// compress_blocks() and compress_parallel() take one of these as their
+// objective, and then pick max_code from the first block instead of
+// using the one they were given. TUNE_NONE, the default, leaves
+// max_code alone.
+//
+
+namespace lzw {
+
+enum tuning_objective {
+    TUNE_NONE,
+    TUNE_SPEED,
+    TUNE_BALANCED,
+    TUNE_RATIO
+};
+
+//
+// The largest max_code a flavour can write. lzw-b always writes
+// sixteen bit codes, and the others go all the way to LARGEST_MAX_CODE.
+//
+template<char FLAVOUR>
+unsigned int flavour_max_code()
+{
+    return FLAVOUR == 'b' ? 0xffff : LARGEST_MAX_CODE;
+}
+
+template<char FLAVOUR>
+unsigned int choose_max_code( const char *data, size_t length, tuning_objective objective )
+{
+    static const unsigned int candidates[] = {
+        511, 2047, 8191, 32767, 65535, 262143, 1048575
+    };
+    const int count = sizeof( candidates ) / sizeof( candidates[ 0 ] );
+    size_t sizes[ count ];
+    size_t best = 0;
+    std::string packed;
+    int tried = 0;
+    while ( tried < count && candidates[ tried ] <= flavour_max_code<FLAVOUR>() ) {
+        packed.clear();
+        memory_input in( data, length );
+        memory_output out( packed );
+        flavoured<memory_input,FLAVOUR> flavoured_in( in );
+        flavoured<memory_output,FLAVOUR> flavoured_out( out );
+        compressor trial( candidates[ tried ] );
+        trial.compress( flavoured_in, flavoured_out );
+        sizes[ tried ] = packed.size();
+        if ( !tried || sizes[ tried ] < best )
+            best = sizes[ tried ];
+        //
+        // If the sample didn't fill this dictionary, it won't fill
+        // any of the bigger ones either, so there's no point in
+        // trying them. Note that we can't stop just because a bigger
+        // size did worse than the one before it: the ratio isn't
+        // monotonic, and a dictionary that is a little too small to
+        // hold the useful strings can lose to a much smaller one.
+        //
+        if ( trial.next_code() <= candidates[ tried++ ] )
+            break;
+    }
+    const double tolerance = objective == TUNE_RATIO ? 0 : objective == TUNE_BALANCED ? 0.01 : 0.05;
+    for ( int i = 0 ; i < tried ; i++ )
+        if ( sizes[ i ] <= best + best * tolerance )
+            return candidates[ i ];
+    return candidates[ tried - 1 ];
+}
+
+}; //namespace lzw
+
+#endif //#ifndef LZW_TUNE_DOT_H
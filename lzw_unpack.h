@@ -0,0 +1,238 @@
+//
+// Copyright (c) 2011 Mark Nelson
+//
+// This software is licensed under the OSI MIT License, contained in
+// the file license.txt included with this project.
+//
+#ifndef LZW_UNPACK_DOT_H
+#define LZW_UNPACK_DOT_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include "lzw_streambase.h"
+#if (defined( __GNUC__ ) && defined( __x86_64__ )) || (defined( _MSC_VER ) && defined( _M_X64 ))
+#define LZW_UNPACK_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define LZW_UNPACK_TARGET( features )
+#else
+#define LZW_UNPACK_TARGET( features ) __attribute__(( target( features ) ))
+#endif
+#endif
+
+//
+// In lzw-c every code has the same width, so where each one sits in the
+// stream is known before any of them are read: code i of a run that
+// starts shift bits into a byte covers bits shift + i * width up to
+// shift + (i + 1) * width. The input code stream in lzw-c.h takes them
+// out one at a time, shifting bytes in and codes out of a 64 bit
+// accumulator, and every code has to wait for the one before it to
+// update the accumulator. When the whole code stream is in memory, as
+// it is for every block and for liblzw, the codes can be unpacked in
+// batches instead, with nothing linking one code to the next.
+//
+// Every batch of eight codes is exactly width bytes long, so it starts
+// the same number of bits into its first byte as the batch before it
+// did. That means the byte offsets and shifts within a batch only have
+// to be worked out once for the whole run. There are three versions:
+//
+//    scalar    an unaligned 64 bit load, a shift, and a mask for each
+//              code, which any compiler can interleave
+//    bmi2      the same with shrx and bzhi, which do the variable shift
+//              and the mask without tying up the flags or cl
+//    avx2      eight codes at a time: each 128 bit half of the register
+//              is loaded from where its four codes start, a shuffle
+//              moves the four bytes under each code into its 32 bit
+//              lane, and a per-lane shift and a mask finish the job.
+//              Each code has to fit in 32 bits along with its shift of
+//              up to 7, so this handles widths up to 25 bits, and wider
+//              codes use bmi2.
+//
+// unpack_codes() picks the best one the processor supports the first
+// time it is called, using cpuid, and remembers it. Setting LZW_UNPACK
+// to scalar or bmi2 in the environment holds it back, which is handy for
+// comparing them. Elsewhere than x86-64 the scalar version is all there
+// is. All three produce exactly the same codes.
+//
+// The unpackers read past the last code they return, by up to
+// UNPACK_SLACK bytes, so callers only use them while that much input is
+// left over, and finish the last few codes some other way.
+//
+
+namespace lzw {
+
+typedef void (*unpack_function)( const unsigned char *data,
+                                 unsigned int shift,
+                                 unsigned int width,
+                                 unsigned int *codes,
+                                 size_t count );
+
+enum { UNPACK_SLACK = 32 };
+
+namespace unpack_detail {
+
+inline unsigned long long load64( const unsigned char *data )
+{
+#if defined( __BYTE_ORDER__ ) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    unsigned long long value = 0;
+    for ( int i = 7 ; i >= 0 ; i-- )
+        value = (value << 8) | data[ i ];
+    return value;
+#else
+    unsigned long long value;
+    memcpy( &value, data, sizeof( value ) );
+    return value;
+#endif
+}
+
+//
+// count doesn't have to be a multiple of eight here, so this one also
+// finishes whatever the vector version leaves over.
+//
+inline void unpack_scalar( const unsigned char *data,
+                           unsigned int shift,
+                           unsigned int width,
+                           unsigned int *codes,
+                           size_t count )
+{
+    const unsigned long long mask = ~(~0ull << width);
+    unsigned long long bit = shift;
+    for ( size_t i = 0 ; i < count ; i++, bit += width )
+        codes[ i ] = (unsigned int) ((load64( data + (bit >> 3) ) >> (bit & 7)) & mask);
+}
+
+#ifdef LZW_UNPACK_X86
+
+LZW_UNPACK_TARGET( "bmi2" )
+inline void unpack_bmi2( const unsigned char *data,
+                         unsigned int shift,
+                         unsigned int width,
+                         unsigned int *codes,
+                         size_t count )
+{
+    unsigned long long bit = shift;
+    for ( size_t i = 0 ; i < count ; i++, bit += width )
+        codes[ i ] = (unsigned int) _bzhi_u64( load64( data + (bit >> 3) ) >> (bit & 7), width );
+}
+
+LZW_UNPACK_TARGET( "avx2,bmi2" )
+inline void unpack_avx2( const unsigned char *data,
+                         unsigned int shift,
+                         unsigned int width,
+                         unsigned int *codes,
+                         size_t count )
+{
+    if ( width > 25 ) {
+        unpack_bmi2( data, shift, width, codes, count );
+        return;
+    }
+    //
+    // The second half of the register is loaded from the byte where
+    // code 4 starts, so all the offsets in the shuffle stay under 16.
+    //
+    const unsigned int second_half = (shift + 4 * width) >> 3;
+    unsigned char offsets[ 32 ];
+    unsigned int shifts[ 8 ];
+    for ( unsigned int i = 0 ; i < 8 ; i++ ) {
+        const unsigned int bit = shift + i * width - (i < 4 ? 0 : second_half * 8);
+        shifts[ i ] = bit & 7;
+        for ( unsigned int j = 0 ; j < 4 ; j++ )
+            offsets[ i * 4 + j ] = (unsigned char) ((bit >> 3) + j);
+    }
+    const __m256i shuffle = _mm256_loadu_si256( (const __m256i *) offsets );
+    const __m256i lane_shifts = _mm256_loadu_si256( (const __m256i *) shifts );
+    const __m256i mask = _mm256_set1_epi32( (1 << width) - 1 );
+    size_t i = 0;
+    for ( const unsigned char *p = data ; i + 8 <= count ; i += 8, p += width ) {
+        const __m128i low = _mm_loadu_si128( (const __m128i *) p );
+        const __m128i high = _mm_loadu_si128( (const __m128i *) (p + second_half) );
+        __m256i v = _mm256_inserti128_si256( _mm256_castsi128_si256( low ), high, 1 );
+        v = _mm256_shuffle_epi8( v, shuffle );
+        v = _mm256_and_si256( _mm256_srlv_epi32( v, lane_shifts ), mask );
+        _mm256_storeu_si256( (__m256i *) (codes + i), v );
+    }
+    unpack_bmi2( data + (i / 8) * width, shift, width, codes + i, count - i );
+}
+
+inline void cpu_features( bool &bmi2, bool &avx2 )
+{
+#ifdef _MSC_VER
+    int info[ 4 ];
+    __cpuid( info, 0 );
+    bmi2 = avx2 = false;
+    if ( info[ 0 ] < 7 )
+        return;
+    __cpuidex( info, 7, 0 );
+    bmi2 = (info[ 1 ] & (1 << 8)) != 0;
+    avx2 = (info[ 1 ] & (1 << 5)) != 0;
+    __cpuid( info, 1 );
+    const bool os_saves_ymm = (info[ 2 ] & (1 << 27)) && (_xgetbv( 0 ) & 6) == 6;
+    avx2 = avx2 && os_saves_ymm;
+#else
+    __builtin_cpu_init();
+    bmi2 = __builtin_cpu_supports( "bmi2" ) != 0;
+    avx2 = __builtin_cpu_supports( "avx2" ) != 0;
+#endif
+}
+
+#endif //#ifdef LZW_UNPACK_X86
+
+struct unpack_choice
+{
+    unpack_choice()
+        : function( unpack_scalar ),
+          name( "scalar" )
+    {
+#ifdef LZW_UNPACK_X86
+        bool bmi2;
+        bool avx2;
+        cpu_features( bmi2, avx2 );
+        const char *limit = getenv( "LZW_UNPACK" );
+        if ( limit && !strcmp( limit, "scalar" ) )
+            return;
+        if ( bmi2 ) {
+            function = unpack_bmi2;
+            name = "bmi2";
+        }
+        if ( limit && !strcmp( limit, "bmi2" ) )
+            return;
+        if ( bmi2 && avx2 ) {
+            function = unpack_avx2;
+            name = "avx2";
+        }
+#endif
+    }
+    unpack_function function;
+    const char *name;
+};
+
+inline const unpack_choice &chosen()
+{
+    static const unpack_choice choice;
+    return choice;
+}
+
+}; //namespace unpack_detail
+
+//
+// Unpacks count codes of width bits each, the first one starting shift
+// bits into data.
+//
+inline unpack_function unpack_codes()
+{
+    return unpack_detail::chosen().function;
+}
+
+//
+// "scalar", "bmi2" or "avx2", for --perf to report.
+//
+inline const char *unpack_name()
+{
+    return unpack_detail::chosen().name;
+}
+
+}; //namespace lzw
+
+#endif //#ifndef LZW_UNPACK_DOT_H
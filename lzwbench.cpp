@@ -0,0 +1,205 @@
+//
+// Copyright (c) 2011 Mark Nelson
+//
+// This software is licensed under the OSI MIT License, contained in
+// the file license.txt included with this project.
+//
+// lzwbench.cpp : Per-message latency benchmark.
+//
+// For each message size, this program compresses and decompresses a
+// few thousand messages cut from the sample file at random offsets,
+// timing every message individually, and prints the median and 99th
+// percentile latency in microseconds. Three ways of doing the work
+// are compared:
+//
+//    legacy   the original algorithm, with a std::string keyed
+//             unordered_map sized for max_code and loaded with
+//             256 roots on every call, included here for reference
+//    fresh    calling lzw::compress() and lzw::decompress(), which
+//             build a new context for each message
+//    pooled   leasing a context from lzw::context_pool, so the
+//             dictionary is reset, not rebuilt
+//
+// Usage: lzwbench [-max max_code] [sample-file]
+//
+// If no sample file is given, the benchmark uses its own source code.
+//
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "lzw_streambase.h"
+#include "lzw-d.h"
+#include "lzw_memory.h"
+#include "lzw.h"
+#include "lzw_pool.h"
+
+typedef lzw::flavoured<lzw::memory_input,'d'> code_input;
+typedef lzw::flavoured<lzw::memory_output,'d'> code_output;
+
+//
+// This is compress() and decompress() as they were originally
+// written, before the dictionary was split into layers.
+//
+void legacy_compress( lzw::memory_input &input, lzw::memory_output &output, const unsigned int max_code )
+{
+    code_input fin( input );
+    code_output fout( output );
+    lzw::input_symbol_stream<code_input> in( fin );
+    lzw::output_code_stream<code_output> out( fout, max_code );
+
+    std::unordered_map<std::string, unsigned int> codes( (max_code * 11)/10 );
+    for ( unsigned int i = 0 ; i < 256 ; i++ )
+        codes[std::string(1,i)] = i;
+    unsigned int next_code = 257;
+    std::string current_string;
+    char c;
+    while ( in >> c ) {
+        current_string = current_string + c;
+        if ( codes.find(current_string) == codes.end() ) {
+            if ( next_code <= max_code )
+                codes[ current_string ] = next_code++;
+            current_string.erase(current_string.size()-1);
+            out << codes[current_string];
+            current_string = c;
+        }
+    }
+    if ( current_string.size() )
+        out << codes[current_string];
+}
+
+void legacy_decompress( lzw::memory_input &input, lzw::memory_output &output, const unsigned int max_code )
+{
+    code_input fin( input );
+    code_output fout( output );
+    lzw::input_code_stream<code_input> in( fin, max_code );
+    lzw::output_symbol_stream<code_output> out( fout );
+
+    std::unordered_map<unsigned int,std::string> strings( (max_code * 11) / 10 );
+    for ( int unsigned i = 0 ; i < 256 ; i++ )
+        strings[i] = std::string(1,i);
+    std::string previous_string;
+    unsigned int code;
+    unsigned int next_code = 257;
+    while ( in >> code ) {
+        if ( strings.find( code ) == strings.end() )
+            strings[ code ] = previous_string + previous_string[0];
+        out << strings[code];
+        if ( previous_string.size() && next_code <= max_code )
+            strings[next_code++] = previous_string + strings[code][0];
+        previous_string = strings[code];
+    }
+}
+
+enum method { LEGACY, FRESH, POOLED };
+
+void compress_message( method m, const std::string &message, std::string &compressed, unsigned int max_code )
+{
+    compressed.clear();
+    lzw::memory_input in( message );
+    lzw::memory_output out( compressed );
+    if ( m == LEGACY )
+        legacy_compress( in, out, max_code );
+    else {
+        code_input fin( in );
+        code_output fout( out );
+        if ( m == FRESH )
+            lzw::compress( fin, fout, max_code );
+        else {
+            lzw::context_pool<lzw::compressor>::lease c( max_code );
+            c->compress( fin, fout );
+        }
+    }
+}
+
+void decompress_message( method m, const std::string &compressed, std::string &message, unsigned int max_code )
+{
+    message.clear();
+    lzw::memory_input in( compressed );
+    lzw::memory_output out( message );
+    if ( m == LEGACY )
+        legacy_decompress( in, out, max_code );
+    else {
+        code_input fin( in );
+        code_output fout( out );
+        if ( m == FRESH )
+            lzw::decompress( fin, fout, max_code );
+        else {
+            lzw::context_pool<lzw::decompressor>::lease d( max_code );
+            d->decompress( fin, fout );
+        }
+    }
+}
+
+double percentile( std::vector<double> &samples, double p )
+{
+    std::sort( samples.begin(), samples.end() );
+    size_t i = (size_t) (p * (samples.size() - 1));
+    return samples[ i ];
+}
+
+int main( int argc, char *argv[] )
+{
+    unsigned int max_code = 32767;
+    if ( argc >= 3 && !strcmp( "-max", argv[1] ) ) {
+        if ( sscanf( argv[2], "%u", &max_code ) != 1 ) {
+            std::cerr << "Usage: lzwbench [-max max_code] [sample-file]\n";
+            return 1;
+        }
+        argc -= 2;
+        argv += 2;
+    }
+    std::ifstream file( argc >= 2 ? argv[1] : "lzwbench.cpp", std::ios_base::binary );
+    std::ostringstream buffer;
+    buffer << file.rdbuf();
+    std::string sample = buffer.str();
+    if ( sample.empty() ) {
+        std::cerr << "Can't read sample file\n";
+        return 1;
+    }
+
+    static const size_t sizes[] = { 64, 256, 500, 1024, 4096, 16384, 65536 };
+    static const char *names[] = { "legacy", "fresh", "pooled" };
+    printf( "max_code %u, latency in microseconds\n", max_code );
+    printf( "%8s %-8s %10s %10s %10s %10s\n", "size", "method", "comp p50", "comp p99", "dec p50", "dec p99" );
+    srand( 1 );
+    for ( size_t s = 0 ; s < sizeof(sizes) / sizeof(sizes[0]) ; s++ ) {
+        const size_t size = std::min( sizes[ s ], sample.size() );
+        const int count = size <= 4096 ? 2000 : 200;
+        for ( int m = LEGACY ; m <= POOLED ; m++ ) {
+            std::vector<double> compress_times;
+            std::vector<double> decompress_times;
+            std::string compressed;
+            std::string expanded;
+            for ( int i = 0 ; i < count ; i++ ) {
+                size_t offset = sample.size() > size ? rand() % (sample.size() - size) : 0;
+                std::string message = sample.substr( offset, size );
+                std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+                compress_message( method( m ), message, compressed, max_code );
+                std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+                decompress_message( method( m ), compressed, expanded, max_code );
+                std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+                if ( expanded != message ) {
+                    std::cerr << "Round trip failed for " << names[ m ] << "\n";
+                    return 1;
+                }
+                compress_times.push_back( std::chrono::duration<double, std::micro>( t1 - t0 ).count() );
+                decompress_times.push_back( std::chrono::duration<double, std::micro>( t2 - t1 ).count() );
+            }
+            printf( "%8lu %-8s %10.2f %10.2f %10.2f %10.2f\n",
+                    (unsigned long) size, names[ m ],
+                    percentile( compress_times, 0.5 ), percentile( compress_times, 0.99 ),
+                    percentile( decompress_times, 0.5 ), percentile( decompress_times, 0.99 ) );
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,183 @@
+//
+// Copyright (c) 2011 Mark Nelson
+//
+// This software is licensed under the OSI MIT License, contained in
+// the file license.txt included with this project.
+//
+// lzwc.cpp : Client for the lzwd compression daemon.
+//
+// lzwc takes the same options and file arguments as lzw, for the modes
+// that make sense one file at a time, and has lzwd do the work. The
+// output is exactly what lzw would have written, so the two can be
+// mixed freely. A script that compresses many small files with lzwc
+// doesn't pay for a new dictionary for each one, since the daemon's
+// workers keep theirs.
+//
+
+#include <iostream>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "lzw_streambase.h"
+#include "lzw-fd.h"
+#include "lzw_tune.h"
+#include "lzw_filter.h"
+#include "lzw_daemon.h"
+
+void usage()
+{
+    std::cerr <<
+        "Usage:\n"
+        "lzwc [-s socket] [-f a|b|c|d] [-max max_code] [-raw] [-filter list] -c [input [output]]\n"
+        "lzwc [-s socket] [-f a|b|c|d] [-max max_code] [-filter list] -a input|- output\n"
+        "lzwc [-s socket] [-f a|b|c|d] [-max max_code] -d [input [output]]\n"
+        "\n"
+        "Compresses or decompresses through the lzwd daemon, with the same\n"
+        "options and output as lzw. Input and output default to stdin and\n"
+        "stdout, and - means stdin. The daemon's socket is $LZWD_SOCKET, or\n"
+        "lzwd.sock in $XDG_RUNTIME_DIR or /tmp/lzwd-<uid>, unless -s gives\n"
+        "another. lzwc won't talk to a daemon run by another user.\n";
+    exit(1);
+}
+
+//
+// The daemon needs the length of the data before the data itself, so
+// the input is read in full first.
+//
+bool read_all( int fd, std::string &data )
+{
+    char buffer[ 65536 ];
+    for ( ; ; ) {
+        const long n = lzw::fd_detail::read_some( fd, buffer, sizeof( buffer ) );
+        if ( n < 0 )
+            return false;
+        if ( !n )
+            return true;
+        data.append( buffer, n );
+    }
+}
+
+int main( int argc, char *argv[] )
+{
+    const char *socket_path = 0;
+    lzw::daemon_request request;
+    lzw::filter_chain filters;
+    for ( ; ; ) {
+        if ( argc >= 3 && !strcmp( "-s", argv[1] ) ) {
+            socket_path = argv[2];
+            argc -= 2;
+            argv += 2;
+        } else if ( argc >= 3 && !strcmp( "-f", argv[1] ) ) {
+            if ( strlen( argv[2] ) != 1 || argv[2][0] < 'a' || argv[2][0] > 'd' )
+                usage();
+            request.flavour = argv[2][0];
+            argc -= 2;
+            argv += 2;
+        } else if ( argc >= 3 && !strcmp( "-max", argv[1] ) ) {
+            int max_code;
+            request.objective = lzw::TUNE_NONE;
+            if ( !strcmp( "auto", argv[2] ) )
+                request.objective = lzw::TUNE_BALANCED;
+            else if ( !strcmp( "auto:speed", argv[2] ) )
+                request.objective = lzw::TUNE_SPEED;
+            else if ( !strcmp( "auto:ratio", argv[2] ) )
+                request.objective = lzw::TUNE_RATIO;
+            else if ( sscanf( argv[2], "%d", &max_code ) != 1 || max_code < 256 )
+                usage();
+            else
+                request.max_code = max_code;
+            argc -= 2;
+            argv += 2;
+        } else if ( argc >= 3 && !strcmp( "-filter", argv[1] ) ) {
+            if ( !filters.parse( argv[2] ) )
+                usage();
+            request.filters = filters.specs();
+            argc -= 2;
+            argv += 2;
+        } else if ( argc >= 2 && !strcmp( "-raw", argv[1] ) ) {
+            request.flags |= lzw::RAW_REQUEST;
+            argc--;
+            argv++;
+        } else
+            break;
+    }
+    if ( argc < 2 || argc > 4 )
+        usage();
+    const std::string mode = argv[1];
+    const bool append = mode == "-a";
+    if ( mode == "-d" )
+        request.operation = lzw::DECOMPRESS_REQUEST;
+    else if ( mode != "-c" && !append )
+        usage();
+    if ( request.operation == lzw::DECOMPRESS_REQUEST && request.objective != lzw::TUNE_NONE ) {
+        std::cerr << "Error: -max auto only applies when compressing\n";
+        return 1;
+    }
+    if ( (append && argc != 4) ||
+         ((request.flags & lzw::RAW_REQUEST) && (append || !filters.empty())) ||
+         ((request.flags & lzw::RAW_REQUEST) && request.objective != lzw::TUNE_NONE) ||
+         (request.flavour == 'b' && request.objective == lzw::TUNE_NONE && request.max_code > 0xffff) ||
+         (request.operation == lzw::DECOMPRESS_REQUEST &&
+          (request.flags || !filters.empty())) )
+        usage();
+    signal( SIGPIPE, SIG_IGN );
+    int in_fd = 0;
+    if ( argc >= 3 && std::string( "-" ) != argv[2] ) {
+        in_fd = open( argv[2], O_RDONLY );
+        if ( in_fd < 0 ) {
+            perror( argv[2] );
+            return 1;
+        }
+    }
+    std::string data;
+    if ( !read_all( in_fd, data ) ) {
+        perror( argc >= 3 ? argv[2] : "stdin" );
+        return 1;
+    }
+    const std::string path = lzw::daemon_socket_path( socket_path );
+    const int sock = lzw::daemon_connect( path );
+    if ( sock < 0 ) {
+        std::cerr << "Error: can't connect to lzwd on " << path << ": " << strerror( errno ) << "\n";
+        return 1;
+    }
+    lzw::daemon_status status;
+    std::string result;
+    {
+        lzw::fd_output out( sock, 65536 );
+        lzw::write_request_header( out, request, data.size() );
+        out.write( data.data(), data.size() );
+        lzw::fd_input in( sock, 65536, false );
+        if ( !out.flush() || !lzw::read_response( in, status, result ) ) {
+            std::cerr << "Error: lost connection to lzwd\n";
+            return 1;
+        }
+    }
+    close( sock );
+    if ( status != lzw::DAEMON_OK ) {
+        std::cerr << "Error: " << lzw::daemon_status_string( status ) << "\n";
+        return 1;
+    }
+    int out_fd = 1;
+    if ( argc == 4 ) {
+        out_fd = open( argv[3], O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC), 0666 );
+        if ( out_fd < 0 ) {
+            perror( argv[3] );
+            return 1;
+        }
+    }
+    if ( !lzw::fd_detail::write_all( out_fd, result.data(), result.size() ) ) {
+        perror( argc == 4 ? argv[3] : "stdout" );
+        return 1;
+    }
+    if ( out_fd != 1 && close( out_fd ) ) {
+        perror( argv[3] );
+        return 1;
+    }
+    return 0;
+}
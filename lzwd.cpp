@@ -0,0 +1,705 @@
+//
+// Copyright (c) 2011 Mark Nelson
+//
+// This software is licensed under the OSI MIT License, contained in
+// the file license.txt included with this project.
+//
+// lzwd.cpp : Local compression daemon.
+//
+// lzwd listens on a Unix domain socket for requests in the format
+// described in lzw_daemon.h, and answers each one with the data lzw
+// would have written for the same options. lzwc is the client, and
+// lzwload measures how fast the daemon answers.
+//
+// One thread runs an epoll loop that accepts connections, reads
+// requests, and writes responses, all without blocking. When a request
+// has arrived in full, it goes on a queue for the worker threads, which
+// do the compressing and decompressing. Each worker leases its contexts
+// from lzw::context_pool, so after the first few requests, the
+// dictionaries are already grown to size, and a request costs only the
+// work of compressing it. When a worker is done, it puts the job on the
+// finished list and wakes the loop with an eventfd, and the loop sends
+// the response. Each connection has at most one request in progress, so
+// responses always come back in the order the requests were sent.
+//
+// Usage: lzwd [-s socket] [-j workers]
+//
+// The socket defaults to $LZWD_SOCKET, or lzwd.sock in $XDG_RUNTIME_DIR
+// or /tmp/lzwd-<uid>, and is created with mode 0600. Connections from
+// other users, except root, are closed as soon as they are accepted. The number of workers defaults to the number
+// of processors. lzwd runs in the foreground until it gets SIGINT or
+// SIGTERM, when it stops taking requests, answers the ones it is already
+// working on, removes the socket, and exits.
+//
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "lzw_streambase.h"
+#include "lzw-d.h"
+#include "lzw-a.h"
+#include "lzw-b.h"
+#include "lzw-c.h"
+#include "lzw_memory.h"
+#include "lzw.h"
+#include "lzw_pool.h"
+#include "lzw_block.h"
+#include "lzw_symbols.h"
+#include "lzw_daemon.h"
+
+void usage()
+{
+    std::cerr <<
+        "Usage:\n"
+        "lzwd [-s socket] [-j workers]\n"
+        "\n"
+        "Serves compress and decompress requests from lzwc and lzwload on a\n"
+        "Unix domain socket, $LZWD_SOCKET or lzwd.sock in $XDG_RUNTIME_DIR\n"
+        "or /tmp/lzwd-<uid> by default. Only the same user and root can use it.\n"
+        "Runs until it gets SIGINT or SIGTERM.\n";
+    exit(1);
+}
+
+typedef lzw::alphabet<unsigned short> utf16;
+
+//
+// A request on its way through the workers. The job takes over the
+// connection's input buffer, so the data isn't copied.
+//
+struct job
+{
+    unsigned long long connection;
+    lzw::daemon_request request;
+    std::string input;
+    size_t data;
+    size_t length;
+    lzw::daemon_status status;
+    std::string output;
+};
+
+template<char FLAVOUR>
+void compress_flavour( const job &j, lzw::memory_input &in, lzw::memory_output &out, const lzw::filter_chain &filters )
+{
+    if ( j.request.flags & lzw::RAW_REQUEST ) {
+        lzw::context_pool<lzw::compressor>::lease c( j.request.max_code );
+        lzw::flavoured<lzw::memory_input,FLAVOUR> flavoured_in( in );
+        lzw::flavoured<lzw::memory_output,FLAVOUR> flavoured_out( out );
+        c->compress( flavoured_in, flavoured_out );
+    } else if ( j.request.objective != lzw::TUNE_NONE )
+        lzw::compress_blocks<FLAVOUR>( in, out, j.request.max_code, lzw::block_writer::DEFAULT_BLOCK_SIZE, filters,
+                                       0, j.request.objective );
+    else {
+        lzw::context_pool<lzw::compressor>::lease c( j.request.max_code );
+        lzw::compress_blocks<FLAVOUR>( in, out, *c, lzw::block_writer::DEFAULT_BLOCK_SIZE, filters );
+    }
+}
+
+//
+// The same checks lzw makes on its options: lzw-b can't hold codes
+// past 16 bits, and a bare code stream has nowhere to record filters
+// or a max_code picked for it.
+//
+lzw::daemon_status compress( const job &j, lzw::memory_input &in, lzw::memory_output &out )
+{
+    lzw::filter_chain filters;
+    if ( !filters.set( j.request.filters ) || j.request.max_code < 256 ||
+         (j.request.flavour == 'b' && j.request.objective == lzw::TUNE_NONE && j.request.max_code > 0xffff) ||
+         ((j.request.flags & lzw::RAW_REQUEST) && (!filters.empty() || j.request.objective != lzw::TUNE_NONE)) )
+        return lzw::DAEMON_BAD_REQUEST;
+    switch ( j.request.flavour ) {
+    case 'a' : compress_flavour<'a'>( j, in, out, filters ); break;
+    case 'b' : compress_flavour<'b'>( j, in, out, filters ); break;
+    case 'c' : compress_flavour<'c'>( j, in, out, filters ); break;
+    case 'd' : compress_flavour<'d'>( j, in, out, filters ); break;
+    }
+    return lzw::DAEMON_OK;
+}
+
+//
+// Decodes one member after its header, with the code streams for the
+// flavour the header names.
+//
+template<char FLAVOUR>
+bool decompress_member( lzw::memory_input &in,
+                        lzw::memory_output &out,
+                        const lzw::stream_header &header,
+                        unsigned int max_code,
+                        const lzw::filter_chain &filters )
+{
+    if ( header.has_symbols() )
+        return header.symbol_size() == 2 && header.alphabet_size() == utf16::size &&
+               !header.has_filters() &&
+               lzw::decompress_symbol_stream<FLAVOUR,utf16>( in, out, max_code );
+    lzw::context_pool<lzw::decompressor>::lease d( max_code );
+    if ( header.has_blocks() )
+        return lzw::decompress_blocks<FLAVOUR>( in, out, *d, filters, header.has_primed() );
+    lzw::flavoured<lzw::memory_input,FLAVOUR> flavoured_in( in );
+    lzw::flavoured<lzw::memory_output,FLAVOUR> flavoured_out( out );
+    d->decompress( flavoured_in, flavoured_out );
+    return true;
+}
+
+//
+// The same walk through the members that lzw -d makes: a stream with
+// no header is a bare code stream, in the request's flavour, and
+// otherwise each member has its own header.
+//
+lzw::daemon_status decompress( const job &j, const char *data, size_t length, lzw::memory_output &out )
+{
+    if ( j.request.max_code < 256 )
+        return lzw::DAEMON_BAD_REQUEST;
+    for ( bool first = true ; length || first ; first = false ) {
+        lzw::memory_input in( data, length );
+        lzw::stream_header header;
+        unsigned int max_code = j.request.max_code;
+        char flavour = j.request.flavour;
+        lzw::filter_chain filters;
+        if ( !lzw::stream_header::present( data, length ) ) {
+            if ( !first )
+                return lzw::DAEMON_BAD_DATA;
+        } else {
+            if ( !header.read( in ) )
+                return lzw::DAEMON_BAD_DATA;
+            if ( header.has_max_code() )
+                max_code = header.max_code();
+            flavour = header.flavour();
+            if ( !filters.set( header.filters() ) || (header.has_filters() && !header.has_blocks()) )
+                return lzw::DAEMON_BAD_DATA;
+        }
+        bool ok = false;
+        switch ( flavour ) {
+        case 'a' : ok = decompress_member<'a'>( in, out, header, max_code, filters ); break;
+        case 'b' : ok = decompress_member<'b'>( in, out, header, max_code, filters ); break;
+        case 'c' : ok = decompress_member<'c'>( in, out, header, max_code, filters ); break;
+        case 'd' : ok = decompress_member<'d'>( in, out, header, max_code, filters ); break;
+        }
+        if ( !ok )
+            return lzw::DAEMON_BAD_DATA;
+        data += in.tellg();
+        length -= in.tellg();
+    }
+    return lzw::DAEMON_OK;
+}
+
+void process( job &j )
+{
+    j.output.clear();
+    try {
+        lzw::memory_output out( j.output );
+        if ( j.request.operation == lzw::COMPRESS_REQUEST ) {
+            lzw::memory_input in( j.input.data() + j.data, j.length );
+            j.status = compress( j, in, out );
+        } else
+            j.status = decompress( j, j.input.data() + j.data, j.length, out );
+    } catch ( std::bad_alloc & ) {
+        j.status = lzw::DAEMON_NO_MEMORY;
+    }
+    if ( j.status != lzw::DAEMON_OK )
+        j.output.clear();
+    std::string().swap( j.input );
+}
+
+//
+// The queue of jobs waiting for a worker, and the list of finished
+// ones waiting for the event loop. Finishing a job writes to the
+// eventfd, which wakes the loop up.
+//
+class workers
+{
+public :
+    workers( unsigned int count, int eventfd )
+        : m_eventfd( eventfd ),
+          m_stopping( false )
+    {
+        for ( unsigned int i = 0 ; i < count ; i++ )
+            m_threads.push_back( std::thread( &workers::run, this ) );
+    }
+    ~workers()
+    {
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_stopping = true;
+        }
+        m_ready.notify_all();
+        for ( size_t i = 0 ; i < m_threads.size() ; i++ )
+            m_threads[ i ].join();
+        for ( size_t i = 0 ; i < m_finished.size() ; i++ )
+            delete m_finished[ i ];
+    }
+    void submit( job *j )
+    {
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_pending.push_back( j );
+        }
+        m_ready.notify_one();
+    }
+    void collect( std::vector<job *> &finished )
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        finished.swap( m_finished );
+    }
+private :
+    workers( const workers & );
+    workers &operator=( const workers & );
+    void run()
+    {
+        for ( ; ; ) {
+            job *j;
+            {
+                std::unique_lock<std::mutex> lock( m_mutex );
+                while ( m_pending.empty() && !m_stopping )
+                    m_ready.wait( lock );
+                if ( m_pending.empty() )
+                    return;
+                j = m_pending.front();
+                m_pending.pop_front();
+            }
+            process( *j );
+            {
+                std::lock_guard<std::mutex> lock( m_mutex );
+                m_finished.push_back( j );
+            }
+            const unsigned long long one = 1;
+            if ( write( m_eventfd, &one, sizeof( one ) ) < 0 )
+                perror( "eventfd" );
+        }
+    }
+    int m_eventfd;
+    bool m_stopping;
+    std::mutex m_mutex;
+    std::condition_variable m_ready;
+    std::deque<job *> m_pending;
+    std::vector<job *> m_finished;
+    std::vector<std::thread> m_threads;
+};
+
+//
+// A client connection. in holds whatever has been read and not yet
+// handed to a worker, and head and body hold the response on its way
+// out, with sent counting how much of the two has been written.
+//
+struct connection
+{
+    connection()
+        : fd( -1 ),
+          busy( false ),
+          closing( false ),
+          sent( 0 ) {}
+    int fd;
+    bool busy;
+    bool closing;
+    std::string in;
+    std::string head;
+    std::string body;
+    size_t sent;
+};
+
+//
+// The first few epoll ids are reserved for the daemon's own file
+// descriptors, and connections are numbered from FIRST_CONNECTION.
+// Ids are never reused, so a job that finishes after its client has
+// gone away won't be sent to some other connection with the same fd.
+//
+enum {
+    LISTEN_ID,
+    WAKE_ID,
+    SIGNAL_ID,
+    FIRST_CONNECTION
+};
+
+class event_loop
+{
+public :
+    event_loop( int listener, int eventfd, int signals, workers &w )
+        : m_epoll( epoll_create1( EPOLL_CLOEXEC ) ),
+          m_listener( listener ),
+          m_eventfd( eventfd ),
+          m_signals( signals ),
+          m_workers( w ),
+          m_next_id( FIRST_CONNECTION ),
+          m_stopping( false )
+    {
+        watch( listener, LISTEN_ID, EPOLLIN, EPOLL_CTL_ADD );
+        watch( eventfd, WAKE_ID, EPOLLIN, EPOLL_CTL_ADD );
+        watch( signals, SIGNAL_ID, EPOLLIN, EPOLL_CTL_ADD );
+    }
+    ~event_loop()
+    {
+        while ( !m_connections.empty() )
+            drop( m_connections.begin()->first );
+        close( m_epoll );
+    }
+    //
+    // When a signal arrives, the loop stops taking new connections and
+    // new requests, but keeps going until every request that already
+    // made it to a worker has been answered.
+    //
+    void run()
+    {
+        epoll_event events[ 64 ];
+        while ( !m_stopping || !m_connections.empty() ) {
+            const int n = epoll_wait( m_epoll, events, 64, -1 );
+            if ( n < 0 ) {
+                if ( errno == EINTR )
+                    continue;
+                perror( "epoll_wait" );
+                return;
+            }
+            for ( int i = 0 ; i < n ; i++ ) {
+                const unsigned long long id = events[ i ].data.u64;
+                if ( id == LISTEN_ID )
+                    accept_all();
+                else if ( id == WAKE_ID )
+                    finish_jobs();
+                else if ( id == SIGNAL_ID )
+                    stop();
+                else
+                    serve( id, events[ i ].events );
+            }
+        }
+    }
+private :
+    event_loop( const event_loop & );
+    event_loop &operator=( const event_loop & );
+    void watch( int fd, unsigned long long id, unsigned int events, int operation )
+    {
+        epoll_event event;
+        event.events = events;
+        event.data.u64 = id;
+        if ( epoll_ctl( m_epoll, operation, fd, &event ) )
+            perror( "epoll_ctl" );
+    }
+    connection *find( unsigned long long id )
+    {
+        std::map<unsigned long long, connection>::iterator c = m_connections.find( id );
+        return c == m_connections.end() ? 0 : &c->second;
+    }
+    void stop()
+    {
+        if ( m_stopping )
+            return;
+        m_stopping = true;
+        epoll_ctl( m_epoll, EPOLL_CTL_DEL, m_listener, 0 );
+        std::vector<unsigned long long> idle;
+        for ( std::map<unsigned long long, connection>::iterator c = m_connections.begin() ; c != m_connections.end() ; ++c )
+            if ( !c->second.busy && c->second.head.empty() )
+                idle.push_back( c->first );
+        for ( size_t i = 0 ; i < idle.size() ; i++ )
+            drop( idle[ i ] );
+    }
+    void accept_all()
+    {
+        for ( ; ; ) {
+            const int fd = accept4( m_listener, 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC );
+            if ( fd < 0 ) {
+                if ( errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR )
+                    perror( "accept" );
+                return;
+            }
+            if ( !lzw::daemon_peer_trusted( fd ) ) {
+                close( fd );
+                continue;
+            }
+            const unsigned long long id = m_next_id++;
+            m_connections[ id ].fd = fd;
+            watch( fd, id, EPOLLIN, EPOLL_CTL_ADD );
+        }
+    }
+    void finish_jobs()
+    {
+        unsigned long long count;
+        if ( read( m_eventfd, &count, sizeof( count ) ) < 0 && errno != EAGAIN )
+            perror( "eventfd" );
+        std::vector<job *> finished;
+        m_workers.collect( finished );
+        for ( size_t i = 0 ; i < finished.size() ; i++ ) {
+            job *j = finished[ i ];
+            connection *c = find( j->connection );
+            if ( c ) {
+                c->busy = false;
+                respond( *c, j->status, j->output );
+                send( j->connection );
+            }
+            delete j;
+        }
+    }
+    void respond( connection &c, lzw::daemon_status status, std::string &body )
+    {
+        c.head.clear();
+        lzw::memory_output out( c.head );
+        lzw::write_response_header( out, status, body.size() );
+        c.body.swap( body );
+        c.sent = 0;
+    }
+    //
+    // Reads everything that has arrived, unless a request is already
+    // being worked on, in which case the rest waits in the socket.
+    //
+    void serve( unsigned long long id, unsigned int events )
+    {
+        if ( !find( id ) )
+            return;
+        connection &c = *find( id );
+        if ( events & EPOLLOUT ) {
+            send( id );
+            return;
+        }
+        if ( events & (EPOLLHUP | EPOLLERR) && !(events & EPOLLIN) ) {
+            drop( id );
+            return;
+        }
+        char buffer[ 65536 ];
+        for ( ; ; ) {
+            const ssize_t n = read( c.fd, buffer, sizeof( buffer ) );
+            if ( n > 0 ) {
+                c.in.append( buffer, n );
+                continue;
+            }
+            if ( n < 0 && errno == EINTR )
+                continue;
+            if ( n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) )
+                break;
+            c.closing = true;
+            break;
+        }
+        dispatch( id );
+    }
+    void dispatch( unsigned long long id )
+    {
+        connection &c = *find( id );
+        if ( m_stopping && !c.busy && c.head.empty() ) {
+            drop( id );
+            return;
+        }
+        if ( c.busy || c.head.size() ) {
+            update( id );
+            return;
+        }
+        lzw::daemon_request request;
+        size_t data = 0;
+        size_t length = 0;
+        size_t used = 0;
+        switch ( lzw::parse_request( c.in.data(), c.in.size(), request, data, length, used ) ) {
+        case lzw::PARSE_MORE :
+            if ( c.closing ) {
+                drop( id );
+                return;
+            }
+            if ( used > c.in.capacity() )
+                c.in.reserve( used );
+            break;
+        case lzw::PARSE_BAD : {
+            std::string empty;
+            respond( c, lzw::DAEMON_BAD_REQUEST, empty );
+            c.closing = true;
+            c.in.clear();
+            send( id );
+            return;
+        }
+        case lzw::PARSE_DONE : {
+            job *j = new job;
+            j->connection = id;
+            j->request = request;
+            j->data = data;
+            j->length = length;
+            j->input.swap( c.in );
+            c.in.assign( j->input, used, std::string::npos );
+            c.busy = true;
+            m_workers.submit( j );
+            break;
+        }
+        }
+        update( id );
+    }
+    //
+    // Writes as much of the response as the socket will take. Once it
+    // is all gone, the next request, if one is already waiting in the
+    // buffer, can start.
+    //
+    void send( unsigned long long id )
+    {
+        connection &c = *find( id );
+        while ( c.sent < c.head.size() + c.body.size() ) {
+            iovec parts[ 2 ];
+            int count = 0;
+            if ( c.sent < c.head.size() ) {
+                parts[ count ].iov_base = &c.head[ c.sent ];
+                parts[ count++ ].iov_len = c.head.size() - c.sent;
+            }
+            const size_t body_sent = c.sent > c.head.size() ? c.sent - c.head.size() : 0;
+            if ( body_sent < c.body.size() ) {
+                parts[ count ].iov_base = &c.body[ body_sent ];
+                parts[ count++ ].iov_len = c.body.size() - body_sent;
+            }
+            const ssize_t n = writev( c.fd, parts, count );
+            if ( n < 0 && errno == EINTR )
+                continue;
+            if ( n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ) {
+                update( id );
+                return;
+            }
+            if ( n < 0 ) {
+                drop( id );
+                return;
+            }
+            c.sent += n;
+        }
+        c.head.clear();
+        std::string().swap( c.body );
+        c.sent = 0;
+        if ( c.closing && !c.in.size() ) {
+            drop( id );
+            return;
+        }
+        dispatch( id );
+    }
+    //
+    // A connection waits for input when it is idle, for the socket to
+    // drain when it has a response to send, and for nothing at all
+    // while a worker has its request.
+    //
+    void update( unsigned long long id )
+    {
+        connection &c = *find( id );
+        unsigned int events = 0;
+        if ( c.head.size() )
+            events = EPOLLOUT;
+        else if ( !c.busy && !c.closing )
+            events = EPOLLIN;
+        watch( c.fd, id, events, EPOLL_CTL_MOD );
+    }
+    void drop( unsigned long long id )
+    {
+        std::map<unsigned long long, connection>::iterator c = m_connections.find( id );
+        if ( c == m_connections.end() )
+            return;
+        close( c->second.fd );
+        m_connections.erase( c );
+    }
+    int m_epoll;
+    int m_listener;
+    int m_eventfd;
+    int m_signals;
+    workers &m_workers;
+    unsigned long long m_next_id;
+    bool m_stopping;
+    std::map<unsigned long long, connection> m_connections;
+};
+
+//
+// If the socket file is already there, it is either in use by another
+// lzwd, or left over from one that didn't get to clean up. Trying to
+// connect tells the two apart, and also catches a socket someone else
+// is listening on, which we mustn't take over.
+//
+int listen_on( const std::string &path )
+{
+    sockaddr_un address;
+    if ( !lzw::daemon_address( path, address ) ) {
+        std::cerr << "Error: socket path is too long: " << path << "\n";
+        return -1;
+    }
+    if ( !lzw::prepare_daemon_directory( path ) ) {
+        std::cerr << "Error: can't use " << lzw::daemon_private_directory() << ": " << strerror( errno ) << "\n";
+        return -1;
+    }
+    const int existing = lzw::daemon_connect( path );
+    if ( existing >= 0 ) {
+        close( existing );
+        std::cerr << "Error: lzwd is already running on " << path << "\n";
+        return -1;
+    }
+    if ( errno == EACCES ) {
+        std::cerr << "Error: another user is listening on " << path << "\n";
+        return -1;
+    }
+    unlink( path.c_str() );
+    const int fd = socket( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+    if ( fd < 0 ) {
+        perror( "socket" );
+        return -1;
+    }
+    const mode_t mask = umask( 0077 );
+    const int bound = bind( fd, (sockaddr *) &address, sizeof( address ) );
+    umask( mask );
+    if ( bound || listen( fd, SOMAXCONN ) ) {
+        perror( path.c_str() );
+        close( fd );
+        return -1;
+    }
+    return fd;
+}
+
+int main( int argc, char *argv[] )
+{
+    const char *socket_path = 0;
+    unsigned int worker_count = std::thread::hardware_concurrency();
+    for ( ; ; ) {
+        if ( argc >= 3 && !strcmp( "-s", argv[1] ) ) {
+            socket_path = argv[2];
+            argc -= 2;
+            argv += 2;
+        } else if ( argc >= 3 && !strcmp( "-j", argv[1] ) ) {
+            if ( sscanf( argv[2], "%u", &worker_count ) != 1 || !worker_count )
+                usage();
+            argc -= 2;
+            argv += 2;
+        } else
+            break;
+    }
+    if ( argc != 1 )
+        usage();
+    if ( !worker_count )
+        worker_count = 1;
+    const std::string path = lzw::daemon_socket_path( socket_path );
+    //
+    // The signals are blocked before any threads start, so they all
+    // inherit the mask, and the signals only ever arrive at the signalfd.
+    //
+    sigset_t signals;
+    sigemptyset( &signals );
+    sigaddset( &signals, SIGINT );
+    sigaddset( &signals, SIGTERM );
+    sigprocmask( SIG_BLOCK, &signals, 0 );
+    signal( SIGPIPE, SIG_IGN );
+    const int signal_fd = signalfd( -1, &signals, SFD_NONBLOCK | SFD_CLOEXEC );
+    const int wake_fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+    if ( signal_fd < 0 || wake_fd < 0 ) {
+        perror( "lzwd" );
+        return 1;
+    }
+    const int listener = listen_on( path );
+    if ( listener < 0 )
+        return 1;
+    std::cerr << "lzwd: listening on " << path << " with " << worker_count << " workers\n";
+    {
+        workers w( worker_count, wake_fd );
+        event_loop loop( listener, wake_fd, signal_fd, w );
+        loop.run();
+        close( listener );
+        unlink( path.c_str() );
+    }
+    close( wake_fd );
+    close( signal_fd );
+    return 0;
+}
@@ -0,0 +1,277 @@
+//
+// Copyright (c) 2011 Mark Nelson
+//
+// This software is licensed under the OSI MIT License, contained in
+// the file license.txt included with this project.
+//
+// lzwload.cpp : Load generator for the lzwd compression daemon.
+//
+// lzwload sends the same file to lzwd over and over, from several
+// client threads at once, timing every request from the moment it
+// starts to send until the whole response has arrived. At the end it
+// prints the throughput, in requests and megabytes per second, and the
+// latency at several percentiles, in microseconds. Three ways of
+// getting the work done can be compared:
+//
+//    daemon     each thread keeps one connection open, and sends one
+//               request after another on it, the default
+//    connect    each request makes a new connection, the way lzwc does
+//    exec       each request runs the lzw program, the way scripts did
+//               before there was a daemon
+//
+// Usage: lzwload [-s socket] [-t threads] [-n requests] [-max max_code]
+//                [-d] [-connect | -exec lzw] file
+//
+// With -d, the file is compressed once, by the daemon, and the requests
+// decompress it. With -exec, the output goes to /dev/null.
+//
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "lzw_streambase.h"
+#include "lzw-fd.h"
+#include "lzw_daemon.h"
+
+void usage()
+{
+    std::cerr <<
+        "Usage:\n"
+        "lzwload [-s socket] [-t threads] [-n requests] [-max max_code]\n"
+        "        [-d] [-connect | -exec lzw] file\n"
+        "\n"
+        "Sends file to lzwd n times, 1000 by default, from t threads, 4 by\n"
+        "default, and reports requests per second and latency percentiles.\n"
+        "-d decompresses instead. -connect makes a new connection for every\n"
+        "request, and -exec runs the given lzw program for each one instead\n"
+        "of using the daemon.\n";
+    exit(1);
+}
+
+enum method {
+    KEEP_OPEN,
+    CONNECT_EACH,
+    EXEC_EACH
+};
+
+struct load
+{
+    std::string path;
+    method how;
+    const char *program;
+    const char *file;
+    std::string compressed_file;
+    lzw::daemon_request request;
+    std::string data;
+    unsigned int requests;
+    std::atomic<unsigned int> started;
+    std::atomic<unsigned int> failed;
+    std::mutex mutex;
+    std::vector<double> latencies;
+};
+
+//
+// One request over an open connection. Returns false if the connection
+// is lost or the daemon reports an error.
+//
+bool round_trip( int sock, const lzw::daemon_request &request, const std::string &data, std::string &result )
+{
+    lzw::fd_output out( sock, 65536 );
+    lzw::write_request_header( out, request, data.size() );
+    out.write( data.data(), data.size() );
+    if ( !out.flush() )
+        return false;
+    lzw::fd_input in( sock, 65536, false );
+    lzw::daemon_status status;
+    return lzw::read_response( in, status, result ) && status == lzw::DAEMON_OK;
+}
+
+bool run_program( const char *program, const char *mode, const std::string &input )
+{
+    const pid_t pid = fork();
+    if ( pid < 0 )
+        return false;
+    if ( !pid ) {
+        execl( program, program, mode, input.c_str(), "/dev/null", (char *) 0 );
+        _exit( 127 );
+    }
+    int status;
+    while ( waitpid( pid, &status, 0 ) < 0 )
+        if ( errno != EINTR )
+            return false;
+    return WIFEXITED( status ) && WEXITSTATUS( status ) == 0;
+}
+
+void client( load *l )
+{
+    typedef std::chrono::steady_clock clock;
+    std::vector<double> latencies;
+    std::string result;
+    int sock = -1;
+    while ( l->started++ < l->requests ) {
+        const clock::time_point start = clock::now();
+        bool ok;
+        if ( l->how == EXEC_EACH ) {
+            const bool decompress = l->request.operation == lzw::DECOMPRESS_REQUEST;
+            ok = run_program( l->program,
+                              decompress ? "-d" : "-c",
+                              decompress ? l->compressed_file : std::string( l->file ) );
+        } else {
+            if ( sock < 0 )
+                sock = lzw::daemon_connect( l->path );
+            ok = sock >= 0 && round_trip( sock, l->request, l->data, result );
+            if ( !ok || l->how == CONNECT_EACH ) {
+                if ( sock >= 0 )
+                    close( sock );
+                sock = -1;
+            }
+        }
+        const double micros = std::chrono::duration<double, std::micro>( clock::now() - start ).count();
+        if ( ok )
+            latencies.push_back( micros );
+        else
+            l->failed++;
+    }
+    if ( sock >= 0 )
+        close( sock );
+    std::lock_guard<std::mutex> lock( l->mutex );
+    l->latencies.insert( l->latencies.end(), latencies.begin(), latencies.end() );
+}
+
+double percentile( const std::vector<double> &sorted, double p )
+{
+    if ( sorted.empty() )
+        return 0;
+    size_t i = (size_t) (p / 100 * sorted.size());
+    return sorted[ i < sorted.size() ? i : sorted.size() - 1 ];
+}
+
+int main( int argc, char *argv[] )
+{
+    const char *socket_path = 0;
+    unsigned int threads = 4;
+    load l;
+    l.how = KEEP_OPEN;
+    l.program = 0;
+    l.requests = 1000;
+    l.started = 0;
+    l.failed = 0;
+    for ( ; ; ) {
+        if ( argc >= 3 && !strcmp( "-s", argv[1] ) ) {
+            socket_path = argv[2];
+            argc -= 2;
+            argv += 2;
+        } else if ( argc >= 3 && !strcmp( "-t", argv[1] ) ) {
+            if ( sscanf( argv[2], "%u", &threads ) != 1 || !threads )
+                usage();
+            argc -= 2;
+            argv += 2;
+        } else if ( argc >= 3 && !strcmp( "-n", argv[1] ) ) {
+            if ( sscanf( argv[2], "%u", &l.requests ) != 1 || !l.requests )
+                usage();
+            argc -= 2;
+            argv += 2;
+        } else if ( argc >= 3 && !strcmp( "-max", argv[1] ) ) {
+            int max_code;
+            if ( sscanf( argv[2], "%d", &max_code ) != 1 || max_code < 256 )
+                usage();
+            l.request.max_code = max_code;
+            argc -= 2;
+            argv += 2;
+        } else if ( argc >= 3 && !strcmp( "-exec", argv[1] ) ) {
+            l.how = EXEC_EACH;
+            l.program = argv[2];
+            argc -= 2;
+            argv += 2;
+        } else if ( argc >= 2 && !strcmp( "-connect", argv[1] ) ) {
+            l.how = CONNECT_EACH;
+            argc--;
+            argv++;
+        } else if ( argc >= 2 && !strcmp( "-d", argv[1] ) ) {
+            l.request.operation = lzw::DECOMPRESS_REQUEST;
+            argc--;
+            argv++;
+        } else
+            break;
+    }
+    if ( argc != 2 )
+        usage();
+    signal( SIGPIPE, SIG_IGN );
+    l.file = argv[1];
+    l.path = lzw::daemon_socket_path( socket_path );
+    const int fd = open( l.file, O_RDONLY );
+    if ( fd < 0 ) {
+        perror( l.file );
+        return 1;
+    }
+    {
+        lzw::fd_input in( fd );
+        char buffer[ 65536 ];
+        while ( in.read( buffer, sizeof( buffer ) ).gcount() )
+            l.data.append( buffer, in.gcount() );
+    }
+    close( fd );
+    //
+    // For decompression, the daemon compresses the file first, and the
+    // result has to decompress back to the original. With -exec, the
+    // compressed copy is written to a temporary file for lzw to read.
+    //
+    if ( l.request.operation == lzw::DECOMPRESS_REQUEST ) {
+        lzw::daemon_request compress = l.request;
+        compress.operation = lzw::COMPRESS_REQUEST;
+        std::string packed;
+        std::string check;
+        const int sock = lzw::daemon_connect( l.path );
+        if ( sock < 0 || !round_trip( sock, compress, l.data, packed ) ||
+             !round_trip( sock, l.request, packed, check ) || check != l.data ) {
+            std::cerr << "Error: lzwd on " << l.path << " didn't compress and decompress the file\n";
+            return 1;
+        }
+        close( sock );
+        l.data.swap( packed );
+        if ( l.how == EXEC_EACH ) {
+            char name[] = "/tmp/lzwloadXXXXXX";
+            const int temp = mkstemp( name );
+            if ( temp < 0 || !lzw::fd_detail::write_all( temp, l.data.data(), l.data.size() ) ) {
+                perror( name );
+                return 1;
+            }
+            close( temp );
+            l.compressed_file = name;
+        }
+    }
+    typedef std::chrono::steady_clock clock;
+    const clock::time_point start = clock::now();
+    std::vector<std::thread> clients;
+    for ( unsigned int i = 0 ; i < threads ; i++ )
+        clients.push_back( std::thread( client, &l ) );
+    for ( size_t i = 0 ; i < clients.size() ; i++ )
+        clients[ i ].join();
+    const double seconds = std::chrono::duration<double>( clock::now() - start ).count();
+    if ( l.compressed_file.size() )
+        unlink( l.compressed_file.c_str() );
+    std::sort( l.latencies.begin(), l.latencies.end() );
+    const double done = (double) l.latencies.size();
+    printf( "%u requests of %lu bytes, %u threads, %u failed, %.3f seconds\n",
+            l.requests, (unsigned long) l.data.size(), threads, l.failed.load(), seconds );
+    printf( "%.1f requests/s, %.1f MB/s\n", done / seconds, done * l.data.size() / seconds / 1e6 );
+    printf( "latency us: p50 %.0f  p90 %.0f  p99 %.0f  p99.9 %.0f  max %.0f\n",
+            percentile( l.latencies, 50 ), percentile( l.latencies, 90 ),
+            percentile( l.latencies, 99 ), percentile( l.latencies, 99.9 ),
+            l.latencies.empty() ? 0 : l.latencies.back() );
+    return l.failed ? 1 : 0;
+}
@@ -0,0 +1,224 @@
+//
+// Copyright (c) 2011 Mark Nelson
+//
+// This software is licensed under the OSI MIT License, contained in
+// the file license.txt included with this project.
+//
+// lzwlog.cpp : Load generator for concurrent_writer.
+//
+// lzwlog starts a number of threads that each write log records, made
+// up to look like the access log of a busy server, into one compressed
+// file, and times every write() call. At the end it prints the
+// throughput, the latency of a write at several percentiles, in
+// microseconds, and how often a producer had to wait for room in the
+// queue. Two ways of sharing the file are compared:
+//
+//    queue    the producers hand their records to a concurrent_writer,
+//             which compresses them on its own thread, the default
+//    mutex    the producers take turns writing to a stream_writer
+//             under a lock, so each one runs the dictionary itself
+//
+// Usage: lzwlog [-t threads] [-n records] [-q capacity] [-max max_code]
+//               [-mutex] output
+//
+// The output is an ordinary compressed file, which lzw -d decodes into
+// the records, each one whole, in the order they were written.
+//
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "lzw_streambase.h"
+#include "lzw-d.h"
+#include "lzw-fd.h"
+#include "lzw_block.h"
+#include "lzw_concurrent.h"
+
+void usage()
+{
+    std::cerr <<
+        "Usage:\n"
+        "lzwlog [-t threads] [-n records] [-q capacity] [-max max_code]\n"
+        "       [-mutex] output\n"
+        "\n"
+        "Writes n log records, a million by default, from t threads, 8 by\n"
+        "default, into one compressed file through a concurrent_writer with\n"
+        "a queue of the given capacity, and reports records per second, the\n"
+        "latency of each write, and how often a writer had to wait for room.\n"
+        "-mutex shares a stream_writer under a lock instead.\n";
+    exit(1);
+}
+
+typedef lzw::concurrent_writer<'d',lzw::fd_output> queued_log;
+typedef lzw::stream_writer<'d',lzw::fd_output> locked_log;
+
+struct load
+{
+    unsigned int records;
+    std::atomic<unsigned int> started;
+    queued_log *queued;
+    locked_log *locked;
+    std::mutex lock;
+    std::mutex mutex;
+    std::vector<double> latencies;
+    std::atomic<unsigned long long> bytes;
+};
+
+//
+// The records vary the way real ones do: a few fields change every
+// time, and the rest come from short lists.
+//
+size_t make_record( char *buffer, size_t size, unsigned int thread, unsigned int n, unsigned int &seed )
+{
+    static const char *methods[] = { "GET", "GET", "GET", "POST", "PUT", "DELETE" };
+    static const char *paths[] = { "/api/v1/items", "/api/v1/users", "/api/v1/orders", "/static/app.js",
+                                   "/static/style.css", "/health", "/api/v1/search" };
+    static const int statuses[] = { 200, 200, 200, 200, 201, 204, 304, 404, 500 };
+    seed = seed * 1103515245 + 12345;
+    const unsigned int r = seed >> 8;
+    return (size_t) snprintf( buffer, size,
+                              "2026-10-19T12:%02u:%02u.%06u thread=%u seq=%u %s %s/%u status=%d bytes=%u us=%u\n",
+                              (n / 60000) % 60, (n / 1000) % 60, r % 1000000, thread, n,
+                              methods[ r % 6 ], paths[ (r >> 3) % 7 ], (r >> 6) % 10000,
+                              statuses[ (r >> 11) % 9 ], (r >> 4) % 65536, (r >> 9) % 5000 );
+}
+
+void producer( load *l, unsigned int thread )
+{
+    typedef std::chrono::steady_clock clock;
+    std::vector<double> latencies;
+    char buffer[ 256 ];
+    unsigned int seed = thread;
+    unsigned long long bytes = 0;
+    unsigned int n;
+    while ( (n = l->started++) < l->records ) {
+        const size_t length = make_record( buffer, sizeof( buffer ), thread, n, seed );
+        const clock::time_point start = clock::now();
+        if ( l->queued )
+            l->queued->write( buffer, length );
+        else {
+            std::lock_guard<std::mutex> lock( l->lock );
+            l->locked->write( buffer, length );
+        }
+        latencies.push_back( std::chrono::duration<double, std::micro>( clock::now() - start ).count() );
+        bytes += length;
+    }
+    l->bytes += bytes;
+    std::lock_guard<std::mutex> lock( l->mutex );
+    l->latencies.insert( l->latencies.end(), latencies.begin(), latencies.end() );
+}
+
+double percentile( const std::vector<double> &sorted, double p )
+{
+    if ( sorted.empty() )
+        return 0;
+    size_t i = (size_t) (p / 100 * sorted.size());
+    return sorted[ i < sorted.size() ? i : sorted.size() - 1 ];
+}
+
+int main( int argc, char *argv[] )
+{
+    unsigned int threads = 8;
+    unsigned int capacity = queued_log::DEFAULT_CAPACITY;
+    int max_code = 32767;
+    bool use_mutex = false;
+    load l;
+    l.records = 1000000;
+    l.started = 0;
+    l.bytes = 0;
+    for ( ; ; ) {
+        if ( argc >= 3 && !strcmp( "-t", argv[1] ) ) {
+            if ( sscanf( argv[2], "%u", &threads ) != 1 || !threads )
+                usage();
+            argc -= 2;
+            argv += 2;
+        } else if ( argc >= 3 && !strcmp( "-n", argv[1] ) ) {
+            if ( sscanf( argv[2], "%u", &l.records ) != 1 )
+                usage();
+            argc -= 2;
+            argv += 2;
+        } else if ( argc >= 3 && !strcmp( "-q", argv[1] ) ) {
+            if ( sscanf( argv[2], "%u", &capacity ) != 1 || !capacity )
+                usage();
+            argc -= 2;
+            argv += 2;
+        } else if ( argc >= 3 && !strcmp( "-max", argv[1] ) ) {
+            if ( sscanf( argv[2], "%d", &max_code ) != 1 || max_code < 256 )
+                usage();
+            argc -= 2;
+            argv += 2;
+        } else if ( argc >= 2 && !strcmp( "-mutex", argv[1] ) ) {
+            use_mutex = true;
+            argc--;
+            argv++;
+        } else
+            break;
+    }
+    if ( argc != 2 )
+        usage();
+    const int fd = open( argv[1], O_WRONLY | O_CREAT | O_TRUNC, 0666 );
+    if ( fd < 0 ) {
+        perror( argv[1] );
+        return 1;
+    }
+    typedef std::chrono::steady_clock clock;
+    double seconds;
+    unsigned long long waits = 0;
+    bool written;
+    {
+        lzw::fd_output out( fd );
+        clock::time_point start;
+        if ( use_mutex ) {
+            locked_log log( out, max_code );
+            l.queued = 0;
+            l.locked = &log;
+            start = clock::now();
+            std::vector<std::thread> producers;
+            for ( unsigned int i = 0 ; i < threads ; i++ )
+                producers.push_back( std::thread( producer, &l, i ) );
+            for ( size_t i = 0 ; i < producers.size() ; i++ )
+                producers[ i ].join();
+            log.close();
+        } else {
+            queued_log log( out, max_code, capacity );
+            l.queued = &log;
+            l.locked = 0;
+            start = clock::now();
+            std::vector<std::thread> producers;
+            for ( unsigned int i = 0 ; i < threads ; i++ )
+                producers.push_back( std::thread( producer, &l, i ) );
+            for ( size_t i = 0 ; i < producers.size() ; i++ )
+                producers[ i ].join();
+            log.close();
+            waits = log.waits();
+        }
+        written = out.flush();
+        seconds = std::chrono::duration<double>( clock::now() - start ).count();
+    }
+    if ( !written || close( fd ) ) {
+        perror( argv[1] );
+        return 1;
+    }
+    std::sort( l.latencies.begin(), l.latencies.end() );
+    const double done = (double) l.latencies.size();
+    printf( "%u records, %llu bytes, %u threads, %s, %.3f seconds\n",
+            l.records, l.bytes.load(), threads, use_mutex ? "mutex" : "queue", seconds );
+    printf( "%.0f records/s, %.1f MB/s, %llu waits for room\n",
+            done / seconds, l.bytes.load() / seconds / 1e6, waits );
+    printf( "write latency us: p50 %.2f  p90 %.2f  p99 %.2f  p99.9 %.2f  max %.0f\n",
+            percentile( l.latencies, 50 ), percentile( l.latencies, 90 ),
+            percentile( l.latencies, 99 ), percentile( l.latencies, 99.9 ),
+            l.latencies.empty() ? 0 : l.latencies.back() );
+    return 0;
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2011 Mark Nelson
+ *
+ * This software is licensed under the OSI MIT License, contained in
+ * the file license.txt included with this project.
+ *
+ * lzwtrain.c : Training driver for the profile guided build of liblzw.
+ *
+ * The pgo target in the Makefile builds this program against an
+ * instrumented copy of the library, runs it over the corpus of files
+ * shipped with the project, and then rebuilds the library using the
+ * profile that was collected. Every file is compressed and expanded
+ * with each of the four flavours at a few different code sizes, and
+ * the round trip is checked, so this doubles as a smoke test of the
+ * C interface. It is written in C to make sure liblzw.h stays usable
+ * from C.
+ *
+ * Usage: lzwtrain file...
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "liblzw.h"
+
+static char *read_file( const char *name, size_t *length )
+{
+    FILE *f = fopen( name, "rb" );
+    char *data;
+    long size;
+    if ( !f )
+        return NULL;
+    fseek( f, 0, SEEK_END );
+    size = ftell( f );
+    fseek( f, 0, SEEK_SET );
+    data = (char *) malloc( size + 1 );
+    if ( data && fread( data, 1, size, f ) != (size_t) size ) {
+        free( data );
+        data = NULL;
+    }
+    fclose( f );
+    *length = size;
+    return data;
+}
+
+/*
+ * Compress and expand one buffer, growing the output buffers
+ * on demand the way a typical caller would. When the size is
+ * recorded in the stream, the expansion buffer is allocated
+ * once, at exactly the right size.
+ */
+static int round_trip( lzw_context *ctx, const char *data, size_t length )
+{
+    size_t capacity = length + 64;
+    size_t compressed_length;
+    size_t expanded_length;
+    char *compressed = (char *) malloc( capacity );
+    char *expanded;
+    int result = lzw_compress( ctx, data, length, compressed, capacity, &compressed_length );
+    if ( result == LZW_ERROR_BUFFER_TOO_SMALL ) {
+        capacity = compressed_length;
+        compressed = (char *) realloc( compressed, capacity );
+        result = lzw_compress( ctx, data, length, compressed, capacity, &compressed_length );
+    }
+    if ( result != LZW_OK ) {
+        free( compressed );
+        return result;
+    }
+    if ( lzw_decompressed_size( compressed, compressed_length, &capacity ) != LZW_OK )
+        capacity = length + 1;
+    expanded = (char *) malloc( capacity + 1 );
+    result = lzw_decompress( ctx, compressed, compressed_length, expanded, capacity, &expanded_length );
+    if ( result == LZW_OK && (expanded_length != length || memcmp( data, expanded, length )) )
+        result = LZW_ERROR_PARAMETER;
+    free( compressed );
+    free( expanded );
+    return result;
+}
+
+int main( int argc, char *argv[] )
+{
+    static const char flavours[] = "abcd";
+    static const unsigned int max_codes[] = { 511, 4095, 32767, 65535 };
+    int failures = 0;
+    int i;
+    if ( argc < 2 ) {
+        fprintf( stderr, "Usage: lzwtrain file...\n" );
+        return 1;
+    }
+    for ( i = 1 ; i < argc ; i++ ) {
+        size_t length;
+        char *data = read_file( argv[ i ], &length );
+        int f;
+        if ( !data ) {
+            fprintf( stderr, "Can't read %s\n", argv[ i ] );
+            failures++;
+            continue;
+        }
+        for ( f = 0 ; flavours[ f ] ; f++ ) {
+            size_t m;
+            for ( m = 0 ; m < sizeof(max_codes) / sizeof(max_codes[0]) ; m++ ) {
+                lzw_context *ctx = lzw_create( flavours[ f ], max_codes[ m ] );
+                int result = ctx ? round_trip( ctx, data, length ) : LZW_ERROR_PARAMETER;
+                if ( result == LZW_OK ) {
+                    lzw_set_flags( ctx, LZW_FLAG_RECORD_SIZE );
+                    result = round_trip( ctx, data, length );
+                }
+                if ( result == LZW_OK ) {
+                    lzw_set_flags( ctx, LZW_FLAG_BLOCKS );
+                    result = round_trip( ctx, data, length );
+                }
+                if ( result != LZW_OK ) {
+                    fprintf( stderr, "%s: flavour %c, max_code %u: %s\n",
+                             argv[ i ], flavours[ f ], max_codes[ m ], lzw_error_string( result ) );
+                    failures++;
+                }
+                lzw_free( ctx );
+            }
+        }
+        free( data );
+    }
+    return failures ? 1 : 0;
+}